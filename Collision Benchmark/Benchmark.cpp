@@ -0,0 +1,483 @@
+//Collision benchmarks, runs without an OpenGL context
+#include "glm.hpp"
+#include "CollisionManager.h"
+#include "collision_math.h"
+
+#include "CollisionGeometry.h"
+#include "SceneCollision.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// settings
+const unsigned int TRIANGLES = 4096;
+const unsigned int QUERIES = 2000;
+//same values as the Model objects of Interactive Room
+const float SCALE = 0.02f;
+const float CELL_SIZE = 5.0f;
+//synthetic trace, used when no recorded trace is given
+const unsigned int TRACE_FRAMES = 3000;
+//where the models are, relative to the benchmark's working directory
+const string ROOT = "../Interactive Room/";
+
+//Random triangles scattered around the origin, roughly the size of the furniture boxes in elipse space
+void makeTriangles(mt19937 &rng, TriangleBatch &batch)
+{
+	uniform_real_distribution<float> position(-20.0f, 20.0f);
+	uniform_real_distribution<float> corner(-3.0f, 3.0f);
+	batch.clear();
+	for (unsigned int i = 0; i < TRIANGLES; i++)
+	{
+		vec3 center(position(rng), position(rng), position(rng));
+		batch.add(center + vec3(corner(rng), corner(rng), corner(rng)),
+			center + vec3(corner(rng), corner(rng), corner(rng)),
+			center + vec3(corner(rng), corner(rng), corner(rng)));
+	}
+	batch.pad();
+}
+
+//Builds a packet the same way askMove does, with a unit elipsoid
+CollisionPacket makePacket(mt19937 &rng)
+{
+	uniform_real_distribution<float> position(-20.0f, 20.0f);
+	uniform_real_distribution<float> velocity(-2.0f, 2.0f);
+	CollisionPacket packet;
+	packet.elipsoidRadius = vec3(1);
+	packet.R3position = vec3(position(rng), position(rng), position(rng));
+	packet.R3velocity = vec3(velocity(rng), velocity(rng), velocity(rng));
+	packet.eBasePoint = packet.R3position;
+	packet.eVelocity = packet.R3velocity;
+	packet.eNormalizedVelocity = normalize(packet.eVelocity);
+	packet.foundCollision = false;
+	packet.nearestDistance = 0.0f;
+	packet.foundEmbedded = false;
+	packet.embeddedDepth = 0.0f;
+	return packet;
+}
+
+void scalarNarrowphase(CollisionPacket* packet, const TriangleBatch &batch)
+{
+	for (unsigned int i = 0; i < batch.count; i++)
+	{
+		CollisionManager::checkTriangle(packet,
+			vec3(batch.x1[i], batch.y1[i], batch.z1[i]),
+			vec3(batch.x2[i], batch.y2[i], batch.z2[i]),
+			vec3(batch.x3[i], batch.y3[i], batch.z3[i]));
+	}
+}
+
+//Compares the batched narrowphase against checkTriangle, then times both in triangles per microsecond
+void benchmarkNarrowphase()
+{
+	mt19937 rng(26);
+	TriangleBatch batch;
+	makeTriangles(rng, batch);
+	vector<CollisionPacket> packets;
+	for (unsigned int i = 0; i < QUERIES; i++)
+		packets.push_back(makePacket(rng));
+
+	//Both paths must agree on the closest hit, and on the deepest triangle the elipsoid starts in
+	unsigned int hits = 0, embedded = 0, mismatches = 0;
+	for (unsigned int i = 0; i < packets.size(); i++)
+	{
+		CollisionPacket scalar = packets[i];
+		CollisionPacket batched = packets[i];
+		scalarNarrowphase(&scalar, batch);
+		CollisionManager::checkTriangleBatch(&batched, batch);
+		if (scalar.foundCollision)
+			hits++;
+		if (scalar.foundEmbedded)
+			embedded++;
+		if (scalar.foundCollision != batched.foundCollision ||
+			(scalar.foundCollision && (abs(scalar.nearestDistance - batched.nearestDistance) > 1e-4f ||
+				distance(scalar.intersectionPoint, batched.intersectionPoint) > 1e-3f)) ||
+			scalar.foundEmbedded != batched.foundEmbedded ||
+			(scalar.foundEmbedded && (abs(scalar.embeddedDepth - batched.embeddedDepth) > 1e-4f ||
+				distance(scalar.embeddedNormal, batched.embeddedNormal) > 1e-3f)))
+			mismatches++;
+	}
+	cout << "narrowphase: " << QUERIES << " queries, " << hits << " hits, " << embedded << " starting embedded, "
+		<< mismatches << " mismatches between scalar and batched" << endl;
+
+	//Zero-area triangles across each query's path (a point, two equal corners, three corners on a line) have no
+	//plane: both paths must skip them rather than hit their vertices or edges
+	TriangleBatch degenerate;
+	for (unsigned int i = 0; i < packets.size(); i++)
+	{
+		vec3 point = packets[i].eBasePoint + 0.5f * packets[i].eVelocity;
+		vec3 side = normalize(cross(packets[i].eVelocity, vec3(0.3f, 1.0f, 0.2f)));
+		degenerate.add(point, point, point);
+		degenerate.add(point - side, point - side, point + side);
+		degenerate.add(point - side, point, point + side);
+	}
+	degenerate.pad();
+	unsigned int degenerateHits = 0;
+	for (unsigned int i = 0; i < packets.size(); i++)
+	{
+		CollisionPacket scalar = packets[i];
+		CollisionPacket batched = packets[i];
+		scalarNarrowphase(&scalar, degenerate);
+		CollisionManager::checkTriangleBatch(&batched, degenerate);
+		if (scalar.foundCollision || scalar.foundEmbedded || batched.foundCollision || batched.foundEmbedded)
+			degenerateHits++;
+	}
+	cout << "narrowphase: " << degenerate.count << " zero-area triangles, " << degenerateHits << " queries hitting them" << endl;
+
+	//timing
+	float sink = 0.0f;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < packets.size(); i++)
+	{
+		CollisionPacket packet = packets[i];
+		scalarNarrowphase(&packet, batch);
+		sink += packet.nearestDistance;
+	}
+	double scalarTime = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+
+	start = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < packets.size(); i++)
+	{
+		CollisionPacket packet = packets[i];
+		CollisionManager::checkTriangleBatch(&packet, batch);
+		sink += packet.nearestDistance;
+	}
+	double batchedTime = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+
+	double triangles = (double)TRIANGLES * QUERIES;
+	cout << "scalar:\t\t" << triangles / scalarTime << " triangles/us" << endl;
+	cout << "batched (" << CollisionManager::batchWidth() << " wide):\t" << triangles / batchedTime << " triangles/us" << endl;
+	cout << "speedup:\t" << scalarTime / batchedTime << "x\t(" << sink << ")" << endl;
+}
+
+//OBJ vertex index, 1 based or negative from the end of the vertices read so far
+unsigned int objIndex(const string &token, unsigned int vertexCount)
+{
+	int index = atoi(token.substr(0, token.find('/')).c_str());
+	return index < 0 ? vertexCount + index : index - 1;
+}
+
+//Reads the positions of an OBJ file. Like Assimp, it splits the file into one mesh per group and material,
+//and each mesh gets its own bounding box and collision mesh
+bool loadObj(const string &file, PlainGeometry &geometry)
+{
+	ifstream in(file);
+	if (!in.is_open())
+		return false;
+
+	vector<vec3> vertices;
+	vector<vector<unsigned int>> groups(1);
+	string line, type, token;
+	while (getline(in, line))
+	{
+		istringstream words(line);
+		if (!(words >> type))
+			continue;
+		if (type == "v")
+		{
+			vec3 v;
+			words >> v.x >> v.y >> v.z;
+			vertices.push_back(v);
+		}
+		else if (type == "g" || type == "o" || type == "usemtl")
+		{
+			if (!groups.back().empty())
+				groups.push_back(vector<unsigned int>());
+		}
+		else if (type == "f")
+		{
+			//fan triangulation of the polygon
+			vector<unsigned int> face;
+			while (words >> token)
+				face.push_back(objIndex(token, vertices.size()));
+			for (unsigned int i = 2; i < face.size(); i++)
+			{
+				groups.back().push_back(face[0]);
+				groups.back().push_back(face[i - 1]);
+				groups.back().push_back(face[i]);
+			}
+		}
+	}
+
+	for (unsigned int g = 0; g < groups.size(); g++)
+	{
+		//keep only the vertices this group uses
+		map<unsigned int, unsigned int> local;
+		vector<vec3> positions;
+		vector<unsigned int> indices;
+		for (unsigned int i = 0; i < groups[g].size(); i++)
+		{
+			unsigned int index = groups[g][i];
+			if (index >= vertices.size())
+				continue;
+			map<unsigned int, unsigned int>::iterator found = local.find(index);
+			if (found == local.end())
+			{
+				found = local.insert(make_pair(index, (unsigned int)positions.size())).first;
+				positions.push_back(vertices[index]);
+			}
+			indices.push_back(found->second);
+		}
+		geometry.addTriangles(positions, indices, CELL_SIZE);
+	}
+	return true;
+}
+
+//A move read from a trace, with its filter rebuilt against the benchmark's geometry
+struct TraceMove
+{
+	unsigned int frame;
+	CollisionFilter filter;
+	vec3 radius, position, velocity;
+};
+
+//Loads the scene into the collision manager, scaled like Model does
+void loadScene(vector<PlainGeometry> &scene, map<string, const CollisionGeometry*> &byName)
+{
+	CollisionManager* manager = CollisionManager::getInstance();
+	//the manager keeps pointers to the geometry, so it must not move
+	scene.reserve(SCENE_COLLISION_SIZE);
+	unsigned int triangles = 0;
+	for (unsigned int i = 0; i < SCENE_COLLISION_SIZE; i++)
+	{
+		scene.push_back(PlainGeometry(SCENE_COLLISION[i].path));
+		PlainGeometry &geometry = scene.back();
+		if (!loadObj(ROOT + SCENE_COLLISION[i].path, geometry))
+		{
+			cout << "missing " << SCENE_COLLISION[i].path << ", skipped" << endl;
+			scene.pop_back();
+			continue;
+		}
+		geometry.transform = scale(mat4(1), vec3(SCALE));
+		for (unsigned int m = 0; m < geometry.meshes.size(); m++)
+			triangles += geometry.meshes[m].triangleCount();
+		manager->trackModel(&geometry, SCENE_COLLISION[i].layer);
+		manager->setBlocks(&geometry, SCENE_COLLISION[i].blocks);
+		byName[geometry.name] = &geometry;
+	}
+	cout << scene.size() << " models, " << triangles << " collision mesh triangles" << endl;
+}
+
+//Trace lines as written by CollisionManager::writeTrace
+bool loadTrace(const string &file, const map<string, const CollisionGeometry*> &byName, vector<TraceMove> &moves)
+{
+	ifstream in(file);
+	if (!in.is_open())
+		return false;
+	string line, name;
+	while (getline(in, line))
+	{
+		istringstream words(line);
+		TraceMove move;
+		if (!(words >> move.frame >> move.filter.layer >> move.filter.mask >> move.filter.useStaticField
+			>> move.radius.x >> move.radius.y >> move.radius.z
+			>> move.position.x >> move.position.y >> move.position.z
+			>> move.velocity.x >> move.velocity.y >> move.velocity.z))
+			continue;
+		getline(words >> ws, name);
+		map<string, const CollisionGeometry*>::const_iterator found = byName.find(name);
+		if (found != byName.end())
+			move.filter.exclude.push_back(found->second);
+		moves.push_back(move);
+	}
+	return true;
+}
+
+//Bounding box of a whole model in world space
+void modelBounds(PlainGeometry &geometry, vec3 &low, vec3 &high)
+{
+	vector<vec3> corners;
+	geometry.getBoundingBoxes(corners);
+	low = vec3(FLT_MAX);
+	high = vec3(-FLT_MAX);
+	for (unsigned int i = 0; i < corners.size(); i++)
+	{
+		low = min(low, corners[i]);
+		high = max(high, corners[i]);
+	}
+}
+
+//Walks the camera around from its start position in Main.cpp at walking speed, following the collision response,
+//and every few frames pushes a random piece of furniture the way Model::shift does
+void synthesizeTrace(vector<PlainGeometry> &scene, vector<TraceMove> &moves)
+{
+	CollisionManager* manager = CollisionManager::getInstance();
+	mt19937 rng(31);
+	uniform_real_distribution<float> turn(-0.15f, 0.15f);
+	uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+	vector<PlainGeometry*> furniture;
+	for (unsigned int i = 0; i < scene.size(); i++)
+	{
+		for (unsigned int s = 0; s < SCENE_COLLISION_SIZE; s++)
+			if (scene[i].name == SCENE_COLLISION[s].path && SCENE_COLLISION[s].layer == LAYER_FURNITURE)
+				furniture.push_back(&scene[i]);
+	}
+
+	TraceMove camera;
+	camera.filter.useStaticField = true;
+	camera.radius = vec3(1);
+	camera.position = SCALE * vec3(2280, 0, -121.5f);
+	//collision center just above the ground, as in Camera::ProcessMovement
+	camera.position.y = 2.0f;
+	float heading = angle(rng);
+	for (unsigned int frame = 0; frame < TRACE_FRAMES; frame++)
+	{
+		heading += turn(rng);
+		camera.frame = frame;
+		camera.velocity = 4.5f / 60.0f * vec3(cos(heading), 0, sin(heading));
+		moves.push_back(camera);
+		vec3 result = manager->askMove(camera.radius, camera.velocity, camera.position, camera.filter);
+		//turn around when blocked
+		if (length(result) < 0.5f * length(camera.velocity))
+			heading += 3.1415926f;
+		camera.position += result;
+
+		if (frame % 4 == 0 && !furniture.empty())
+		{
+			PlainGeometry* pushed = furniture[rng() % furniture.size()];
+			vec3 low, high;
+			modelBounds(*pushed, low, high);
+			float direction = angle(rng);
+			TraceMove shift;
+			shift.frame = frame;
+			shift.filter.layer = LAYER_FURNITURE;
+			shift.filter.mask = MOVED_MODEL_MASK;
+			shift.filter.exclude.push_back(pushed);
+			shift.radius = 0.5f * (high - low);
+			shift.position = 0.5f * (high + low);
+			shift.velocity = 0.1f * vec3(cos(direction), 0, sin(direction));
+			moves.push_back(shift);
+		}
+	}
+}
+
+//Replays every move through askMove and reports throughput, tail latency and narrowphase work
+void replay(const char* name, const vector<TraceMove> &moves, bool meshes, bool staticField)
+{
+	CollisionManager* manager = CollisionManager::getInstance();
+	manager->meshCollision = meshes;
+	vector<double> latencies(moves.size());
+	unsigned long long triangles = manager->getTrianglesTested();
+	//heap allocations made by askMove itself, the copied filter aside
+	unsigned long long allocations = 0;
+	float sink = 0.0f;
+	chrono::high_resolution_clock::time_point begin = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < moves.size(); i++)
+	{
+		CollisionFilter filter = moves[i].filter;
+		filter.useStaticField = filter.useStaticField && staticField;
+		unsigned long long allocated = MemoryTracker::threadAllocations();
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		vec3 result = manager->askMove(moves[i].radius, moves[i].velocity, moves[i].position, filter);
+		latencies[i] = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+		allocations += MemoryTracker::threadAllocations() - allocated;
+		sink += result.x;
+	}
+	double total = chrono::duration<double>(chrono::high_resolution_clock::now() - begin).count();
+	triangles = manager->getTrianglesTested() - triangles;
+
+	vector<double> sorted = latencies;
+	sort(sorted.begin(), sorted.end());
+	double mean = 0;
+	for (unsigned int i = 0; i < sorted.size(); i++)
+		mean += sorted[i];
+	mean /= std::max<size_t>(sorted.size(), 1);
+	double p99 = sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.99))];
+	cout << name << ":\t" << moves.size() / total << " queries/s, mean " << mean << " us, p99 " << p99 << " us, "
+		<< (double)triangles / std::max<size_t>(moves.size(), 1) << " triangles/query, " << allocations << " heap allocations\t(" << sink << ")" << endl;
+}
+
+//Pushes a sphere into a single sided wall at a glancing angle, frame after frame, with both narrowphases. It must
+//slide along the wall without sinking into it
+void grazeWall()
+{
+	CollisionManager* manager = CollisionManager::getInstance();
+	//a layer of its own, so the scene doesn't get in the way
+	const unsigned int LAYER_WALL = 1 << 7;
+	static PlainGeometry wall("grazed wall");
+	vector<vec3> corners = { vec3(0, -50, -50), vec3(0, 50, -50), vec3(0, 50, 50), vec3(0, -50, 50) };
+	vector<unsigned int> indices = { 0, 1, 2, 0, 2, 3 };
+	wall.addTriangles(corners, indices, CELL_SIZE);
+	manager->trackModel(&wall, LAYER_WALL);
+	manager->meshCollision = true;
+
+	CollisionFilter filter;
+	filter.mask = LAYER_WALL;
+	const float degrees[] = { 1.0f, 5.0f, 20.0f };
+	for (unsigned int batched = 0; batched < 2; batched++)
+	{
+		manager->useBatchedNarrowphase = batched != 0;
+		for (unsigned int i = 0; i < sizeof(degrees) / sizeof(degrees[0]); i++)
+		{
+			float angle = radians(degrees[i]);
+			vec3 push = 4.5f / 60.0f * vec3(-sin(angle), 0, cos(angle));
+			//starts a tenth of the radius into the front of the wall, on +x, as if something had moved it there
+			vec3 position(0.9f, 0, -40);
+			float deepest = 0.0f;
+			bool through = false;
+			for (unsigned int frame = 0; frame < 1000; frame++)
+			{
+				position += manager->askMove(vec3(1), push, position, filter);
+				deepest = std::max(deepest, 1.0f - abs(position.x));
+				through = through || position.x < 0.0f;
+			}
+			cout << "grazing " << degrees[i] << " degrees (" << (batched ? "batched" : "scalar") << "):\tdeepest overlap "
+				<< deepest << ", overlap at the end " << std::max(0.0f, 1.0f - abs(position.x)) << ", "
+				<< (through ? "went through the wall" : "stayed in front of the wall") << endl;
+		}
+	}
+	manager->useBatchedNarrowphase = true;
+}
+
+//Usage: Benchmark [trace file]. Without a trace, a camera walk with furniture pushes is generated
+int main(int argc, char** argv)
+{
+	benchmarkNarrowphase();
+
+	vector<PlainGeometry> scene;
+	map<string, const CollisionGeometry*> byName;
+	loadScene(scene, byName);
+
+	CollisionManager* manager = CollisionManager::getInstance();
+	manager->buildStaticField("house_bench.sdf");
+	while (!manager->staticFieldReady())
+		this_thread::sleep_for(chrono::milliseconds(50));
+	//the frame budget doesn't apply to a single query at a time
+	manager->meshBudgetMicroseconds = 1e9f;
+
+	vector<TraceMove> moves;
+	if (argc > 1)
+	{
+		if (!loadTrace(argv[1], byName, moves))
+		{
+			cout << "can't read trace " << argv[1] << endl;
+			return 1;
+		}
+		cout << "replaying " << moves.size() << " moves from " << argv[1] << endl;
+	}
+	else
+	{
+		synthesizeTrace(scene, moves);
+		cout << "replaying " << moves.size() << " synthetic moves" << endl;
+	}
+
+	replay("boxes", moves, false, false);
+	replay("boxes + static field", moves, false, true);
+	replay("collision meshes", moves, true, true);
+	grazeWall();
+	return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef COLLISION_GEOMETRY_H
+#define COLLISION_GEOMETRY_H
+#include "glm.hpp"
+#include "gtc/matrix_transform.hpp"
+#include "CollisionMesh.h"
+#include <string>
+#include <vector>
+
+using namespace glm;
+
+//Anything the collision manager can track. Model implements it for loaded meshes,
+//PlainGeometry for boxes and triangle soups that never go through OpenGL
+class CollisionGeometry
+{
+public:
+	virtual ~CollisionGeometry() {}
+	//Replaces corners with the corners of each bounding box in world space, 8 per box in the order described in model.h.
+	//Filling the caller's vector lets queries reuse it instead of allocating
+	virtual void getBoundingBoxes(std::vector<vec3> &corners) = 0;
+	//Transform placing the collision meshes in the world
+	virtual mat4 getModelMatrix() const = 0;
+	//Simplified meshes for triangle-accurate collision, in model space
+	virtual void getCollisionMeshes(std::vector<const CollisionMesh*> &result) const = 0;
+	//Used to find the geometry again when replaying recorded collision traces
+	virtual std::string getCollisionName() const = 0;
+};
+
+//Collision geometry without any rendering data
+class PlainGeometry : public CollisionGeometry
+{
+public:
+	std::string name;
+	mat4 transform = mat4(1);
+	//boxes in model space, 8 corners each
+	std::vector<std::vector<vec3>> boxes;
+	std::vector<CollisionMesh> meshes;
+
+	PlainGeometry(const std::string &name = "") : name(name) {}
+
+	//Adds an axis aligned box, with its corners in the order used by model.h
+	void addBox(const vec3 &low, const vec3 &high)
+	{
+		std::vector<vec3> box = {
+			vec3(low.x, low.y, low.z),		//Vertex 0: Front, bottom, left corner
+			vec3(low.x, high.y, low.z),		//Vertex 1: Front, top, left corner
+			vec3(high.x, high.y, low.z),	//Vertex 2: Front, top, right corner
+			vec3(high.x, low.y, low.z),		//Vertex 3: Front, bottom, right corner
+			vec3(low.x, low.y, high.z),		//Vertex 4: Back, bottom, left corner
+			vec3(low.x, high.y, high.z),	//Vertex 5: Back, top, left corner
+			vec3(high.x, high.y, high.z),	//Vertex 6: Back, top, right corner
+			vec3(high.x, low.y, high.z)		//Vertex 7: Back, bottom, right corner
+		};
+		boxes.push_back(box);
+	}
+
+	//Adds a triangle soup, with its bounding box and a collision mesh simplified on cellSize
+	void addTriangles(const std::vector<vec3> &positions, const std::vector<unsigned int> &indices, float cellSize)
+	{
+		if (positions.empty())
+			return;
+		vec3 low = positions[0], high = positions[0];
+		for (unsigned int i = 0; i < positions.size(); i++)
+		{
+			low = min(low, positions[i]);
+			high = max(high, positions[i]);
+		}
+		addBox(low, high);
+		meshes.push_back(CollisionMesh());
+		meshes.back().build(positions, indices, cellSize);
+	}
+
+	void getBoundingBoxes(std::vector<vec3> &corners)
+	{
+		corners.clear();
+		for (unsigned int i = 0; i < boxes.size(); i++)
+			for (unsigned int j = 0; j < boxes[i].size(); j++)
+				corners.push_back(vec3(transform * vec4(boxes[i][j], 1)));
+	}
+
+	mat4 getModelMatrix() const
+	{
+		return transform;
+	}
+
+	void getCollisionMeshes(std::vector<const CollisionMesh*> &result) const
+	{
+		result.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (!meshes[i].empty())
+				result.push_back(&meshes[i]);
+		}
+	}
+
+	std::string getCollisionName() const
+	{
+		return name;
+	}
+};
+#endif
@@ -1,6 +1,11 @@
 #include "CollisionManager.h"
 #include "collision_math.h"
-#include "model.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Memory.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
 
 //Since this is a static class, definition is in a .cpp file
 static CollisionManager* instance = 0;
@@ -17,388 +22,591 @@ CollisionManager* CollisionManager::getInstance()
 }
 
 //Tracks the vertices bounding boxes of a model;
-void CollisionManager::trackModel(Model* model)
+void CollisionManager::trackModel(CollisionGeometry* model, unsigned int layer)
 {
 	std::cout << "Tracking the added model" << std::endl;
-	tracked_models.push_back(model);
+	TrackedModel tracked;
+	tracked.model = model;
+	tracked.layer = layer;
+	tracked.blocks = LAYER_ALL;
+	tracked.inStaticField = false;
+	tracked_models.push_back(tracked);
 }
 
-//Solution of quadratic equation references Soren Seedberg
-bool CollisionManager::getLowestRoot(float a, float b, float c, float current, float* root)
+void CollisionManager::setLayer(const CollisionGeometry* model, unsigned int layer)
 {
-	float determinant = b*b - 4.0f * a * c;
-	//Check for complex solutions
-	if (determinant < 0)
+	TrackedModel* tracked = findTracked(model);
+	if (tracked)
 	{
-		return false;
+		tracked->layer = layer;
 	}
+}
 
-	//calculate roots
-	float rootD = sqrt(determinant);
-	float r1 = (-b - rootD) / 2 * a;
-	float r2 = (-b + rootD) / 2 * a;
-
-	//Sort roots
-	if (r1 > r2)
+void CollisionManager::setBlocks(const CollisionGeometry* model, unsigned int blocks)
+{
+	TrackedModel* tracked = findTracked(model);
+	if (tracked)
 	{
-		float temp = r2;
-		r2 = r1;
-		r1 = temp;
+		tracked->blocks = blocks;
 	}
-	//We're looking for the lowest value between [0,1];
-	if (r1 > 0 && r1 < current)
+}
+
+CollisionManager::TrackedModel* CollisionManager::findTracked(const CollisionGeometry* model)
+{
+	for (unsigned int i = 0; i < tracked_models.size(); i++)
 	{
-		*root = r1;
-		return true;
+		if (tracked_models[i].model == model)
+		{
+			return &tracked_models[i];
+		}
 	}
+	return nullptr;
+}
 
-	//According to reference, this can happen if x1 negative
-	if (r2 > 0 && r2 < current)
+//A tracked model takes part in a query if the mover collides with its layer, it blocks the mover's layer
+//and it isn't excluded by the query
+bool CollisionManager::passesFilter(const TrackedModel &tracked, const CollisionFilter &filter) const
+{
+	if (!(filter.mask & tracked.layer) || !(tracked.blocks & filter.layer))
 	{
-		*root = r2;
-		return true;
+		return false;
 	}
-
-	return false;
+	return std::find(filter.exclude.begin(), filter.exclude.end(), tracked.model) == filter.exclude.end();
 }
 
-//Barycentric technique referenced from http://blackpawn.com/texts/pointinpoly/
-bool CollisionManager::checkPointInTriangle(const vec3 &point, const vec3 &p1, const vec3 &p2, const vec3 & p3)
+vec3 CollisionManager::askMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter)
 {
-	vec3 v0 = p2 - p1;
-	vec3 v1 = p3 - p1;
-	vec3 v2 = point - p1;
-
-	float dot00 = dot(v0, v0);
-	float dot01 = dot(v0, v1);
-	float dot02 = dot(v0, v2);
-	float dot11 = dot(v1, v1);
-	float dot12 = dot(v1, v2);
-
-	//barycentric coordinates
-	float denumerator = dot00 * dot11 - dot01 * dot01;
-	float u = (dot11 * dot02 - dot01 * dot12) / denumerator;
-	float v = (dot00 * dot12 - dot01 * dot02) / denumerator;
-
-	return (u >= 0) && (v >= 0) && (u + v < 1);
+	PROFILE_ZONE("askMove");
+	MemoryScope tag(MEMORY_COLLISION);
+	//Refresh the models this query sweeps, skipping filtered models before building their boxes
+	for (unsigned int i = 0; i < tracked_models.size(); i++)
+	{
+		if (isSwept(tracked_models[i], filter))
+		{
+			snapshotModel(tracked_models[i]);
+		}
+	}
+	return resolveMove(elipsoidradius, R3velocity, R3position, filter);
 }
 
-vec3 CollisionManager::askMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position)
+void CollisionManager::queueMove(CollisionMover* mover, glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter* filter)
 {
-	glm::vec3 result;
-	//Construct a collision packet
-	CollisionPacket packet;
-	packet.elipsoidRadius = elipsoidradius;
-	packet.R3velocity = R3velocity;
-	packet.R3position = R3position;
-
-	//Create a "Change of Basis Matrix" to translate to elipse space (equation 2.4)
-	mat3 CBM = mat3(
-		glm::vec3(1 / elipsoidradius.x, 0.0f, 0.0f),
-		glm::vec3(0.0f, 1 / elipsoidradius.y, 0.0f),
-		glm::vec3(0.0f, 0.0f, 1 / elipsoidradius.z)
-	);
-
-	//Calculate the elipse space vectors
-	packet.eVelocity = CBM * R3velocity;
-	packet.eNormalizedVelocity = normalize(packet.eVelocity);
-	packet.eBasePoint = CBM * R3position;
+	//Several keys held at once only cost one query
+	for (unsigned int i = 0; i < move_queue.size(); i++)
+	{
+		if (move_queue[i].mover == mover)
+		{
+			move_queue[i].R3velocity += R3velocity;
+			return;
+		}
+	}
+	MoveRequest request = { mover, elipsoidradius, R3velocity, R3position, filter, vec3(0) };
+	move_queue.push_back(request);
+}
 
-	packet.foundCollision = false;
+void CollisionManager::resolveMoves()
+{
+	if (move_queue.empty())
+	{
+		return;
+	}
+	PROFILE_ZONE("resolveMoves");
+	MemoryScope tag(MEMORY_COLLISION);
 
-	//Attempt to process the collision for each bounding box triangle
+	//Snapshot every model at least one queued move can collide with. Nothing moves until the results are handed back,
+	//so all requests of this frame see the same world
 	for (unsigned int i = 0; i < tracked_models.size(); i++)
 	{
-		std::vector<vector<vec3>> box = tracked_models[i]->getBoundingBoxes();
-		//Front-facing triangles based on vertices as described in model.h
-		for (int i = 0; i < box.size(); ++i){
-		//Front face
-		checkTriangle(&packet, box[i][3], box[i][1], box[i][0]);
-		checkTriangle(&packet, box[i][3], box[i][4], box[i][1]);
-		//Back face
-		checkTriangle(&packet, box[i][4], box[i][6], box[i][7]);
-		checkTriangle(&packet, box[i][4], box[i][5], box[i][6]);
-		//Left face
-		checkTriangle(&packet, box[i][0], box[i][5], box[i][4]);
-		checkTriangle(&packet, box[i][0], box[i][1], box[i][5]);
-		//Right face
-		checkTriangle(&packet, box[i][7], box[i][2], box[i][3]);
-		checkTriangle(&packet, box[i][7], box[i][6], box[i][2]);
-		//Top face
-		checkTriangle(&packet, box[i][2], box[i][5], box[i][1]);
-		checkTriangle(&packet, box[i][2], box[i][6], box[i][5]);
-		//Bottom face
-		checkTriangle(&packet, box[i][7], box[i][0], box[i][4]);
-		checkTriangle(&packet, box[i][7], box[i][3], box[i][0]);
+		for (unsigned int j = 0; j < move_queue.size(); j++)
+		{
+			if (isSwept(tracked_models[i], *move_queue[j].filter))
+			{
+				snapshotModel(tracked_models[i]);
+				break;
+			}
 		}
 	}
-	if (packet.foundCollision == true)
-	{
-		float nearDistance = 0.05f;
-		vec3 elipsoid = packet.elipsoidRadius;
-		vec3 intersection = packet.intersectionPoint;
-		mat3 invCMD = mat3(
-			vec3(elipsoid.x, 0.0f, 0.0f),
-			vec3(0.0f, elipsoid.y, 0.0f),
-			vec3(0.0f, 0.0f, elipsoid.z)
-		);
-
-		vec3 destination = packet.eBasePoint + packet.eVelocity;
-		vec3 newBasePoint = packet.eBasePoint;
 
-		//Set the length of the movement vector so we don't move close but not right to the collision point
-		if (packet.nearestDistance >= nearDistance)
+	//One job per request, the calling thread takes requests too
+	JobSystem::getInstance()->parallelFor(0, move_queue.size(), 1, [this](unsigned int first, unsigned int last)
+	{
+		MemoryScope tag(MEMORY_COLLISION);
+		for (unsigned int i = first; i < last; i++)
 		{
-			vec3 V = (packet.nearestDistance - nearDistance) * normalize(packet.eVelocity);
-			newBasePoint = newBasePoint + V;
-
-			//Move the intersection point closer to calculate the sliding plane
-			packet.intersectionPoint -= nearDistance * normalize(V);
+			MoveRequest &request = move_queue[i];
+			request.result = resolveMove(request.elipsoidRadius, request.R3velocity, request.R3position, *request.filter);
 		}
+	});
 
-		//Calculate a sliding plane
-		vec3 slidePoint = packet.intersectionPoint;
-		vec3 slideNormal = newBasePoint - packet.intersectionPoint;
-		slideNormal = normalize(slideNormal);
-		Plane slidingPlane(slidePoint, slideNormal);
+	//Hand the results back on the main thread, in the order the moves were queued
+	for (unsigned int i = 0; i < move_queue.size(); i++)
+	{
+		if (trace.is_open())
+		{
+			writeTrace(move_queue[i]);
+		}
+		move_queue[i].mover->moveResolved(move_queue[i].result);
+	}
+	traceFrame++;
+	unsigned int moves = move_queue.size();
+	move_queue.clear();
+
+	//Collision mesh budget of this frame
+	lastMeshMicroseconds = meshNanoseconds / 1000.0f;
+	lastMeshTriangles = meshTriangles;
+	unsigned int fallbacks = meshFallbacks;
+	meshNanoseconds = 0;
+	meshTriangles = 0;
+	meshFallbacks = 0;
+
+	//Substeps and slide iterations of this frame
+	lastSubsteps = substepsTaken;
+	lastSlideIterations = slideIterations;
+	lastIterationCapHits = iterationCapHits;
+	substepsTaken = 0;
+	slideIterations = 0;
+	iterationCapHits = 0;
+	reportFrame(moves, fallbacks);
+}
 
-		vec3 newDestination = destination - slidingPlane.signedDistanceTo(destination) * slideNormal;
+//Counts the frame if it ran out of mesh budget, or a hitch needed substeps or a move ran out of iterations. Such a
+//frame prints the count since the last report with its own numbers, unless there was a report less than a second ago
+void CollisionManager::reportFrame(unsigned int moves, unsigned int fallbacks)
+{
+	bool budget = fallbacks > 0;
+	bool hitch = lastSubsteps > moves || lastIterationCapHits > 0;
+	budgetFrames += budget ? 1 : 0;
+	hitchFrames += hitch ? 1 : 0;
+	if (!budget && !hitch)
+	{
+		return;
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - lastReport < std::chrono::seconds(1))
+	{
+		return;
+	}
+	lastReport = now;
+	if (budget)
+	{
+		std::cout << "Collision mesh budget of " << meshBudgetMicroseconds << " us used up on " << budgetFrames << " frames, the last one took "
+			<< lastMeshMicroseconds << " us (" << lastMeshTriangles << " triangles) and " << fallbacks << " models fell back to bounding boxes" << std::endl;
+		budgetFrames = 0;
+	}
+	if (hitch)
+	{
+		std::cout << "Collision needed substeps or ran out of iterations on " << hitchFrames << " frames, the last one had " << moves
+			<< " moves in " << lastSubsteps << " substeps, " << lastSlideIterations << " slide iterations, " << lastIterationCapHits
+			<< " hit the cap of " << maxSlideIterations << std::endl;
+		hitchFrames = 0;
+	}
+}
 
-		vec3 newVelocity = newDestination - packet.intersectionPoint;
+bool CollisionManager::startTrace(const std::string &path)
+{
+	stopTrace();
+	trace.open(path);
+	traceFrame = 0;
+	return trace.is_open();
+}
 
-		//Transform back to R3 and remove vertical component;
-		result = invCMD * newVelocity;
-		result.y = 0.0f;
-		slidePoint = invCMD * slidePoint;
-	}
-	else
+void CollisionManager::stopTrace()
+{
+	if (trace.is_open())
 	{
-		result = R3velocity;
-		result.y = 0.0f;
+		trace.close();
 	}
-	
-	return result;
 }
 
-//Assume that p1, p2 and p3 are given in front-facing order
-void CollisionManager::checkTriangle(CollisionPacket* col, vec3 p1, vec3 p2, vec3 p3)
+//One move per line: frame, filter layer, mask and static field flag, radius, position, velocity,
+//then the name of the excluded geometry (or -) up to the end of the line since paths may hold spaces
+void CollisionManager::writeTrace(const MoveRequest &request)
 {
-	Plane triangle(p1, p2, p3);
+	const CollisionFilter &filter = *request.filter;
+	trace << traceFrame << ' ' << filter.layer << ' ' << filter.mask << ' ' << filter.useStaticField << ' '
+		<< request.elipsoidRadius.x << ' ' << request.elipsoidRadius.y << ' ' << request.elipsoidRadius.z << ' '
+		<< request.R3position.x << ' ' << request.R3position.y << ' ' << request.R3position.z << ' '
+		<< request.R3velocity.x << ' ' << request.R3velocity.y << ' ' << request.R3velocity.z << ' '
+		<< (filter.exclude.empty() ? std::string("-") : filter.exclude[0]->getCollisionName()) << '\n';
+}
 
-	//Proceed only if triangle is front-facing to normal
-	if (triangle.isFrontFacingTo(col->eNormalizedVelocity))
+CollisionManager::~CollisionManager()
+{
+	if (fieldBuilder.joinable())
 	{
-		float t0, t1;
-		bool embeddedInPlane = false;
+		fieldBuilder.join();
+	}
+}
+
+//Voxel size and band of the static field, in world units. The band must be wider than the camera elipsoid
+static const float FIELD_VOXEL_SIZE = 0.2f;
+static const float FIELD_BAND = 1.5f;
+//Longest hitch resolved in full, longer moves get longer substeps
+static const unsigned int MAX_SUBSTEPS = 64;
 
-		//Calculate distance from sphere to plane
-		double distToPlane = triangle.signedDistanceTo(col->eBasePoint);
-		float normalDotVelocity = dot(triangle.normal, col->eVelocity);
+void CollisionManager::buildStaticField(const std::string &cachePath)
+{
+	if (fieldBuilder.joinable() || fieldReady)
+	{
+		return;
+	}
 
-		//special case where normal is perpendicular (sphere traveling parallel to plane)
-		if (normalDotVelocity == 0.0f)
+	//Static models never move, so their triangles are gathered once here
+	staticTriangles.clear();
+	for (unsigned int i = 0; i < tracked_models.size(); i++)
+	{
+		TrackedModel &tracked = tracked_models[i];
+		if ((tracked.layer & LAYER_STATIC) && (tracked.blocks & LAYER_CAMERA))
 		{
-			if (abs(distToPlane) >= 1.0f)
-			{
-				//no collision
-				return;
-			}
-			else
+			snapshotModel(tracked);
+			for (unsigned int j = 0; j < tracked.triangles.count; j++)
 			{
-				//sphere embedded in plane
-				embeddedInPlane = true;
-				//sphere interesects plane at all times
-				t0 = 0.0;
-				t1 = 1.0;
+				staticTriangles.add(
+					vec3(tracked.triangles.x1[j], tracked.triangles.y1[j], tracked.triangles.z1[j]),
+					vec3(tracked.triangles.x2[j], tracked.triangles.y2[j], tracked.triangles.z2[j]),
+					vec3(tracked.triangles.x3[j], tracked.triangles.y3[j], tracked.triangles.z3[j]));
 			}
+			tracked.inStaticField = true;
 		}
-		//non-parallel, calculate intersection
-		else
+	}
+
+	unsigned long long hash = DistanceField::hashTriangles(staticTriangles, FIELD_VOXEL_SIZE, FIELD_BAND);
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	if (staticField.load(cachePath, hash))
+	{
+		reportStaticField("loaded from cache", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		fieldReady = true;
+		return;
+	}
+
+	//Build in the background, camera queries keep sweeping the static models until it's done
+	fieldBuilder = std::thread([this, cachePath]()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		staticField.build(staticTriangles, FIELD_VOXEL_SIZE, FIELD_BAND);
+		reportStaticField("built", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		if (!staticField.save(cachePath))
 		{
-			t0 = (-1.0 - distToPlane) / normalDotVelocity;
-			t1 = (1.0 - distToPlane) / normalDotVelocity;
-			//make sure t0 is the smaller distance
-			if (t0 > t1)
-			{
-				float temp = t1;
-				t1 = t0;
-				t0 = temp;
-			}
+			std::cout << "Static field could not be cached at " << cachePath << std::endl;
 		}
+		fieldReady = true;
+	});
+}
+
+//Prints the memory used by the static field and the average time of a distance + gradient lookup
+void CollisionManager::reportStaticField(const char* source, double milliseconds) const
+{
+	const unsigned int QUERIES = 100000;
+	float sink = 0.0f;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < QUERIES; i++)
+	{
+		unsigned int t = i % staticTriangles.count;
+		vec3 point = vec3(staticTriangles.x1[t], staticTriangles.y1[t], staticTriangles.z1[t]) + vec3(0.37f * (i % 7), 0.21f * (i % 5), 0.43f * (i % 3));
+		sink += staticField.distance(point) + staticField.gradient(point).x;
+	}
+	double query = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / QUERIES;
+
+	std::cout << "Static field " << source << " in " << milliseconds << " ms: " << staticTriangles.count << " triangles, "
+		<< staticField.storedBrickCount() << "/" << staticField.brickCount() << " bricks stored, "
+		<< staticField.memoryBytes() / 1024 << " KB, " << query << " ns per distance + gradient query" << (sink == 0.0f ? " " : "") << std::endl;
+}
 
-		//Check for collisions within the sphere's radius of 1.0f
-		if (t0 > 1.0f || t1 < 0.0f)
+//Share of the field's gradient that must be horizontal for the field to push a sphere sideways
+static const float FIELD_HORIZONTAL_SHARE = 0.3f;
+
+vec3 CollisionManager::slideAgainstField(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position) const
+{
+	//Movement is horizontal, so the horizontal radius of the elipsoid is the one that matters
+	float radius = glm::min(glm::max(elipsoidradius.x, elipsoidradius.z), staticField.getBand());
+	vec3 target = R3position + R3velocity;
+
+	//Push the sphere out along the gradient until it no longer overlaps, which slides it along walls
+	for (int i = 0; i < 4; i++)
+	{
+		float distance = staticField.distance(target);
+		if (distance >= radius)
 		{
-			//Outside the radius, no collision
-			return;
+			break;
 		}
-		else if (t0 < -30.0f || t1 > 30.0f)
+		vec3 gradient = staticField.gradient(target);
+		vec3 normal = vec3(gradient.x, 0.0f, gradient.z);
+		//A mostly horizontal surface (floor, ceiling, table top) has no sideways push to give: normalizing what is
+		//left of its gradient would shove the sphere in an arbitrary direction
+		if (length(normal) < FIELD_HORIZONTAL_SHARE * length(gradient))
 		{
-			return;
+			break;
 		}
+		target += (radius - distance) * normalize(normal);
+	}
 
-		if (t0 < 0.0)
+	vec3 result = target - R3position;
+	result.y = 0.0f;
+	return result;
+}
+
+//Runs the narrowphase selected by useBatchedNarrowphase over a batch of triangles
+void CollisionManager::sweepTriangles(CollisionPacket* packet, const TriangleBatch &batch) const
+{
+	PROFILE_ZONE("checkTriangle");
+	trianglesTested += batch.count;
+	if (useBatchedNarrowphase)
+	{
+		checkTriangleBatch(packet, batch);
+	}
+	else
+	{
+		for (unsigned int i = 0; i < batch.count; i++)
 		{
-			t0 = 0.0;
+			checkTriangle(packet,
+				vec3(batch.x1[i], batch.y1[i], batch.z1[i]),
+				vec3(batch.x2[i], batch.y2[i], batch.z2[i]),
+				vec3(batch.x3[i], batch.y3[i], batch.z3[i]));
 		}
-		if (t1 < 0.0)
+	}
+}
+
+//Sweeps against the collision mesh triangles near the path of the packet
+void CollisionManager::sweepCollisionMeshes(CollisionPacket* packet, const TrackedModel &tracked) const
+{
+	//reused between queries of the same thread
+	thread_local TriangleBatch batch;
+	thread_local std::vector<unsigned int> candidates;
+
+	//Bounds of the whole sweep in world space, then in model space so the hierarchy can be searched
+	vec3 start = packet->R3position;
+	vec3 end = packet->R3position + packet->R3velocity;
+	vec3 sweepMin = glm::min(start, end) - packet->elipsoidRadius;
+	vec3 sweepMax = glm::max(start, end) + packet->elipsoidRadius;
+	vec3 localMin(FLT_MAX), localMax(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		vec3 p((corner & 1) ? sweepMax.x : sweepMin.x, (corner & 2) ? sweepMax.y : sweepMin.y, (corner & 4) ? sweepMax.z : sweepMin.z);
+		p = vec3(tracked.inverseTransform * vec4(p, 1));
+		localMin = glm::min(localMin, p);
+		localMax = glm::max(localMax, p);
+	}
+
+	batch.clear();
+	for (unsigned int m = 0; m < tracked.meshes.size(); m++)
+	{
+		const CollisionMesh &mesh = *tracked.meshes[m];
+		candidates.clear();
+		mesh.query(localMin, localMax, candidates);
+		for (unsigned int i = 0; i < candidates.size(); i++)
 		{
-			t1 = 0.0;
+			const unsigned int* triangle = &mesh.indices[3 * candidates[i]];
+			vec3 p1 = vec3(tracked.transform * vec4(mesh.vertices[triangle[0]], 1));
+			vec3 p2 = vec3(tracked.transform * vec4(mesh.vertices[triangle[1]], 1));
+			vec3 p3 = vec3(tracked.transform * vec4(mesh.vertices[triangle[2]], 1));
+			//Mesh triangles wind counter-clockwise around outward normals, checkTriangle expects the opposite like the box faces
+			batch.add(p1, p3, p2);
 		}
-		if (t0 > 1.0)
+	}
+	batch.pad();
+	meshTriangles += batch.count;
+	sweepTriangles(packet, batch);
+}
+
+//Whether a query sweeps against a model, rather than skipping it or using the static field for it
+bool CollisionManager::isSwept(const TrackedModel &tracked, const CollisionFilter &filter) const
+{
+	if (tracked.inStaticField && filter.useStaticField && fieldReady)
+	{
+		return false;
+	}
+	return passesFilter(tracked, filter);
+}
+
+void CollisionManager::snapshotModel(TrackedModel &tracked)
+{
+	tracked.transform = tracked.model->getModelMatrix();
+	tracked.inverseTransform = inverse(tracked.transform);
+	tracked.model->getCollisionMeshes(tracked.meshes);
+
+	TriangleBatch &batch = tracked.triangles;
+	batch.clear();
+	tracked.model->getBoundingBoxes(boxCorners);
+	const vec3* box = boxCorners.data();
+	//Front-facing triangles based on vertices as described in model.h
+	for (unsigned int i = 0; i + 8 <= boxCorners.size(); i += 8){
+	//Front face
+	batch.add(box[i + 3], box[i + 1], box[i + 0]);
+	batch.add(box[i + 3], box[i + 4], box[i + 1]);
+	//Back face
+	batch.add(box[i + 4], box[i + 6], box[i + 7]);
+	batch.add(box[i + 4], box[i + 5], box[i + 6]);
+	//Left face
+	batch.add(box[i + 0], box[i + 5], box[i + 4]);
+	batch.add(box[i + 0], box[i + 1], box[i + 5]);
+	//Right face
+	batch.add(box[i + 7], box[i + 2], box[i + 3]);
+	batch.add(box[i + 7], box[i + 6], box[i + 2]);
+	//Top face
+	batch.add(box[i + 2], box[i + 5], box[i + 1]);
+	batch.add(box[i + 2], box[i + 6], box[i + 5]);
+	//Bottom face
+	batch.add(box[i + 7], box[i + 0], box[i + 4]);
+	batch.add(box[i + 7], box[i + 3], box[i + 0]);
+	}
+	batch.pad();
+}
+
+vec3 CollisionManager::resolveMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter) const
+{
+	PROFILE_ZONE("resolveMove");
+	//Static models baked in the distance field are handled after each substep
+	bool useField = filter.useStaticField && fieldReady;
+
+	//Split the move into substeps no longer than the elipsoid's radius, so a long frame can't carry it through a wall.
+	//In elipse space the radius is 1, so the length of the move is the number of substeps
+	vec3 eVelocity = R3velocity / elipsoidradius;
+	unsigned int substeps = (unsigned int)ceil(length(eVelocity));
+	substeps = glm::clamp(substeps, 1u, MAX_SUBSTEPS);
+	vec3 step = R3velocity / (float)substeps;
+
+	vec3 position = R3position;
+	unsigned int taken = 0;
+	while (taken < substeps)
+	{
+		vec3 moved = collideAndSlide(elipsoidradius, step, position, filter);
+		if (useField)
 		{
-			t0 = 1.0;
+			moved = slideAgainstField(elipsoidradius, moved, position);
 		}
-		if (t1 > 1.0)
+		position += moved;
+		taken++;
+		//Blocked, the remaining substeps would stop at the same place
+		if (length(moved / elipsoidradius) < slideEpsilon)
 		{
-			t1 = 1.0;
+			break;
 		}
+	}
+	substepsTaken += taken;
 
-		//If a collision happens it's between these two values
-		vec3 collisionPoint;
-		bool foundCollision = false;
-		float t = 1.0;
+	vec3 result = position - R3position;
+	result.y = 0.0f;
+	return result;
+}
 
-		//Check collision inside the triangle
-		if (!embeddedInPlane)
+vec3 CollisionManager::collideAndSlide(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter) const
+{
+	//Construct a collision packet
+	CollisionPacket packet;
+	packet.elipsoidRadius = elipsoidradius;
+	packet.R3velocity = R3velocity;
+	packet.R3position = R3position;
+
+	//Create a "Change of Basis Matrix" to translate to elipse space (equation 2.4)
+	mat3 CBM = mat3(
+		glm::vec3(1 / elipsoidradius.x, 0.0f, 0.0f),
+		glm::vec3(0.0f, 1 / elipsoidradius.y, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1 / elipsoidradius.z)
+	);
+	mat3 invCMD = mat3(
+		vec3(elipsoidradius.x, 0.0f, 0.0f),
+		vec3(0.0f, elipsoidradius.y, 0.0f),
+		vec3(0.0f, 0.0f, elipsoidradius.z)
+	);
+
+	//Calculate the elipse space vectors
+	vec3 start = CBM * R3position;
+	vec3 basePoint = start;
+	vec3 velocity = CBM * R3velocity;
+	const float nearDistance = 0.05f;
+
+	//Recursive collide and slide of the referenced paper, as a loop
+	unsigned int iteration = 0;
+	//passes that swept the tracked models, the report counts these
+	unsigned int passes = 0;
+	for (; iteration < maxSlideIterations; iteration++)
+	{
+		//Nothing left to move
+		if (length(velocity) < slideEpsilon)
 		{
-			vec3 planeIntersectionPoint = (col->eBasePoint - triangle.normal) + t0 * col->eVelocity;
-			if (checkPointInTriangle(planeIntersectionPoint, p1, p2, p3))
-			{
-				//If collision happened inside the triangle it must have been at t0 (explained in referenced paper)
-				foundCollision = true;
-				t = t0;
-				collisionPoint = planeIntersectionPoint;
-			}
+			break;
 		}
-
-		//If collision wasn't inside the triangle, proceed with the expensive sweep method for edge/vertex collisions
-		//A triangle collision will always occur before an edge or vertex collision
-		if (!foundCollision)
+		passes++;
+		packet.eVelocity = velocity;
+		packet.eNormalizedVelocity = normalize(velocity);
+		packet.eBasePoint = basePoint;
+		packet.foundCollision = false;
+		packet.foundEmbedded = false;
+
+		//Attempt to process the collision for each bounding box triangle
+		for (unsigned int i = 0; i < tracked_models.size(); i++)
 		{
-			vec3 velocity = col->eVelocity;
-			vec3 base = col->eBasePoint;
-			float velocitySquaredLength = dot(velocity, velocity);
-			float a, b, c;
-			float newT;
-
-			//As explained in the paper (Equation 3.5), we find the time of intersection by solving the
-			//quadratic equation At^2 + Bt + C, where:
-			//A = dot(velocity, velocity) (velocitySquaredLength, calculated above)
-			//B = 2 * dot(velocity, basePoint - p)
-			//C = dot(p - basePoint, p - basePoint) - 1
-			// p is each of the points to be checked (p1, p2, p3)
-			a = velocitySquaredLength;
-
-			//Check p1
-			b = 2.0f * dot(velocity, base - p1);
-			c = dot(p1 - base, p1 - base) - 1.0;
-			if (getLowestRoot(a, b, c, t, &newT))
+			if (!isSwept(tracked_models[i], filter))
 			{
-				t = newT;
-				foundCollision = true;
-				collisionPoint = p1;
+				continue;
 			}
-
-			//Check p2
-			b = 2.0f * dot(velocity, base - p2);
-			c = dot(p2 - base, p2 - base) - 1.0;
-			if (getLowestRoot(a, b, c, t, &newT))
-			{
-				t = newT;
-				foundCollision = true;
-				collisionPoint = p2;
-			}
-
-			//Check p3
-			b = 2.0f * dot(velocity, base - p3);
-			c = dot(p3 - base, p3 - base) - 1.0;
-			if (getLowestRoot(a, b, c, t, &newT))
+			const TrackedModel &tracked = tracked_models[i];
+			//Collision meshes are used while the frame budget lasts, the bounding boxes after that
+			if (meshCollision && !tracked.meshes.empty())
 			{
-				t = newT;
-				foundCollision = true;
-				collisionPoint = p3;
-			}
-
-			//According to above reference, even if an edge collision is true
-			//We must still check against edges, as it's possible that an
-			//edge collision happens sooner
-
-			//p1 - p2 edge
-			vec3 edge = p2 - p1;
-			vec3 baseToVertex = p1 - base;
-
-			//Calculate a,b,c, as described on page 16
-			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
-			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
-			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
-
-			if (getLowestRoot(a, b, c, t, &newT))
-			{
-				//Calculate where along the edge (rather, its infinity line) the intersection happens (Equation 3.6)
-				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
-				//Since we calculated roots along the infinity line, check if it lies on the triangle edge
-				if (f >= 0.0 && f <= 1.0)
+				if (meshNanoseconds < (long long)(meshBudgetMicroseconds * 1000.0f))
 				{
-					t = newT;
-					foundCollision = true;
-					collisionPoint = p1 + f*edge;
+					std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+					sweepCollisionMeshes(&packet, tracked);
+					meshNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+					continue;
 				}
+				meshFallbacks++;
 			}
+			sweepTriangles(&packet, tracked.triangles);
+		}
 
-			//Likewise for all other edges
-			//p2 - p3 edge
-			edge = p3 - p2;
-			baseToVertex = p2 - base;
-
-			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
-			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
-			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
-
-			if (getLowestRoot(a, b, c, t, &newT))
-			{
-				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
-				if (f >= 0.0 && f <= 1.0)
-				{
-					t = newT;
-					foundCollision = true;
-					collisionPoint = p2 + f*edge;
-				}
-			}
+		//Started inside a triangle: back out along its normal to the near distance, keep only the part of the move
+		//along its plane and sweep again from there
+		if (packet.foundEmbedded)
+		{
+			basePoint -= (packet.embeddedDepth + nearDistance) * packet.embeddedNormal;
+			velocity -= dot(velocity, packet.embeddedNormal) * packet.embeddedNormal;
+			velocity.y = 0.0f;
+			continue;
+		}
 
-			//p3 - p1 edge
-			edge = p1 - p3;
-			baseToVertex = p3 - base;
+		//No collision, the whole remaining move is free
+		if (packet.foundCollision == false)
+		{
+			basePoint += velocity;
+			break;
+		}
 
-			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
-			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
-			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
+		vec3 destination = basePoint + velocity;
+		vec3 newBasePoint = basePoint;
 
-			if (getLowestRoot(a, b, c, t, &newT))
-			{
-				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
-				if (f >= 0.0 && f <= 1.0)
-				{
-					t = newT;
-					foundCollision = true;
-					collisionPoint = p3 + f*edge;
-				}
-			}
+		//Set the length of the movement vector so we don't move close but not right to the collision point
+		if (packet.nearestDistance >= nearDistance)
+		{
+			vec3 V = (packet.nearestDistance - nearDistance) * normalize(velocity);
+			newBasePoint = newBasePoint + V;
 
+			//Move the intersection point closer to calculate the sliding plane
+			packet.intersectionPoint -= nearDistance * normalize(V);
 		}
 
-		if (foundCollision == true)
-		{
-			//set distance to collision
-			float distToCollision = t*length(col->eVelocity);
+		//Calculate a sliding plane
+		vec3 slidePoint = packet.intersectionPoint;
+		vec3 slideNormal = newBasePoint - packet.intersectionPoint;
+		slideNormal = normalize(slideNormal);
+		Plane slidingPlane(slidePoint, slideNormal);
 
-			//This is the closest hit if its the first or closest
-			if (col->foundCollision == false || distToCollision < col->nearestDistance)
-			{
-				col->nearestDistance = distToCollision;
-				col->intersectionPoint = collisionPoint;
-				col->foundCollision = true;
-			}
-		}
+		vec3 newDestination = destination - slidingPlane.signedDistanceTo(destination) * slideNormal;
+
+		//Slide along the plane with what is left of the move, without the vertical component
+		basePoint = newBasePoint;
+		velocity = newDestination - packet.intersectionPoint;
+		velocity.y = 0.0f;
+	}
+	slideIterations += passes;
+	if (iteration == maxSlideIterations)
+	{
+		iterationCapHits++;
 	}
+
+	//Transform back to R3 and remove vertical component
+	vec3 result = invCMD * (basePoint - start);
+	result.y = 0.0f;
+	return result;
 }
\ No newline at end of file
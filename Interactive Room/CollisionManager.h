@@ -2,7 +2,14 @@
 #define COLLISION_MANAGER_H
 #include "glm.hpp"
 #include "collision_math.h"
+#include "DistanceField.h"
+#include "CollisionMesh.h"
+#include "CollisionGeometry.h"
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <stdio.h>
 #include <string>
 #include <iostream>
@@ -10,22 +17,162 @@
 //Collision manager, algorithm and plane classes referenced from Soren Seeberg
 //http://www.peroxide.dk/papers/collision/collision.pdf
 
-class Model;
+//Layers a tracked model or a moving object can belong to, used as bit masks
+enum CollisionLayer {
+	LAYER_STATIC = 1 << 0,		//house shell, kitchen cabinets, windows
+	LAYER_FURNITURE = 1 << 1,	//movable furniture
+	LAYER_DECOR = 1 << 2,		//small or transparent decorations
+	LAYER_CAMERA = 1 << 3,		//the player
+	LAYER_ALL = 0xFF
+};
+
+//Describes who is asking to move and what it should collide with
+struct CollisionFilter
+{
+	//layer of the moving object
+	unsigned int layer = LAYER_CAMERA;
+	//layers the moving object collides with
+	unsigned int mask = LAYER_ALL;
+	//models skipped by the query, usually the moving model itself
+	std::vector<const CollisionGeometry*> exclude;
+	//collide with the static distance field instead of sweeping the static models, once the field is built
+	bool useStaticField = false;
+};
+
+//Anything that queues moves with the collision manager and wants the resolved movement back
+class CollisionMover
+{
+public:
+	virtual void moveResolved(vec3 result) = 0;
+};
+
+//A queued move, resolved once per frame by CollisionManager::resolveMoves
+struct MoveRequest
+{
+	CollisionMover* mover;
+	vec3 elipsoidRadius;
+	vec3 R3velocity;
+	vec3 R3position;
+	const CollisionFilter* filter;
+	vec3 result;
+};
 
 class CollisionManager
 {
 public:
+	CollisionManager() : trianglesTested(0), meshNanoseconds(0), meshTriangles(0), meshFallbacks(0),
+		substepsTaken(0), slideIterations(0), iterationCapHits(0), fieldReady(false) {}
 	
 	//prototype for static accessor
 	static CollisionManager *getInstance();
-	void trackModel(Model* model);
-	vec3 askMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position);
-	bool getLowestRoot(float a, float b, float c, float current, float* root);
-	bool checkPointInTriangle(const vec3 &point, const vec3 &p1, const vec3 &p2, const vec3 & p3);
+	void trackModel(CollisionGeometry* model, unsigned int layer = LAYER_FURNITURE);
+	//sets the layer a tracked model belongs to
+	void setLayer(const CollisionGeometry* model, unsigned int layer);
+	//sets which layers of moving objects a tracked model blocks, e.g. LAYER_ALL & ~LAYER_CAMERA to let the player through
+	void setBlocks(const CollisionGeometry* model, unsigned int blocks);
+	//resolves a move right away against the current position of every model
+	vec3 askMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter = CollisionFilter());
+	//queues a move to be resolved by resolveMoves, moves queued by the same mover in one frame are added together.
+	//filter must stay alive until resolveMoves is called
+	void queueMove(CollisionMover* mover, glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter* filter);
+	//resolves every queued move in parallel against a snapshot of the world, then hands the results back to the movers
+	void resolveMoves();
+	//builds the distance field of static models blocking the camera on a worker thread, or loads it from cachePath.
+	//Until it's ready, queries sweep the static models as usual
+	void buildStaticField(const std::string &cachePath);
+	bool staticFieldReady() const { return fieldReady; }
+
+	//records every move resolved by resolveMoves to a text file, to be replayed by the collision benchmark
+	bool startTrace(const std::string &path);
+	void stopTrace();
+	bool isTracing() const { return trace.is_open(); }
+	//triangles handed to the narrowphase since the start
+	unsigned long long getTrianglesTested() const { return trianglesTested; }
+	~CollisionManager();
+
+	//Narrowphase, defined in CollisionNarrowphase.cpp so it can be used without OpenGL
+	static bool getLowestRoot(float a, float b, float c, float current, float* root);
+	static bool checkPointInTriangle(const vec3 &point, const vec3 &p1, const vec3 &p2, const vec3 & p3);
+	static void checkTriangle(CollisionPacket* col, vec3 p1, vec3 p2, vec3 p3);
+	//Same test as checkTriangle, run on 4 (SSE) or 8 (AVX) triangles at a time
+	static void checkTriangleBatch(CollisionPacket* col, const TriangleBatch &batch);
+	//Number of triangles checkTriangleBatch processes per iteration
+	static unsigned int batchWidth();
+
+	//switches askMove between the batched and the one-triangle-at-a-time narrowphase
+	bool useBatchedNarrowphase = true;
+	//sweeps against the simplified collision meshes of the models instead of their bounding boxes
+	bool meshCollision = false;
+	//time collision meshes may take per frame, models queried after that use their bounding boxes
+	float meshBudgetMicroseconds = 2000.0f;
+	//time spent and triangles tested on collision meshes during the last resolveMoves
+	float lastMeshMicroseconds = 0.0f;
+	unsigned int lastMeshTriangles = 0;
+	//collide and slide passes per substep, and the remaining movement (in elipse radii) below which sliding stops
+	unsigned int maxSlideIterations = 5;
+	float slideEpsilon = 0.001f;
+	//substeps, slide iterations and moves that ran out of iterations during the last resolveMoves
+	unsigned int lastSubsteps = 0;
+	unsigned int lastSlideIterations = 0;
+	unsigned int lastIterationCapHits = 0;
 
 private:
-	std::vector<CollisionPacket*> move_queue;
-	std::vector<Model*> tracked_models;
-	void checkTriangle(CollisionPacket* col, vec3 p1, vec3 p2, vec3 p3);
+	struct TrackedModel
+	{
+		CollisionGeometry* model;
+		unsigned int layer;
+		unsigned int blocks;
+		//bounding box triangles in world space, as of the last snapshot
+		TriangleBatch triangles;
+		//baked into the static distance field
+		bool inStaticField;
+		//model matrix and collision meshes, as of the last snapshot
+		mat4 transform;
+		mat4 inverseTransform;
+		std::vector<const CollisionMesh*> meshes;
+	};
+
+	std::vector<MoveRequest> move_queue;
+	std::vector<TrackedModel> tracked_models;
+	TrackedModel* findTracked(const CollisionGeometry* model);
+	bool passesFilter(const TrackedModel &tracked, const CollisionFilter &filter) const;
+	bool isSwept(const TrackedModel &tracked, const CollisionFilter &filter) const;
+	void sweepTriangles(CollisionPacket* packet, const TriangleBatch &batch) const;
+	void sweepCollisionMeshes(CollisionPacket* packet, const TrackedModel &tracked) const;
+	mutable std::atomic<unsigned long long> trianglesTested;
+	std::ofstream trace;
+	unsigned int traceFrame = 0;
+	void writeTrace(const MoveRequest &request);
+	//budget counters, shared by the threads resolving moves
+	mutable std::atomic<long long> meshNanoseconds;
+	mutable std::atomic<unsigned int> meshTriangles;
+	mutable std::atomic<unsigned int> meshFallbacks;
+	//copies the bounding box triangles of a model into its snapshot
+	void snapshotModel(TrackedModel &tracked);
+	//corners filled by getBoundingBoxes, kept between snapshots
+	std::vector<vec3> boxCorners;
+	//substep counters, shared by the threads resolving moves
+	mutable std::atomic<unsigned int> substepsTaken;
+	mutable std::atomic<unsigned int> slideIterations;
+	mutable std::atomic<unsigned int> iterationCapHits;
+	//frames since the last report where the mesh budget ran out, or a move needed substeps or ran out of iterations.
+	//They are reported at most once a second, the frames that need it are the slow ones already
+	unsigned int budgetFrames = 0, hitchFrames = 0;
+	std::chrono::steady_clock::time_point lastReport;
+	void reportFrame(unsigned int moves, unsigned int fallbacks);
+	//resolves a move against the snapshot only, so it can run on any thread
+	vec3 resolveMove(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter) const;
+	//one substep of resolveMove: collides and slides until the move is used up or maxSlideIterations is reached
+	vec3 collideAndSlide(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position, const CollisionFilter &filter) const;
+
+	//distance field of the static models, see buildStaticField
+	DistanceField staticField;
+	TriangleBatch staticTriangles;
+	std::thread fieldBuilder;
+	std::atomic<bool> fieldReady;
+	//moves a sphere along velocity, pushing it out of the static field and sliding along it
+	vec3 slideAgainstField(glm::vec3 elipsoidradius, glm::vec3 R3velocity, glm::vec3 R3position) const;
+	void reportStaticField(const char* source, double milliseconds) const;
+
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "CollisionMesh.h"
+#include <algorithm>
+
+//Triangles per leaf of the hierarchy
+static const unsigned int LEAF_SIZE = 4;
+
+//Vertex of the clustering, sorted by cell
+struct CellEntry
+{
+	long long key;
+	unsigned int vertex;
+};
+
+std::size_t CollisionMesh::scratchBytes(unsigned int vertexCount, unsigned int indexCount)
+{
+	//entries, remap and weights per vertex, a center per triangle, and room to align each array
+	return vertexCount * (sizeof(CellEntry) + sizeof(unsigned int) + sizeof(float)) + indexCount / 3 * sizeof(vec3) + 4 * 16;
+}
+
+void CollisionMesh::build(const std::vector<vec3> &positions, const std::vector<unsigned int> &triangles, float cellSize)
+{
+	LinearArena scratch(scratchBytes(positions.size(), triangles.size()));
+	build(positions.data(), positions.size(), triangles.data(), triangles.size(), cellSize, scratch);
+}
+
+void CollisionMesh::build(const vec3* positions, unsigned int vertexCount, const unsigned int* triangles, unsigned int indexCount, float cellSize, LinearArena &scratch)
+{
+	vertices.clear();
+	indices.clear();
+	nodes.clear();
+	order.clear();
+
+	//Vertex clustering: every vertex is replaced by the average of the vertices in its cell.
+	//Sorting by cell groups them, the first vertex of each cell stands for it
+	CellEntry* entries = scratch.allocate<CellEntry>(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		ivec3 cell = ivec3(floor(positions[i] / cellSize));
+		entries[i].key = ((long long)(cell.x & 0x1FFFFF) << 42) | ((long long)(cell.y & 0x1FFFFF) << 21) | (long long)(cell.z & 0x1FFFFF);
+		entries[i].vertex = i;
+	}
+	std::sort(entries, entries + vertexCount, [](const CellEntry &a, const CellEntry &b) {
+		return a.key < b.key || (a.key == b.key && a.vertex < b.vertex);
+	});
+	unsigned int* remap = scratch.allocate<unsigned int>(vertexCount);
+	unsigned int cellCount = 0;
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		bool first = i == 0 || entries[i].key != entries[i - 1].key;
+		cellCount += first;
+		remap[entries[i].vertex] = first ? entries[i].vertex : remap[entries[i - 1].vertex];
+	}
+	//Cells are numbered in the order their first vertex comes in
+	float* weights = scratch.allocate<float>(cellCount);
+	vertices.reserve(cellCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		if (remap[i] == i)
+		{
+			remap[i] = (unsigned int)vertices.size();
+			vertices.push_back(vec3(0));
+			weights[remap[i]] = 0.0f;
+		}
+		else
+		{
+			remap[i] = remap[remap[i]];
+		}
+		vertices[remap[i]] += positions[i];
+		weights[remap[i]] += 1.0f;
+	}
+	for (unsigned int i = 0; i < vertices.size(); i++)
+	{
+		vertices[i] /= weights[i];
+	}
+
+	//Triangles that collapsed to a line or a point are dropped
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+	{
+		unsigned int a = remap[triangles[i]], b = remap[triangles[i + 1]], c = remap[triangles[i + 2]];
+		kept += !(a == b || b == c || a == c);
+	}
+	indices.reserve(3 * kept);
+	for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+	{
+		unsigned int a = remap[triangles[i]], b = remap[triangles[i + 1]], c = remap[triangles[i + 2]];
+		if (a == b || b == c || a == c)
+		{
+			continue;
+		}
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	}
+
+	if (indices.empty())
+	{
+		return;
+	}
+	vec3* centers = scratch.allocate<vec3>(triangleCount());
+	order.reserve(triangleCount());
+	for (unsigned int i = 0; i < triangleCount(); i++)
+	{
+		centers[i] = (vertices[indices[3 * i]] + vertices[indices[3 * i + 1]] + vertices[indices[3 * i + 2]]) / 3.0f;
+		order.push_back(i);
+	}
+	nodes.reserve(2 * triangleCount() / LEAF_SIZE + 1);
+	buildNode(centers, 0, triangleCount());
+}
+
+//Splits the triangles at the median of the longest axis of their centers
+unsigned int CollisionMesh::buildNode(const vec3* centers, unsigned int first, unsigned int count)
+{
+	Node node;
+	node.boxMin = vertices[indices[3 * order[first]]];
+	node.boxMax = node.boxMin;
+	vec3 centerMin = centers[order[first]], centerMax = centerMin;
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		for (unsigned int j = 0; j < 3; j++)
+		{
+			node.boxMin = min(node.boxMin, vertices[indices[3 * order[i] + j]]);
+			node.boxMax = max(node.boxMax, vertices[indices[3 * order[i] + j]]);
+		}
+		centerMin = min(centerMin, centers[order[i]]);
+		centerMax = max(centerMax, centers[order[i]]);
+	}
+	node.left = node.right = 0;
+	node.first = first;
+	node.count = count;
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(node);
+
+	if (count <= LEAF_SIZE)
+	{
+		return index;
+	}
+
+	vec3 extent = centerMax - centerMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	unsigned int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[centers, axis](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+
+	unsigned int left = buildNode(centers, first, half);
+	unsigned int right = buildNode(centers, first + half, count - half);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+std::size_t CollisionMesh::memoryBytes() const
+{
+	return vertices.capacity() * sizeof(vec3) + (indices.capacity() + order.capacity()) * sizeof(unsigned int) + nodes.capacity() * sizeof(Node);
+}
+
+void CollisionMesh::query(const vec3 &boxMin, const vec3 &boxMax, std::vector<unsigned int> &result) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+	unsigned int stack[64];
+	unsigned int size = 0;
+	stack[size++] = 0;
+	while (size > 0)
+	{
+		const Node &node = nodes[stack[--size]];
+		if (any(lessThan(node.boxMax, boxMin)) || any(greaterThan(node.boxMin, boxMax)))
+		{
+			continue;
+		}
+		if (node.count > 0)
+		{
+			result.insert(result.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+		}
+		else
+		{
+			stack[size++] = node.left;
+			stack[size++] = node.right;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef COLLISION_MESH_H
+#define COLLISION_MESH_H
+#include "glm.hpp"
+#include "Memory.h"
+#include <vector>
+
+using namespace glm;
+
+//Simplified copy of a mesh used for triangle-accurate collision.
+//Vertices are welded on a grid (vertex clustering) so small details collapse, and the remaining
+//triangles are indexed by a bounding volume hierarchy. Everything is in model space.
+class CollisionMesh
+{
+public:
+	std::vector<vec3> vertices;
+	std::vector<unsigned int> indices;
+
+	//Decimates the triangles by merging all vertices falling in the same cellSize cube, then builds the hierarchy
+	void build(const std::vector<vec3> &positions, const std::vector<unsigned int> &triangles, float cellSize);
+	//Same, with the temporary arrays of the build taken from scratch, which needs scratchBytes free
+	void build(const vec3* positions, unsigned int vertexCount, const unsigned int* triangles, unsigned int indexCount, float cellSize, LinearArena &scratch);
+	static std::size_t scratchBytes(unsigned int vertexCount, unsigned int indexCount);
+	//Appends the index of every triangle whose bounds overlap the box
+	void query(const vec3 &boxMin, const vec3 &boxMax, std::vector<unsigned int> &result) const;
+
+	unsigned int triangleCount() const { return (unsigned int)(indices.size() / 3); }
+	bool empty() const { return indices.empty(); }
+	//bytes held by the vertices, indices and hierarchy
+	std::size_t memoryBytes() const;
+
+private:
+	struct Node
+	{
+		vec3 boxMin;
+		vec3 boxMax;
+		//children for inner nodes, range in order for leaves
+		unsigned int left, right;
+		unsigned int first, count;
+	};
+	std::vector<Node> nodes;
+	//triangle indices sorted so every leaf is a contiguous range
+	std::vector<unsigned int> order;
+
+	unsigned int buildNode(const vec3* centers, unsigned int first, unsigned int count);
+};
+#endif
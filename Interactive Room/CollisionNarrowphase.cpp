@@ -0,0 +1,648 @@
+#include "CollisionManager.h"
+#include "collision_math.h"
+#include <cmath>
+
+//Narrowphase of the collision manager: swept elipsoid (unit sphere in elipse space) against triangles.
+//Kept apart from CollisionManager.cpp so it only depends on glm and can be built without OpenGL.
+
+//Triangles whose edges' cross product has a smaller squared length (in elipse space) have no usable plane:
+//both paths skip them instead of sweeping against a NaN normal
+static const float DEGENERATE_CROSS = 1e-12f;
+
+//Solution of quadratic equation references Soren Seedberg
+bool CollisionManager::getLowestRoot(float a, float b, float c, float current, float* root)
+{
+	float determinant = b*b - 4.0f * a * c;
+	//Check for complex solutions
+	if (determinant < 0)
+	{
+		return false;
+	}
+
+	//calculate roots
+	float rootD = sqrt(determinant);
+	float r1 = (-b - rootD) / 2 * a;
+	float r2 = (-b + rootD) / 2 * a;
+
+	//Sort roots
+	if (r1 > r2)
+	{
+		float temp = r2;
+		r2 = r1;
+		r1 = temp;
+	}
+	//We're looking for the lowest value between [0,1];
+	if (r1 > 0 && r1 < current)
+	{
+		*root = r1;
+		return true;
+	}
+
+	//According to reference, this can happen if x1 negative
+	if (r2 > 0 && r2 < current)
+	{
+		*root = r2;
+		return true;
+	}
+
+	return false;
+}
+
+//Barycentric technique referenced from http://blackpawn.com/texts/pointinpoly/
+bool CollisionManager::checkPointInTriangle(const vec3 &point, const vec3 &p1, const vec3 &p2, const vec3 & p3)
+{
+	vec3 v0 = p2 - p1;
+	vec3 v1 = p3 - p1;
+	vec3 v2 = point - p1;
+
+	float dot00 = dot(v0, v0);
+	float dot01 = dot(v0, v1);
+	float dot02 = dot(v0, v2);
+	float dot11 = dot(v1, v1);
+	float dot12 = dot(v1, v2);
+
+	//barycentric coordinates
+	float denumerator = dot00 * dot11 - dot01 * dot01;
+	float u = (dot11 * dot02 - dot01 * dot12) / denumerator;
+	float v = (dot00 * dot12 - dot01 * dot02) / denumerator;
+
+	return (u >= 0) && (v >= 0) && (u + v < 1);
+}
+
+//Assume that p1, p2 and p3 are given in front-facing order
+void CollisionManager::checkTriangle(CollisionPacket* col, vec3 p1, vec3 p2, vec3 p3)
+{
+	vec3 edgeCross = cross(p2 - p1, p3 - p1);
+	if (dot(edgeCross, edgeCross) < DEGENERATE_CROSS)
+	{
+		return;
+	}
+	Plane triangle(p1, p2, p3);
+
+	//Proceed only if triangle is front-facing to normal
+	if (triangle.isFrontFacingTo(col->eNormalizedVelocity))
+	{
+		float t0, t1;
+		bool embeddedInPlane = false;
+
+		//Calculate distance from sphere to plane
+		double distToPlane = triangle.signedDistanceTo(col->eBasePoint);
+		float normalDotVelocity = dot(triangle.normal, col->eVelocity);
+
+		//special case where normal is perpendicular (sphere traveling parallel to plane)
+		if (normalDotVelocity == 0.0f)
+		{
+			if (abs(distToPlane) >= 1.0f)
+			{
+				//no collision
+				return;
+			}
+			else
+			{
+				//sphere embedded in plane
+				embeddedInPlane = true;
+				//sphere interesects plane at all times
+				t0 = 0.0;
+				t1 = 1.0;
+			}
+		}
+		//non-parallel, calculate intersection
+		else
+		{
+			t0 = (-1.0 - distToPlane) / normalDotVelocity;
+			t1 = (1.0 - distToPlane) / normalDotVelocity;
+			//make sure t0 is the smaller distance
+			if (t0 > t1)
+			{
+				float temp = t1;
+				t1 = t0;
+				t0 = temp;
+			}
+		}
+
+		//Check for collisions within the sphere's radius of 1.0f
+		if (t0 > 1.0f || t1 < 0.0f)
+		{
+			//Outside the radius, no collision
+			return;
+		}
+		//Already overlapping the plane when the move starts
+		bool embeddedAtStart = !embeddedInPlane && abs(distToPlane) < 1.0f;
+
+		if (t0 < 0.0)
+		{
+			t0 = 0.0;
+		}
+		if (t1 < 0.0)
+		{
+			t1 = 0.0;
+		}
+		if (t0 > 1.0)
+		{
+			t0 = 1.0;
+		}
+		if (t1 > 1.0)
+		{
+			t1 = 1.0;
+		}
+
+		//If a collision happens it's between these two values
+		vec3 collisionPoint;
+		bool foundCollision = false;
+		float t = 1.0;
+
+		//Check collision inside the triangle
+		if (!embeddedInPlane)
+		{
+			vec3 planeIntersectionPoint = (col->eBasePoint - triangle.normal) + t0 * col->eVelocity;
+			if (checkPointInTriangle(planeIntersectionPoint, p1, p2, p3))
+			{
+				//Overlapping the inside of the triangle, there is no time of contact to find: it is resolved by
+				//pushing the elipsoid back out along the normal (see collideAndSlide). The deepest overlap wins
+				if (embeddedAtStart)
+				{
+					float depth = 1.0f + (float)distToPlane;
+					if (col->foundEmbedded == false || depth > col->embeddedDepth)
+					{
+						col->foundEmbedded = true;
+						col->embeddedDepth = depth;
+						col->embeddedNormal = triangle.normal;
+					}
+					return;
+				}
+				//If collision happened inside the triangle it must have been at t0 (explained in referenced paper)
+				foundCollision = true;
+				t = t0;
+				collisionPoint = planeIntersectionPoint;
+			}
+		}
+
+		//If collision wasn't inside the triangle, proceed with the expensive sweep method for edge/vertex collisions
+		//A triangle collision will always occur before an edge or vertex collision
+		if (!foundCollision)
+		{
+			vec3 velocity = col->eVelocity;
+			vec3 base = col->eBasePoint;
+			float velocitySquaredLength = dot(velocity, velocity);
+			float a, b, c;
+			float newT;
+
+			//As explained in the paper (Equation 3.5), we find the time of intersection by solving the
+			//quadratic equation At^2 + Bt + C, where:
+			//A = dot(velocity, velocity) (velocitySquaredLength, calculated above)
+			//B = 2 * dot(velocity, basePoint - p)
+			//C = dot(p - basePoint, p - basePoint) - 1
+			// p is each of the points to be checked (p1, p2, p3)
+			a = velocitySquaredLength;
+
+			//Check p1
+			b = 2.0f * dot(velocity, base - p1);
+			c = dot(p1 - base, p1 - base) - 1.0;
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				t = newT;
+				foundCollision = true;
+				collisionPoint = p1;
+			}
+
+			//Check p2
+			b = 2.0f * dot(velocity, base - p2);
+			c = dot(p2 - base, p2 - base) - 1.0;
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				t = newT;
+				foundCollision = true;
+				collisionPoint = p2;
+			}
+
+			//Check p3
+			b = 2.0f * dot(velocity, base - p3);
+			c = dot(p3 - base, p3 - base) - 1.0;
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				t = newT;
+				foundCollision = true;
+				collisionPoint = p3;
+			}
+
+			//According to above reference, even if an edge collision is true
+			//We must still check against edges, as it's possible that an
+			//edge collision happens sooner
+
+			//p1 - p2 edge
+			vec3 edge = p2 - p1;
+			vec3 baseToVertex = p1 - base;
+
+			//Calculate a,b,c, as described on page 16
+			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
+			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
+			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
+
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				//Calculate where along the edge (rather, its infinity line) the intersection happens (Equation 3.6)
+				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
+				//Since we calculated roots along the infinity line, check if it lies on the triangle edge
+				if (f >= 0.0 && f <= 1.0)
+				{
+					t = newT;
+					foundCollision = true;
+					collisionPoint = p1 + f*edge;
+				}
+			}
+
+			//Likewise for all other edges
+			//p2 - p3 edge
+			edge = p3 - p2;
+			baseToVertex = p2 - base;
+
+			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
+			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
+			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
+
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
+				if (f >= 0.0 && f <= 1.0)
+				{
+					t = newT;
+					foundCollision = true;
+					collisionPoint = p2 + f*edge;
+				}
+			}
+
+			//p3 - p1 edge
+			edge = p1 - p3;
+			baseToVertex = p3 - base;
+
+			a = dot(edge, edge) * -velocitySquaredLength + dot(edge, velocity) * dot(edge, velocity);
+			b = dot(edge, edge) * 2 * dot(velocity, baseToVertex) - 2 * (dot(edge, velocity) * dot(edge, baseToVertex));
+			c = dot(edge, edge) * (1 - dot(baseToVertex, baseToVertex)) + (dot(edge, baseToVertex) * dot(edge, baseToVertex));
+
+			if (getLowestRoot(a, b, c, t, &newT))
+			{
+				float f = (dot(edge, velocity) * newT - dot(edge, baseToVertex)) / (dot(edge, edge));
+				if (f >= 0.0 && f <= 1.0)
+				{
+					t = newT;
+					foundCollision = true;
+					collisionPoint = p3 + f*edge;
+				}
+			}
+
+		}
+
+		if (foundCollision == true)
+		{
+			//set distance to collision
+			float distToCollision = t*length(col->eVelocity);
+
+			//This is the closest hit if its the first or closest
+			if (col->foundCollision == false || distToCollision < col->nearestDistance)
+			{
+				col->nearestDistance = distToCollision;
+				col->intersectionPoint = collisionPoint;
+				col->foundCollision = true;
+			}
+		}
+	}
+}
+
+//Batched version of checkTriangle.
+//Triangles are stored as a structure of arrays (see TriangleBatch) and each SIMD lane runs the
+//plane, vertex and edge phases of checkTriangle for one triangle. Branches become lane masks,
+//and the closest hit of each batch is found with a masked minimum over the lanes.
+//Operations are kept in the same order as the scalar path so both return the same collision.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define NARROWPHASE_SIMD
+#define NARROWPHASE_WIDTH 8
+typedef __m256 lanes;
+static inline lanes lSet(float f) { return _mm256_set1_ps(f); }
+static inline lanes lLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline void lStore(float* p, lanes a) { _mm256_storeu_ps(p, a); }
+static inline lanes lAdd(lanes a, lanes b) { return _mm256_add_ps(a, b); }
+static inline lanes lSub(lanes a, lanes b) { return _mm256_sub_ps(a, b); }
+static inline lanes lMul(lanes a, lanes b) { return _mm256_mul_ps(a, b); }
+static inline lanes lDiv(lanes a, lanes b) { return _mm256_div_ps(a, b); }
+static inline lanes lSqrt(lanes a) { return _mm256_sqrt_ps(a); }
+static inline lanes lMin(lanes a, lanes b) { return _mm256_min_ps(a, b); }
+static inline lanes lMax(lanes a, lanes b) { return _mm256_max_ps(a, b); }
+static inline lanes lLess(lanes a, lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline lanes lLessEq(lanes a, lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline lanes lEqual(lanes a, lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static inline lanes lAnd(lanes a, lanes b) { return _mm256_and_ps(a, b); }
+static inline lanes lOr(lanes a, lanes b) { return _mm256_or_ps(a, b); }
+static inline lanes lAndNot(lanes mask, lanes a) { return _mm256_andnot_ps(mask, a); }
+static inline lanes lSelect(lanes mask, lanes a, lanes b) { return _mm256_blendv_ps(b, a, mask); }
+static inline int lMask(lanes a) { return _mm256_movemask_ps(a); }
+static inline lanes lIndex() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NARROWPHASE_SIMD
+#define NARROWPHASE_WIDTH 4
+typedef __m128 lanes;
+static inline lanes lSet(float f) { return _mm_set1_ps(f); }
+static inline lanes lLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void lStore(float* p, lanes a) { _mm_storeu_ps(p, a); }
+static inline lanes lAdd(lanes a, lanes b) { return _mm_add_ps(a, b); }
+static inline lanes lSub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+static inline lanes lMul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+static inline lanes lDiv(lanes a, lanes b) { return _mm_div_ps(a, b); }
+static inline lanes lSqrt(lanes a) { return _mm_sqrt_ps(a); }
+static inline lanes lMin(lanes a, lanes b) { return _mm_min_ps(a, b); }
+static inline lanes lMax(lanes a, lanes b) { return _mm_max_ps(a, b); }
+static inline lanes lLess(lanes a, lanes b) { return _mm_cmplt_ps(a, b); }
+static inline lanes lLessEq(lanes a, lanes b) { return _mm_cmple_ps(a, b); }
+static inline lanes lEqual(lanes a, lanes b) { return _mm_cmpeq_ps(a, b); }
+static inline lanes lAnd(lanes a, lanes b) { return _mm_and_ps(a, b); }
+static inline lanes lOr(lanes a, lanes b) { return _mm_or_ps(a, b); }
+static inline lanes lAndNot(lanes mask, lanes a) { return _mm_andnot_ps(mask, a); }
+//SSE2 has no blend instruction, (mask & a) | (~mask & b)
+static inline lanes lSelect(lanes mask, lanes a, lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline int lMask(lanes a) { return _mm_movemask_ps(a); }
+static inline lanes lIndex() { return _mm_setr_ps(0, 1, 2, 3); }
+#endif
+
+#ifdef NARROWPHASE_SIMD
+//Three lanes of floats, one vec3 per triangle
+struct lanes3
+{
+	lanes x, y, z;
+};
+
+static inline lanes3 l3Load(const std::vector<float> &x, const std::vector<float> &y, const std::vector<float> &z, unsigned int i)
+{
+	lanes3 r = { lLoad(&x[i]), lLoad(&y[i]), lLoad(&z[i]) };
+	return r;
+}
+static inline lanes3 l3Set(const vec3 &v)
+{
+	lanes3 r = { lSet(v.x), lSet(v.y), lSet(v.z) };
+	return r;
+}
+static inline lanes3 l3Sub(const lanes3 &a, const lanes3 &b)
+{
+	lanes3 r = { lSub(a.x, b.x), lSub(a.y, b.y), lSub(a.z, b.z) };
+	return r;
+}
+static inline lanes3 l3Add(const lanes3 &a, const lanes3 &b)
+{
+	lanes3 r = { lAdd(a.x, b.x), lAdd(a.y, b.y), lAdd(a.z, b.z) };
+	return r;
+}
+static inline lanes3 l3Scale(const lanes &s, const lanes3 &a)
+{
+	lanes3 r = { lMul(s, a.x), lMul(s, a.y), lMul(s, a.z) };
+	return r;
+}
+static inline lanes3 l3Select(const lanes &mask, const lanes3 &a, const lanes3 &b)
+{
+	lanes3 r = { lSelect(mask, a.x, b.x), lSelect(mask, a.y, b.y), lSelect(mask, a.z, b.z) };
+	return r;
+}
+static inline lanes l3Dot(const lanes3 &a, const lanes3 &b)
+{
+	return lAdd(lAdd(lMul(a.x, b.x), lMul(a.y, b.y)), lMul(a.z, b.z));
+}
+static inline lanes3 l3Cross(const lanes3 &a, const lanes3 &b)
+{
+	lanes3 r = {
+		lSub(lMul(a.y, b.z), lMul(b.y, a.z)),
+		lSub(lMul(a.z, b.x), lMul(b.z, a.x)),
+		lSub(lMul(a.x, b.y), lMul(b.x, a.y))
+	};
+	return r;
+}
+
+//Lane version of getLowestRoot, returns the mask of lanes that found a root below current
+static inline lanes lLowestRoot(lanes a, lanes b, lanes c, lanes current, lanes* root)
+{
+	lanes zero = lSet(0.0f);
+	lanes determinant = lSub(lMul(b, b), lMul(lMul(lSet(4.0f), a), c));
+	//Lanes with complex solutions are masked out, clamp so sqrt stays defined
+	lanes real = lLessEq(zero, determinant);
+	lanes rootD = lSqrt(lMax(determinant, zero));
+	lanes r1 = lMul(lDiv(lSub(lSub(zero, b), rootD), lSet(2.0f)), a);
+	lanes r2 = lMul(lDiv(lAdd(lSub(zero, b), rootD), lSet(2.0f)), a);
+
+	//Sort roots
+	lanes low = lMin(r1, r2);
+	lanes high = lMax(r1, r2);
+
+	lanes lowHit = lAnd(lLess(zero, low), lLess(low, current));
+	lanes highHit = lAnd(lLess(zero, high), lLess(high, current));
+	*root = lSelect(lowHit, low, high);
+	return lAnd(real, lOr(lowHit, highHit));
+}
+
+//Lane version of the vertex sweep in checkTriangle
+static inline void lCheckVertex(const lanes3 &velocity, const lanes3 &base, lanes velocitySquaredLength, const lanes3 &p,
+	lanes sweep, lanes &t, lanes &found, lanes3 &collisionPoint)
+{
+	lanes newT;
+	lanes b = lMul(lSet(2.0f), l3Dot(velocity, l3Sub(base, p)));
+	lanes3 pToBase = l3Sub(p, base);
+	lanes c = lSub(l3Dot(pToBase, pToBase), lSet(1.0f));
+	lanes hit = lAnd(sweep, lLowestRoot(velocitySquaredLength, b, c, t, &newT));
+	t = lSelect(hit, newT, t);
+	found = lOr(found, hit);
+	collisionPoint = l3Select(hit, p, collisionPoint);
+}
+
+//Lane version of the edge sweep in checkTriangle
+static inline void lCheckEdge(const lanes3 &velocity, const lanes3 &base, lanes velocitySquaredLength, const lanes3 &from, const lanes3 &to,
+	lanes sweep, lanes &t, lanes &found, lanes3 &collisionPoint)
+{
+	lanes newT;
+	lanes3 edge = l3Sub(to, from);
+	lanes3 baseToVertex = l3Sub(from, base);
+	lanes edgeSquaredLength = l3Dot(edge, edge);
+	lanes edgeDotVelocity = l3Dot(edge, velocity);
+	lanes edgeDotBaseToVertex = l3Dot(edge, baseToVertex);
+
+	lanes a = lAdd(lMul(edgeSquaredLength, lSub(lSet(0.0f), velocitySquaredLength)), lMul(edgeDotVelocity, edgeDotVelocity));
+	lanes b = lSub(lMul(lMul(edgeSquaredLength, lSet(2.0f)), l3Dot(velocity, baseToVertex)), lMul(lSet(2.0f), lMul(edgeDotVelocity, edgeDotBaseToVertex)));
+	lanes c = lAdd(lMul(edgeSquaredLength, lSub(lSet(1.0f), l3Dot(baseToVertex, baseToVertex))), lMul(edgeDotBaseToVertex, edgeDotBaseToVertex));
+
+	lanes hit = lAnd(sweep, lLowestRoot(a, b, c, t, &newT));
+	//Check that the hit on the infinite line lies on the triangle edge (Equation 3.6)
+	lanes f = lDiv(lSub(lMul(edgeDotVelocity, newT), edgeDotBaseToVertex), edgeSquaredLength);
+	hit = lAnd(hit, lAnd(lLessEq(lSet(0.0f), f), lLessEq(f, lSet(1.0f))));
+	t = lSelect(hit, newT, t);
+	found = lOr(found, hit);
+	collisionPoint = l3Select(hit, l3Add(from, l3Scale(f, edge)), collisionPoint);
+}
+#endif
+
+unsigned int CollisionManager::batchWidth()
+{
+#ifdef NARROWPHASE_SIMD
+	return NARROWPHASE_WIDTH;
+#else
+	return 1;
+#endif
+}
+
+void CollisionManager::checkTriangleBatch(CollisionPacket* col, const TriangleBatch &batch)
+{
+#ifdef NARROWPHASE_SIMD
+	const lanes zero = lSet(0.0f);
+	const lanes one = lSet(1.0f);
+	const lanes3 velocity = l3Set(col->eVelocity);
+	const lanes3 normalizedVelocity = l3Set(col->eNormalizedVelocity);
+	const lanes3 base = l3Set(col->eBasePoint);
+	const lanes velocitySquaredLength = lSet(dot(col->eVelocity, col->eVelocity));
+	const float velocityLength = length(col->eVelocity);
+
+	for (unsigned int i = 0; i < batch.count; i += NARROWPHASE_WIDTH)
+	{
+		//Lanes past the end of the batch only hold padding
+		lanes active = lLess(lAdd(lIndex(), lSet((float)i)), lSet((float)batch.count));
+
+		lanes3 p1 = l3Load(batch.x1, batch.y1, batch.z1, i);
+		lanes3 p2 = l3Load(batch.x2, batch.y2, batch.z2, i);
+		lanes3 p3 = l3Load(batch.x3, batch.y3, batch.z3, i);
+
+		//Plane of each triangle, like Plane(p1, p2, p3)
+		lanes3 e1 = l3Sub(p2, p1);
+		lanes3 e2 = l3Sub(p3, p1);
+		lanes3 normal = l3Cross(e1, e2);
+		lanes crossSquaredLength = l3Dot(normal, normal);
+		active = lAndNot(lLess(crossSquaredLength, lSet(DEGENERATE_CROSS)), active);
+		normal = l3Scale(lDiv(one, lSqrt(crossSquaredLength)), normal);
+		lanes planeConstant = lSub(zero, l3Dot(normal, p1));
+
+		//Proceed only with front-facing triangles
+		lanes facing = l3Dot(normal, normalizedVelocity);
+		active = lAnd(active, lLess(zero, facing));
+		if (lMask(active) == 0)
+		{
+			continue;
+		}
+
+		lanes distToPlane = lAdd(l3Dot(base, normal), planeConstant);
+		lanes normalDotVelocity = l3Dot(normal, velocity);
+
+		//Sphere travelling parallel to the plane: no collision unless embedded in it
+		lanes parallel = lEqual(normalDotVelocity, zero);
+		lanes absDistToPlane = lMax(distToPlane, lSub(zero, distToPlane));
+		active = lAndNot(lAnd(parallel, lLessEq(one, absDistToPlane)), active);
+		lanes embeddedInPlane = parallel;
+
+		lanes t0 = lDiv(lSub(lSub(zero, one), distToPlane), normalDotVelocity);
+		lanes t1 = lDiv(lSub(one, distToPlane), normalDotVelocity);
+		lanes low = lMin(t0, t1);
+		lanes high = lMax(t0, t1);
+		t0 = lSelect(parallel, zero, low);
+		t1 = lSelect(parallel, one, high);
+
+		//Outside the radius
+		active = lAndNot(lOr(lLess(one, t0), lLess(t1, zero)), active);
+		lanes embeddedAtStart = lAndNot(parallel, lLess(absDistToPlane, one));
+		if (lMask(active) == 0)
+		{
+			continue;
+		}
+		t0 = lMin(lMax(t0, zero), one);
+
+		//Check collision inside the triangle, barycentric test of checkPointInTriangle
+		lanes3 planeIntersectionPoint = l3Add(l3Sub(base, normal), l3Scale(t0, velocity));
+		lanes3 v2 = l3Sub(planeIntersectionPoint, p1);
+		lanes dot00 = l3Dot(e1, e1);
+		lanes dot01 = l3Dot(e1, e2);
+		lanes dot02 = l3Dot(e1, v2);
+		lanes dot11 = l3Dot(e2, e2);
+		lanes dot12 = l3Dot(e2, v2);
+		lanes denumerator = lSub(lMul(dot00, dot11), lMul(dot01, dot01));
+		lanes u = lDiv(lSub(lMul(dot11, dot02), lMul(dot01, dot12)), denumerator);
+		lanes v = lDiv(lSub(lMul(dot00, dot12), lMul(dot01, dot02)), denumerator);
+		lanes inside = lAnd(lAnd(lLessEq(zero, u), lLessEq(zero, v)), lLess(lAdd(u, v), one));
+		inside = lAnd(lAndNot(embeddedInPlane, inside), active);
+
+		//Sweep against the vertices and edges for lanes that didn't hit the inside of the triangle
+		lanes sweep = lAndNot(inside, active);
+
+		//Lanes overlapping the inside of their triangle at the start are pushed out instead, like in checkTriangle
+		lanes embedded = lAnd(inside, embeddedAtStart);
+		inside = lAndNot(embedded, inside);
+		if (lMask(embedded) != 0)
+		{
+			float depths[NARROWPHASE_WIDTH];
+			lStore(depths, lSelect(embedded, lAdd(one, distToPlane), lSet(-INFINITY)));
+			unsigned int deepest = 0;
+			for (unsigned int lane = 1; lane < NARROWPHASE_WIDTH; lane++)
+			{
+				if (depths[lane] > depths[deepest])
+				{
+					deepest = lane;
+				}
+			}
+			if (col->foundEmbedded == false || depths[deepest] > col->embeddedDepth)
+			{
+				float nx[NARROWPHASE_WIDTH], ny[NARROWPHASE_WIDTH], nz[NARROWPHASE_WIDTH];
+				lStore(nx, normal.x);
+				lStore(ny, normal.y);
+				lStore(nz, normal.z);
+				col->foundEmbedded = true;
+				col->embeddedDepth = depths[deepest];
+				col->embeddedNormal = vec3(nx[deepest], ny[deepest], nz[deepest]);
+			}
+		}
+
+		lanes found = inside;
+		lanes t = lSelect(inside, t0, one);
+		lanes3 collisionPoint = planeIntersectionPoint;
+
+		if (lMask(sweep) != 0)
+		{
+			lCheckVertex(velocity, base, velocitySquaredLength, p1, sweep, t, found, collisionPoint);
+			lCheckVertex(velocity, base, velocitySquaredLength, p2, sweep, t, found, collisionPoint);
+			lCheckVertex(velocity, base, velocitySquaredLength, p3, sweep, t, found, collisionPoint);
+			lCheckEdge(velocity, base, velocitySquaredLength, p1, p2, sweep, t, found, collisionPoint);
+			lCheckEdge(velocity, base, velocitySquaredLength, p2, p3, sweep, t, found, collisionPoint);
+			lCheckEdge(velocity, base, velocitySquaredLength, p3, p1, sweep, t, found, collisionPoint);
+		}
+
+		int foundMask = lMask(found);
+		if (foundMask == 0)
+		{
+			continue;
+		}
+
+		//Masked minimum: lanes without a hit are pushed to infinity, the first lane holding the minimum wins
+		//just like the first of several equally close triangles wins in the scalar path
+		float times[NARROWPHASE_WIDTH];
+		lStore(times, lSelect(found, t, lSet(INFINITY)));
+		unsigned int nearest = 0;
+		for (unsigned int lane = 1; lane < NARROWPHASE_WIDTH; lane++)
+		{
+			if (times[lane] < times[nearest])
+			{
+				nearest = lane;
+			}
+		}
+
+		float distToCollision = times[nearest] * velocityLength;
+		if (col->foundCollision == false || distToCollision < col->nearestDistance)
+		{
+			float px[NARROWPHASE_WIDTH], py[NARROWPHASE_WIDTH], pz[NARROWPHASE_WIDTH];
+			lStore(px, collisionPoint.x);
+			lStore(py, collisionPoint.y);
+			lStore(pz, collisionPoint.z);
+			col->nearestDistance = distToCollision;
+			col->intersectionPoint = vec3(px[nearest], py[nearest], pz[nearest]);
+			col->foundCollision = true;
+		}
+	}
+#else
+	//No SIMD support, fall back to the scalar test
+	for (unsigned int i = 0; i < batch.count; i++)
+	{
+		checkTriangle(col,
+			vec3(batch.x1[i], batch.y1[i], batch.z1[i]),
+			vec3(batch.x2[i], batch.y2[i], batch.z2[i]),
+			vec3(batch.x3[i], batch.y3[i], batch.z3[i]));
+	}
+#endif
+}
@@ -0,0 +1,301 @@
+#include "DistanceField.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+static const unsigned int FIELD_MAGIC = 0x46445349; //"ISDF"
+static const unsigned int FIELD_VERSION = 1;
+
+//Closest point on a triangle, from Christer Ericson's Real-Time Collision Detection, section 5.1.5
+static vec3 closestPointOnTriangle(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c)
+{
+	vec3 ab = b - a;
+	vec3 ac = c - a;
+	vec3 ap = p - a;
+	float d1 = dot(ab, ap);
+	float d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	vec3 bp = p - b;
+	float d3 = dot(ab, bp);
+	float d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + (d1 / (d1 - d3)) * ab;
+
+	vec3 cp = p - c;
+	float d5 = dot(ab, cp);
+	float d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + (d2 / (d2 - d6)) * ac;
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+
+	//inside the face
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+void DistanceField::build(const TriangleBatch &triangles, float voxelSize, float band)
+{
+	this->voxelSize = voxelSize;
+	this->band = band;
+	hash = hashTriangles(triangles, voxelSize, band);
+	brickIndex.clear();
+	brickData.clear();
+	if (triangles.count == 0)
+	{
+		return;
+	}
+
+	//Bounds of every triangle, and of the whole soup grown by the band
+	std::vector<vec3> triMin(triangles.count), triMax(triangles.count);
+	vec3 low(triangles.x1[0], triangles.y1[0], triangles.z1[0]);
+	vec3 high = low;
+	for (unsigned int i = 0; i < triangles.count; i++)
+	{
+		vec3 p1(triangles.x1[i], triangles.y1[i], triangles.z1[i]);
+		vec3 p2(triangles.x2[i], triangles.y2[i], triangles.z2[i]);
+		vec3 p3(triangles.x3[i], triangles.y3[i], triangles.z3[i]);
+		triMin[i] = min(p1, min(p2, p3));
+		triMax[i] = max(p1, max(p2, p3));
+		low = min(low, triMin[i]);
+		high = max(high, triMax[i]);
+	}
+	origin = low - vec3(band);
+	vec3 size = high - low + vec3(2 * band);
+	//Neighbouring bricks repeat their boundary samples, so a brick spans BRICK - 1 voxels
+	float brickSize = (BRICK - 1) * voxelSize;
+	bricksX = (int)ceil(size.x / brickSize) + 1;
+	bricksY = (int)ceil(size.y / brickSize) + 1;
+	bricksZ = (int)ceil(size.z / brickSize) + 1;
+	unsigned int total = bricksX * bricksY * bricksZ;
+
+	//Each worker takes the next brick until none are left
+	std::vector<std::vector<float>> samples(total);
+	std::atomic<unsigned int> nextBrick(0);
+	auto work = [&]()
+	{
+		std::vector<unsigned int> candidates;
+		unsigned int brick;
+		while ((brick = nextBrick++) < total)
+		{
+			int bx = brick % bricksX;
+			int by = (brick / bricksX) % bricksY;
+			int bz = brick / (bricksX * bricksY);
+			vec3 brickMin = origin + vec3(bx, by, bz) * brickSize;
+			vec3 brickMax = brickMin + vec3(brickSize);
+
+			//Only triangles within band of the brick can change its samples
+			candidates.clear();
+			for (unsigned int i = 0; i < triangles.count; i++)
+			{
+				if (all(lessThanEqual(triMin[i], brickMax + vec3(band))) && all(greaterThanEqual(triMax[i], brickMin - vec3(band))))
+				{
+					candidates.push_back(i);
+				}
+			}
+			if (candidates.empty())
+			{
+				continue;
+			}
+
+			std::vector<float> values(BRICK * BRICK * BRICK, band);
+			bool near = false;
+			for (int z = 0; z < BRICK; z++)
+				for (int y = 0; y < BRICK; y++)
+					for (int x = 0; x < BRICK; x++)
+					{
+						vec3 p = brickMin + vec3(x, y, z) * voxelSize;
+						float closest = band * band;
+						for (unsigned int c = 0; c < candidates.size(); c++)
+						{
+							unsigned int i = candidates[c];
+							vec3 q = closestPointOnTriangle(p,
+								vec3(triangles.x1[i], triangles.y1[i], triangles.z1[i]),
+								vec3(triangles.x2[i], triangles.y2[i], triangles.z2[i]),
+								vec3(triangles.x3[i], triangles.y3[i], triangles.z3[i]));
+							closest = std::min(closest, dot(p - q, p - q));
+						}
+						float d = sqrt(closest);
+						if (d < band)
+							near = true;
+						values[x + BRICK * (y + BRICK * z)] = d;
+					}
+			if (near)
+			{
+				samples[brick].swap(values);
+			}
+		}
+	};
+	unsigned int count = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < count; i++)
+		workers.push_back(std::thread(work));
+	work();
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	//Pack the bricks that were kept
+	brickIndex.assign(total, -1);
+	int stored = 0;
+	for (unsigned int i = 0; i < total; i++)
+	{
+		if (!samples[i].empty())
+		{
+			brickIndex[i] = stored++;
+			brickData.insert(brickData.end(), samples[i].begin(), samples[i].end());
+		}
+	}
+}
+
+bool DistanceField::save(const std::string &path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	unsigned int header[] = { FIELD_MAGIC, FIELD_VERSION };
+	unsigned int indices = (unsigned int)brickIndex.size();
+	unsigned int data = (unsigned int)brickData.size();
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&hash, sizeof(hash));
+	file.write((const char*)&origin, sizeof(origin));
+	file.write((const char*)&voxelSize, sizeof(voxelSize));
+	file.write((const char*)&band, sizeof(band));
+	file.write((const char*)&bricksX, sizeof(bricksX));
+	file.write((const char*)&bricksY, sizeof(bricksY));
+	file.write((const char*)&bricksZ, sizeof(bricksZ));
+	file.write((const char*)&indices, sizeof(indices));
+	file.write((const char*)&data, sizeof(data));
+	file.write((const char*)brickIndex.data(), indices * sizeof(int));
+	file.write((const char*)brickData.data(), data * sizeof(float));
+	return (bool)file;
+}
+
+bool DistanceField::load(const std::string &path, unsigned long long expectedHash)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	unsigned int header[2];
+	unsigned long long fileHash;
+	unsigned int indices, data;
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&fileHash, sizeof(fileHash));
+	if (!file || header[0] != FIELD_MAGIC || header[1] != FIELD_VERSION || fileHash != expectedHash)
+	{
+		return false;
+	}
+	file.read((char*)&origin, sizeof(origin));
+	file.read((char*)&voxelSize, sizeof(voxelSize));
+	file.read((char*)&band, sizeof(band));
+	file.read((char*)&bricksX, sizeof(bricksX));
+	file.read((char*)&bricksY, sizeof(bricksY));
+	file.read((char*)&bricksZ, sizeof(bricksZ));
+	file.read((char*)&indices, sizeof(indices));
+	file.read((char*)&data, sizeof(data));
+	if (!file || indices != (unsigned int)(bricksX * bricksY * bricksZ))
+	{
+		return false;
+	}
+	brickIndex.resize(indices);
+	brickData.resize(data);
+	file.read((char*)brickIndex.data(), indices * sizeof(int));
+	file.read((char*)brickData.data(), data * sizeof(float));
+	if (!file)
+	{
+		brickIndex.clear();
+		brickData.clear();
+		return false;
+	}
+	hash = fileHash;
+	return true;
+}
+
+//FNV-1a over the raw triangle coordinates and build settings
+unsigned long long DistanceField::hashTriangles(const TriangleBatch &triangles, float voxelSize, float band)
+{
+	unsigned long long h = 14695981039346656037ull;
+	auto add = [&h](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			h ^= bytes[i];
+			h *= 1099511628211ull;
+		}
+	};
+	const std::vector<float>* arrays[] = { &triangles.x1, &triangles.y1, &triangles.z1, &triangles.x2, &triangles.y2, &triangles.z2, &triangles.x3, &triangles.y3, &triangles.z3 };
+	for (unsigned int i = 0; i < 9; i++)
+	{
+		add(arrays[i]->data(), triangles.count * sizeof(float));
+	}
+	add(&voxelSize, sizeof(voxelSize));
+	add(&band, sizeof(band));
+	int brick = BRICK;
+	add(&brick, sizeof(brick));
+	return h;
+}
+
+float DistanceField::sample(int x, int y, int z) const
+{
+	//Boundary samples are repeated in both bricks, read them from the higher one
+	int bx = x / (BRICK - 1), by = y / (BRICK - 1), bz = z / (BRICK - 1);
+	if (x < 0 || y < 0 || z < 0 || bx >= bricksX || by >= bricksY || bz >= bricksZ)
+	{
+		return band;
+	}
+	int brick = brickIndex[bx + bricksX * (by + bricksY * bz)];
+	if (brick < 0)
+	{
+		return band;
+	}
+	int lx = x - bx * (BRICK - 1), ly = y - by * (BRICK - 1), lz = z - bz * (BRICK - 1);
+	return brickData[brick * BRICK * BRICK * BRICK + lx + BRICK * (ly + BRICK * lz)];
+}
+
+float DistanceField::distance(const vec3 &point) const
+{
+	if (brickIndex.empty())
+	{
+		return band;
+	}
+	vec3 grid = (point - origin) / voxelSize;
+	vec3 cell = floor(grid);
+	vec3 f = grid - cell;
+	int x = (int)cell.x, y = (int)cell.y, z = (int)cell.z;
+
+	float c000 = sample(x, y, z), c100 = sample(x + 1, y, z);
+	float c010 = sample(x, y + 1, z), c110 = sample(x + 1, y + 1, z);
+	float c001 = sample(x, y, z + 1), c101 = sample(x + 1, y, z + 1);
+	float c011 = sample(x, y + 1, z + 1), c111 = sample(x + 1, y + 1, z + 1);
+
+	float c00 = mix(c000, c100, f.x), c10 = mix(c010, c110, f.x);
+	float c01 = mix(c001, c101, f.x), c11 = mix(c011, c111, f.x);
+	return mix(mix(c00, c10, f.y), mix(c01, c11, f.y), f.z);
+}
+
+vec3 DistanceField::gradient(const vec3 &point) const
+{
+	float h = 0.5f * voxelSize;
+	return vec3(
+		distance(point + vec3(h, 0, 0)) - distance(point - vec3(h, 0, 0)),
+		distance(point + vec3(0, h, 0)) - distance(point - vec3(0, h, 0)),
+		distance(point + vec3(0, 0, h)) - distance(point - vec3(0, 0, h))) / (2.0f * h);
+}
@@ -0,0 +1,50 @@
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+#include "glm.hpp"
+#include "collision_math.h"
+#include <vector>
+#include <string>
+
+//Sparse distance field of a triangle soup, used for constant time collision against static geometry.
+//Space is split into bricks of BRICK^3 samples; only bricks closer than `band` to a triangle store samples,
+//every other brick reads as `band`. The soup is open (bounding boxes seen as surfaces, like the sweep in
+//checkTriangle does) so distances are unsigned.
+class DistanceField
+{
+public:
+	static const int BRICK = 8;
+
+	//Samples the field around the triangles, splitting the bricks between worker threads
+	void build(const TriangleBatch &triangles, float voxelSize, float band);
+	//Cache on disk, load fails if the file was built from other triangles or settings
+	bool save(const std::string &path) const;
+	bool load(const std::string &path, unsigned long long expectedHash);
+	//Identifies the triangles and settings a field was built from
+	static unsigned long long hashTriangles(const TriangleBatch &triangles, float voxelSize, float band);
+
+	//Trilinear distance to the closest triangle, capped at band
+	float distance(const vec3 &point) const;
+	//Central difference of distance, points away from the closest triangle
+	vec3 gradient(const vec3 &point) const;
+
+	bool empty() const { return brickIndex.empty(); }
+	float getBand() const { return band; }
+	unsigned int brickCount() const { return (unsigned int)brickIndex.size(); }
+	unsigned int storedBrickCount() const { return (unsigned int)(brickData.size() / (BRICK * BRICK * BRICK)); }
+	size_t memoryBytes() const { return brickIndex.size() * sizeof(int) + brickData.size() * sizeof(float); }
+
+private:
+	vec3 origin;
+	float voxelSize = 1.0f;
+	float band = 0.0f;
+	//number of bricks along each axis
+	int bricksX = 0, bricksY = 0, bricksZ = 0;
+	//offset of each brick in brickData divided by BRICK^3, -1 for bricks far from every triangle
+	std::vector<int> brickIndex;
+	std::vector<float> brickData;
+	unsigned long long hash = 0;
+
+	//distance stored at a sample of the grid
+	float sample(int x, int y, int z) const;
+};
+#endif
@@ -24,7 +24,7 @@ const float SENSITIVTY = 0.15f;
 const float ZOOM       = 45.0f;
 
 // Camera class that allows for easy modification of position, target, and zoom in OpenGL
-class Camera
+class Camera : public CollisionMover
 {
 public:
 	// Camera Attributes
@@ -34,6 +34,8 @@ public:
 	glm::vec3 Right;
 	glm::vec3 WorldUp;
 	glm::vec3 PlayerElipse;
+	// Collision layer of the player, collides with everything by default
+	CollisionFilter PlayerFilter;
 	// Eular Angles
 	float Yaw;
 	float Pitch;
@@ -50,6 +52,8 @@ public:
 		this->Yaw      = yaw;
 		this->Pitch    = pitch;
 		this->PlayerElipse = glm::vec3(1,1,1);
+		// The house shell is resolved with the static distance field once it's built
+		this->PlayerFilter.useStaticField = true;
 		updateCameraVectors();
 	}
 
@@ -89,10 +93,24 @@ public:
 
 		//center the elipse just above the ground so it collides with low objects
 		collisionSphereCenter.y = PlayerElipse.y + 1.0f;
-		vec3 result = CollisionManager::getInstance()->askMove(PlayerElipse, velocity, collisionSphereCenter);
+		//Resolved with the other moves of this frame by CollisionManager::resolveMoves
+		CollisionManager::getInstance()->queueMove(this, PlayerElipse, velocity, collisionSphereCenter, &PlayerFilter);
+	}
+
+	// Applies the movement left after collision
+	void moveResolved(glm::vec3 result)
+	{
 		Position += result;
 	}
 
+	// Sets the Eular angles directly, used to copy the orientation of another camera
+	void SetOrientation(float yaw, float pitch)
+	{
+		Yaw   = yaw;
+		Pitch = pitch;
+		updateCameraVectors();
+	}
+
 	// Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
 	void ProcessMouseMovement(float xoffset, float yoffset)
 	{
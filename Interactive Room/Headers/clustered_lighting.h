@@ -0,0 +1,98 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "shader.h"
+#include "LightClusters.h"
+#include <vector>
+
+// GPU side of the clustered lights: the light list, the clusters and the light indices, each in a texture buffer.
+// The fragment shader finds its cluster from gl_FragCoord and loops over that cluster's lights only
+class ClusteredLighting
+{
+public:
+	// texture units of the buffers, the meshes' own textures start at 0
+	static const unsigned int LIGHT_UNIT = 13;
+	static const unsigned int CLUSTER_UNIT = 14;
+	static const unsigned int INDEX_UNIT = 15;
+
+	// creates the buffers for up to maxLights lights and binds them to their units for good
+	void create(unsigned int maxLights)
+	{
+		this->maxLights = maxLights;
+		texels.reserve(2 * maxLights);
+		createBuffer(lightBuffer, lightTexture, LIGHT_UNIT, GL_RGBA32F, 2 * maxLights * sizeof(glm::vec4));
+		createBuffer(clusterBuffer, clusterTexture, CLUSTER_UNIT, GL_RG32UI, 2 * LightClusters::CLUSTER_COUNT * sizeof(unsigned int));
+		createBuffer(indexBuffer, indexTexture, INDEX_UNIT, GL_R32UI, LightClusters::MAX_INDICES * sizeof(unsigned int));
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// points the shader's samplers at the buffers and gives it the depth range the clusters are sliced over
+	void setup(Shader &shader, float zNear, float zFar) const
+	{
+		shader.use();
+		shader.setInt("lights", LIGHT_UNIT);
+		shader.setInt("clusters", CLUSTER_UNIT);
+		shader.setInt("lightIndices", INDEX_UNIT);
+		shader.setFloat("zNear", zNear);
+		shader.setFloat("zFar", zFar);
+	}
+
+	// sends the lights and the clusters built from them this frame
+	void upload(const std::vector<PointLight> &lights, const LightClusters &clusters)
+	{
+		unsigned int count = glm::min((unsigned int)lights.size(), maxLights);
+		texels.resize(2 * count);
+		for (unsigned int i = 0; i < count; i++) {
+			texels[2 * i] = glm::vec4(lights[i].position, lights[i].attenuation);
+			texels[2 * i + 1] = glm::vec4(lights[i].color, (float)lights[i].shadowMap);
+		}
+		update(lightBuffer, 2 * maxLights * sizeof(glm::vec4), texels.data(), texels.size() * sizeof(glm::vec4));
+		update(clusterBuffer, 2 * LightClusters::CLUSTER_COUNT * sizeof(unsigned int), clusters.getClusters(),
+			2 * LightClusters::CLUSTER_COUNT * sizeof(unsigned int));
+		update(indexBuffer, LightClusters::MAX_INDICES * sizeof(unsigned int), clusters.getIndices(), clusters.getIndexCount() * sizeof(unsigned int));
+	}
+
+	// deletes the buffers, must run while the context is still current
+	void release()
+	{
+		GLuint buffers[3] = { lightBuffer, clusterBuffer, indexBuffer };
+		GLuint textures[3] = { lightTexture, clusterTexture, indexTexture };
+		glDeleteBuffers(3, buffers);
+		glDeleteTextures(3, textures);
+		lightBuffer = clusterBuffer = indexBuffer = 0;
+		lightTexture = clusterTexture = indexTexture = 0;
+	}
+
+private:
+	unsigned int maxLights = 0;
+	GLuint lightBuffer = 0, clusterBuffer = 0, indexBuffer = 0;
+	GLuint lightTexture = 0, clusterTexture = 0, indexTexture = 0;
+	// two texels per light: position and attenuation, then color and shadow map
+	std::vector<glm::vec4> texels;
+
+	static void createBuffer(GLuint &buffer, GLuint &texture, unsigned int unit, GLenum format, size_t bytes)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		glGenTextures(1, &texture);
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// orphans the buffer's storage, so the GPU can still read last frame's, then writes the used part
+	static void update(GLuint buffer, size_t capacity, const void* data, size_t bytes)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+		if (bytes)
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+};
+#endif
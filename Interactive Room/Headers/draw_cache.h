@@ -0,0 +1,229 @@
+#ifndef DRAW_CACHE_H
+#define DRAW_CACHE_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "shader.h"
+#include "model.h"
+#include "instancing.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include <vector>
+
+// Retained draw commands of the models. For each model and each shader it is drawn with, the program, the uniform
+// locations, and every mesh's vertex array, index count, offset and textures with their sampler locations are
+// resolved once, the first time the model is drawn that way; a frame then replays them without looking anything up.
+// The meshes in view are kept between frames too: a model is culled again only when it moved or the view changed, so
+// a frame where nothing moved costs the draw calls and little else. Selecting a model switches it to the selection
+// shader, which is only recorded the first time and kept
+class DrawCache
+{
+public:
+	// texture units whose bindings are tracked within a model's draw, meshes of a model often share their textures
+	static const unsigned int TRACKED_UNITS = 16;
+
+	// a model's render matrix changed: it is culled again and the matrices of its instanced meshes recomputed
+	void moved(unsigned int index)
+	{
+		if (index < entries.size())
+			entries[index].moved = true;
+	}
+
+	// updates the meshes in view of the first modelCount models, on the job system. Only the models that moved are
+	// culled again, or all of them if viewProjection isn't the one of the last cull
+	void cull(const glm::mat4 &viewProjection, unsigned int modelCount)
+	{
+		PROFILE_ZONE("DrawCache::cull");
+		if (entries.size() < modelCount)
+			entries.resize(modelCount);
+		bool viewChanged = viewProjection != culledWith;
+		culledWith = viewProjection;
+		stale.clear();
+		for (unsigned int i = 0; i < modelCount; i++) {
+			Entry &entry = entries[i];
+			if (!viewChanged && !entry.moved)
+				continue;
+			//sized once, the first time the model is seen
+			unsigned int meshCount = Model::models[i]->meshCount();
+			if (entry.visible.size() < meshCount) {
+				entry.visible.resize(meshCount);
+				entry.matrices.resize(meshCount);
+			}
+			stale.push_back(i);
+		}
+		if (stale.empty())
+			return;
+		JobSystem::getInstance()->parallelFor(0, (unsigned int)stale.size(), 4, [this, &viewProjection](unsigned int first, unsigned int last) {
+			for (unsigned int i = first; i < last; ++i) {
+				Entry &entry = entries[stale[i]];
+				const Model &model = *(Model::models[stale[i]]);
+				entry.visibleCount = model.cull(viewProjection, entry.visible.data());
+				if (entry.moved) {
+					for (unsigned int j = 0; j < model.meshes.size(); j++)
+						entry.matrices[j] = model.meshMatrix(model.meshes[j]);
+					entry.moved = false;
+				}
+			}
+		});
+	}
+
+	// models culled again by the last cull, 0 on a frame where nothing moved
+	unsigned int getCulled() const { return (unsigned int)stale.size(); }
+
+	// replays the commands of the meshes of model index in view, recording them first if the model was never drawn
+	// with this shader. Meshes sharing their buffers with others are handed to batcher instead, if the model is drawn
+	// with the batcher's shader. with replaces the model's own shader for this draw
+	void draw(unsigned int index, InstanceBatcher* batcher = nullptr, Shader* with = nullptr)
+	{
+		if (index >= entries.size())
+			return;
+		Model &model = *(Model::models[index]);
+		Entry &entry = entries[index];
+		Shader &shader = with ? *with : *model.getShader();
+		const Recording &recording = find(entry, model, shader);
+		shader.use();
+		glUniform1i(recording.id, model.ID);
+		Model::transforms.bind(model.ID - 1);
+		bool batching = batcher && batcher->shader == &shader;
+
+		//state set by this draw, the next one starts over as other passes bind in between
+		GLuint bound[TRACKED_UNITS] = {};
+		Sampler samplers[TRACKED_UNITS];
+		unsigned int samplerCount = 0;
+		glm::vec3 offset(0);
+		for (unsigned int i = 0; i < entry.visibleCount; i++) {
+			unsigned int mesh = entry.visible[i];
+			if (batching && model.meshes[mesh].isShared()) {
+				batcher->add(model.meshes[mesh], entry.matrices[mesh], Model::transforms.get(model.ID - 1).normal);
+				continue;
+			}
+			const Command &command = recording.commands[mesh];
+			if (command.offset != offset) {
+				offset = command.offset;
+				glUniform3fv(recording.meshOffset, 1, &offset[0]);
+			}
+			for (unsigned int unit = 0; unit < command.bindingCount; unit++) {
+				const Binding &binding = recording.bindings[command.firstBinding + unit];
+				if (!setSampler(samplers, samplerCount, binding.location, unit))
+					glUniform1i(binding.location, unit);
+				if (unit < TRACKED_UNITS && bound[unit] == binding.texture)
+					continue;
+				glActiveTexture(GL_TEXTURE0 + unit);
+				glBindTexture(GL_TEXTURE_2D, binding.texture);
+				if (unit < TRACKED_UNITS)
+					bound[unit] = binding.texture;
+			}
+			glBindVertexArray(command.vao);
+			glDrawElements(GL_TRIANGLES, command.indexCount, GL_UNSIGNED_INT, 0);
+		}
+		glBindVertexArray(0);
+		glActiveTexture(GL_TEXTURE0);
+		if (offset != glm::vec3(0))
+			glUniform3f(recording.meshOffset, 0, 0, 0);
+	}
+
+	// recordings made so far, one per model and shader it was drawn with
+	unsigned int getRecordings() const { return recordings; }
+
+private:
+	// a texture of a mesh, bound to the unit of its index, and the location of its sampler (-1 if the shader has none)
+	struct Binding
+	{
+		GLint location;
+		GLuint texture;
+	};
+	// what drawing one mesh takes, resolved
+	struct Command
+	{
+		GLuint vao;
+		GLsizei indexCount;
+		glm::vec3 offset;
+		unsigned int firstBinding, bindingCount;
+	};
+	// the commands of every mesh of a model for one shader, by mesh index
+	struct Recording
+	{
+		const Shader* shader;
+		GLint id, meshOffset;
+		std::vector<Command> commands;
+		std::vector<Binding> bindings;
+	};
+	struct Entry
+	{
+		std::vector<Recording> recordings;
+		// meshes in view as of the last cull, the first visibleCount of visible
+		std::vector<unsigned int> visible;
+		unsigned int visibleCount = 0;
+		// matrix of each mesh, the instanced draws take it as an attribute
+		std::vector<glm::mat4> matrices;
+		bool moved = true;
+	};
+	struct Sampler
+	{
+		GLint location;
+		GLint unit;
+	};
+
+	std::vector<Entry> entries;
+	glm::mat4 culledWith = glm::mat4(0);
+	// models to cull this frame
+	std::vector<unsigned int> stale;
+	unsigned int recordings = 0;
+
+	const Recording &find(Entry &entry, const Model &model, const Shader &shader)
+	{
+		for (unsigned int i = 0; i < entry.recordings.size(); i++) {
+			if (entry.recordings[i].shader == &shader)
+				return entry.recordings[i];
+		}
+		PROFILE_ZONE("DrawCache::record");
+		entry.recordings.emplace_back();
+		Recording &recording = entry.recordings.back();
+		recording.shader = &shader;
+		recording.id = glGetUniformLocation(shader.ID, "id");
+		recording.meshOffset = glGetUniformLocation(shader.ID, "meshOffset");
+		recording.commands.resize(model.meshes.size());
+		for (unsigned int i = 0; i < model.meshes.size(); i++) {
+			const Mesh &mesh = model.meshes[i];
+			Command &command = recording.commands[i];
+			//the depth and selection shaders read the position stream and no textures, as in Mesh::Draw
+			command.vao = shader.positionsOnly ? mesh.positionVAO : mesh.VAO;
+			command.indexCount = mesh.indexCount;
+			command.offset = mesh.offset;
+			command.firstBinding = recording.bindings.size();
+			command.bindingCount = shader.positionsOnly ? 0 : mesh.textures.size();
+			for (unsigned int j = 0; j < command.bindingCount; j++) {
+				Binding binding;
+				binding.location = glGetUniformLocation(shader.ID, mesh.samplers[j].c_str());
+				binding.texture = mesh.textures[j].id;
+				recording.bindings.push_back(binding);
+			}
+		}
+		recordings++;
+		return recording;
+	}
+
+	// whether the sampler at location needs no glUniform1i: the shader doesn't have it, or this draw set it to unit
+	// already. Otherwise remembers it is set now
+	static bool setSampler(Sampler* samplers, unsigned int &count, GLint location, GLint unit)
+	{
+		if (location < 0)
+			return true;
+		for (unsigned int i = 0; i < count; i++) {
+			if (samplers[i].location != location)
+				continue;
+			if (samplers[i].unit == unit)
+				return true;
+			samplers[i].unit = unit;
+			return false;
+		}
+		if (count < TRACKED_UNITS) {
+			samplers[count].location = location;
+			samplers[count].unit = unit;
+			count++;
+		}
+		return false;
+	}
+};
+#endif
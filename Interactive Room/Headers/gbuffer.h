@@ -0,0 +1,130 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "shader.h"
+
+// Deferred path for the opaque models: they are drawn once into a G-buffer of albedo, normal and depth, then a full
+// screen pass lights each visible pixel once, whatever the overdraw was. The lighting pass writes the colour and the
+// depth to the default framebuffer, so the transparent models are drawn forward on top of it as before
+class GBuffer
+{
+public:
+	// texture units the lighting pass reads the G-buffer from
+	static const unsigned int ALBEDO_UNIT = 0;
+	static const unsigned int NORMAL_UNIT = 1;
+	static const unsigned int DEPTH_UNIT = 2;
+
+	// points the lighting shader at the G-buffer, the framebuffer itself is created at the first resize
+	void create(Shader &lighting)
+	{
+		this->lighting = &lighting;
+		lighting.use();
+		lighting.setInt("gAlbedo", ALBEDO_UNIT);
+		lighting.setInt("gNormal", NORMAL_UNIT);
+		lighting.setInt("gDepth", DEPTH_UNIT);
+		//the full screen triangle has no attributes, but a core context wants a vertex array bound
+		glGenVertexArrays(1, &emptyVAO);
+	}
+
+	// (re)creates the attachments when the window size changed
+	void resize(int width, int height)
+	{
+		if (width == this->width && height == this->height)
+			return;
+		releaseAttachments();
+		this->width = width;
+		this->height = height;
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		albedo = attachment(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0);
+		normal = attachment(GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_COLOR_ATTACHMENT1);
+		depth = attachment(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, GL_DEPTH_ATTACHMENT);
+		GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, buffers);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::GBUFFER::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// makes the G-buffer the target of the opaque models' draws, cleared
+	void beginGeometry()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		//blending would mix the normals with the clear value
+		glDisable(GL_BLEND);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// back to the default framebuffer
+	void endGeometry()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glEnable(GL_BLEND);
+	}
+
+	// lights the pixels the opaque models cover into the default framebuffer, the lighting shader's other uniforms
+	// (lights, clusters, tile size) are set by the caller
+	void light(const glm::mat4 &viewProjection)
+	{
+		lighting->use();
+		lighting->setMat4("inverseViewProjection", glm::inverse(viewProjection));
+		glActiveTexture(GL_TEXTURE0 + ALBEDO_UNIT);
+		glBindTexture(GL_TEXTURE_2D, albedo);
+		glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+		glBindTexture(GL_TEXTURE_2D, normal);
+		glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		glActiveTexture(GL_TEXTURE0);
+		//every covered pixel takes the G-buffer's depth, the skybox behind has none
+		glDepthFunc(GL_ALWAYS);
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glDepthFunc(GL_LESS);
+	}
+
+	// deletes the framebuffer and its attachments, must run while the context is still current
+	void release()
+	{
+		releaseAttachments();
+		if (emptyVAO)
+			glDeleteVertexArrays(1, &emptyVAO);
+		emptyVAO = 0;
+	}
+
+private:
+	Shader* lighting = nullptr;
+	GLuint framebuffer = 0, albedo = 0, normal = 0, depth = 0;
+	GLuint emptyVAO = 0;
+	int width = 0, height = 0;
+
+	GLuint attachment(GLint internalFormat, GLenum format, GLenum type, GLenum point)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, point, GL_TEXTURE_2D, texture, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+	void releaseAttachments()
+	{
+		if (!framebuffer)
+			return;
+		GLuint textures[3] = { albedo, normal, depth };
+		glDeleteTextures(3, textures);
+		glDeleteFramebuffers(1, &framebuffer);
+		framebuffer = albedo = normal = depth = 0;
+		width = height = 0;
+	}
+};
+#endif
@@ -0,0 +1,283 @@
+#ifndef GL_STATS_H
+#define GL_STATS_H
+
+#include "glew.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+// Kinds of GL calls counted by GlStats
+enum GlStatCategory {
+	GL_STAT_PROGRAM,
+	GL_STAT_TEXTURE,
+	GL_STAT_ACTIVE_TEXTURE,
+	GL_STAT_UNIFORM,
+	GL_STAT_UNIFORM_LOOKUP,
+	GL_STAT_VERTEX_ARRAY,
+	GL_STAT_BUFFER,
+	GL_STAT_DRAW,
+	GL_STAT_STATE,
+	GL_STAT_COUNT
+};
+
+// Calls of one frame, per category
+struct GlFrameStats
+{
+	unsigned int calls[GL_STAT_COUNT] = {};
+	// binds and state changes that set what was already set
+	unsigned int redundant[GL_STAT_COUNT] = {};
+	// indices submitted by the draw calls
+	unsigned long long indices = 0;
+};
+
+// Counts the GL calls of each frame by category and flags redundant binds.
+// Including this header after glew.h routes the instrumented entry points through the functions below,
+// which track the bound program, textures, vertex array and capabilities to tell a redundant call apart.
+// State changed behind their back (deleting a bound object) isn't seen. Define NO_GL_STATS to call GL directly
+class GlStats
+{
+public:
+	static GlStats &get()
+	{
+		static GlStats instance;
+		return instance;
+	}
+
+	GlFrameStats current;
+	// the frame before the current one, complete
+	GlFrameStats last;
+	unsigned long long frame = 0;
+
+	static const char* categoryName(int category)
+	{
+		static const char* names[GL_STAT_COUNT] = { "programs", "texture binds", "active texture", "uniforms", "uniform lookups",
+			"vertex array binds", "buffer binds", "draws", "state changes" };
+		return names[category];
+	}
+
+	void count(GlStatCategory category, bool redundant)
+	{
+		current.calls[category]++;
+		if (redundant)
+			current.redundant[category]++;
+	}
+
+	// closes the frame, writing it to the file if one is open
+	void endFrame()
+	{
+		if (csv.is_open()) {
+			csv << frame;
+			for (int i = 0; i < GL_STAT_COUNT; i++)
+				csv << ',' << current.calls[i] << ',' << current.redundant[i];
+			csv << ',' << current.indices << '\n';
+		}
+		last = current;
+		current = GlFrameStats();
+		frame++;
+	}
+
+	// the last complete frame, one line per category
+	void print() const
+	{
+		std::cout << "GL calls of frame " << (frame ? frame - 1 : 0) << ":" << std::endl;
+		for (int i = 0; i < GL_STAT_COUNT; i++) {
+			std::cout << "\t" << categoryName(i) << ": " << last.calls[i];
+			if (last.redundant[i])
+				std::cout << " (" << last.redundant[i] << " redundant)";
+			std::cout << std::endl;
+		}
+		std::cout << "\tindices drawn: " << last.indices << std::endl;
+	}
+
+	// writes every frame from now on, one line per frame
+	bool startCsv(const std::string &path)
+	{
+		csv.open(path);
+		if (!csv.is_open())
+			return false;
+		csv << "frame";
+		for (int i = 0; i < GL_STAT_COUNT; i++)
+			csv << ',' << categoryName(i) << ',' << categoryName(i) << " redundant";
+		csv << ",indices" << std::endl;
+		return true;
+	}
+	void stopCsv() { csv.close(); }
+	bool isWritingCsv() const { return csv.is_open(); }
+
+	/*  Tracked state, only touched by the wrappers  */
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLuint arrayBuffer = 0;
+	GLenum activeTexture = GL_TEXTURE0;
+	// textures bound to GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP of each unit
+	static const unsigned int TRACKED_UNITS = 32;
+	GLuint textures[TRACKED_UNITS][2] = {};
+	std::map<GLenum, bool> capabilities;
+	GLboolean depthMask = GL_TRUE;
+
+private:
+	GlStats() {}
+	std::ofstream csv;
+};
+
+/*  Wrappers, each counts the call then forwards it to GL  */
+inline void glStatsUseProgram(GLuint program)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_PROGRAM, stats.program == program);
+	stats.program = program;
+	glUseProgram(program);
+}
+
+inline void glStatsActiveTexture(GLenum texture)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_ACTIVE_TEXTURE, stats.activeTexture == texture);
+	stats.activeTexture = texture;
+	glActiveTexture(texture);
+}
+
+inline void glStatsBindTexture(GLenum target, GLuint texture)
+{
+	GlStats &stats = GlStats::get();
+	unsigned int unit = stats.activeTexture - GL_TEXTURE0;
+	int slot = target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_CUBE_MAP ? 1 : -1;
+	if (slot >= 0 && unit < GlStats::TRACKED_UNITS) {
+		stats.count(GL_STAT_TEXTURE, stats.textures[unit][slot] == texture);
+		stats.textures[unit][slot] = texture;
+	}
+	else
+		stats.count(GL_STAT_TEXTURE, false);
+	glBindTexture(target, texture);
+}
+
+inline void glStatsBindVertexArray(GLuint array)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_VERTEX_ARRAY, stats.vertexArray == array);
+	stats.vertexArray = array;
+	glBindVertexArray(array);
+}
+
+inline void glStatsBindBuffer(GLenum target, GLuint buffer)
+{
+	GlStats &stats = GlStats::get();
+	//the element array binding belongs to the bound vertex array, only the array buffer is tracked
+	bool redundant = target == GL_ARRAY_BUFFER && stats.arrayBuffer == buffer;
+	if (target == GL_ARRAY_BUFFER)
+		stats.arrayBuffer = buffer;
+	stats.count(GL_STAT_BUFFER, redundant);
+	glBindBuffer(target, buffer);
+}
+
+inline void glStatsBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	GlStats::get().count(GL_STAT_BUFFER, false);
+	glBindBufferRange(target, index, buffer, offset, size);
+}
+
+inline GLint glStatsGetUniformLocation(GLuint program, const GLchar* name)
+{
+	GlStats::get().count(GL_STAT_UNIFORM_LOOKUP, false);
+	return glGetUniformLocation(program, name);
+}
+
+inline void glStatsDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_DRAW, false);
+	stats.current.indices += count;
+	glDrawElements(mode, count, type, indices);
+}
+
+inline void glStatsDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_DRAW, false);
+	stats.current.indices += (unsigned long long)count * instances;
+	glDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+inline void glStatsDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_DRAW, false);
+	stats.current.indices += count;
+	glDrawArrays(mode, first, count);
+}
+
+inline void glStatsEnable(GLenum capability)
+{
+	GlStats &stats = GlStats::get();
+	std::map<GLenum, bool>::iterator found = stats.capabilities.find(capability);
+	stats.count(GL_STAT_STATE, found != stats.capabilities.end() && found->second);
+	stats.capabilities[capability] = true;
+	glEnable(capability);
+}
+
+inline void glStatsDisable(GLenum capability)
+{
+	GlStats &stats = GlStats::get();
+	std::map<GLenum, bool>::iterator found = stats.capabilities.find(capability);
+	stats.count(GL_STAT_STATE, found != stats.capabilities.end() && !found->second);
+	stats.capabilities[capability] = false;
+	glDisable(capability);
+}
+
+inline void glStatsDepthMask(GLboolean flag)
+{
+	GlStats &stats = GlStats::get();
+	stats.count(GL_STAT_STATE, stats.depthMask == flag);
+	stats.depthMask = flag;
+	glDepthMask(flag);
+}
+
+// every glUniform* is counted the same way, whatever its type
+#define GL_STATS_UNIFORM(call) (GlStats::get().count(GL_STAT_UNIFORM, false), call)
+
+#ifndef NO_GL_STATS
+#undef glUseProgram
+#undef glActiveTexture
+#undef glBindVertexArray
+#undef glBindBuffer
+#undef glBindBufferRange
+#undef glGetUniformLocation
+#undef glDrawElementsInstanced
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2f
+#undef glUniform2fv
+#undef glUniform3f
+#undef glUniform3fv
+#undef glUniform4f
+#undef glUniform4fv
+#undef glUniformMatrix2fv
+#undef glUniformMatrix3fv
+#undef glUniformMatrix4fv
+#define glUseProgram(program) glStatsUseProgram(program)
+#define glActiveTexture(texture) glStatsActiveTexture(texture)
+#define glBindTexture(target, texture) glStatsBindTexture(target, texture)
+#define glBindVertexArray(array) glStatsBindVertexArray(array)
+#define glBindBuffer(target, buffer) glStatsBindBuffer(target, buffer)
+#define glBindBufferRange(target, index, buffer, offset, size) glStatsBindBufferRange(target, index, buffer, offset, size)
+#define glGetUniformLocation(program, name) glStatsGetUniformLocation(program, name)
+#define glDrawElements(mode, count, type, indices) glStatsDrawElements(mode, count, type, indices)
+#define glDrawElementsInstanced(mode, count, type, indices, instances) glStatsDrawElementsInstanced(mode, count, type, indices, instances)
+#define glDrawArrays(mode, first, count) glStatsDrawArrays(mode, first, count)
+#define glEnable(capability) glStatsEnable(capability)
+#define glDisable(capability) glStatsDisable(capability)
+#define glDepthMask(flag) glStatsDepthMask(flag)
+#define glUniform1i(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform1i)(__VA_ARGS__))
+#define glUniform1f(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform1f)(__VA_ARGS__))
+#define glUniform2f(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform2f)(__VA_ARGS__))
+#define glUniform2fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform2fv)(__VA_ARGS__))
+#define glUniform3f(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform3f)(__VA_ARGS__))
+#define glUniform3fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform3fv)(__VA_ARGS__))
+#define glUniform4f(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform4f)(__VA_ARGS__))
+#define glUniform4fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniform4fv)(__VA_ARGS__))
+#define glUniformMatrix2fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniformMatrix2fv)(__VA_ARGS__))
+#define glUniformMatrix3fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniformMatrix3fv)(__VA_ARGS__))
+#define glUniformMatrix4fv(...) GL_STATS_UNIFORM(GLEW_GET_FUN(__glewUniformMatrix4fv)(__VA_ARGS__))
+#endif
+#endif
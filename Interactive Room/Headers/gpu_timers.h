@@ -0,0 +1,250 @@
+#ifndef GPU_TIMERS_H
+#define GPU_TIMERS_H
+
+#include "glew.h"
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Rolling GPU time of one named scope
+struct GpuTimerStat
+{
+	std::string name;
+	// nesting level the scope was first seen at, indents it in the overlay
+	unsigned int depth = 0;
+	// milliseconds of the last frames it was measured in
+	std::vector<float> samples;
+	unsigned int next = 0;
+	float sum = 0.0f;
+
+	float average() const { return samples.empty() ? 0.0f : sum / samples.size(); }
+};
+
+// Measures the GPU time of render passes and models with GL_TIMESTAMP queries.
+// Every frame records into its own query set of a ring; a set is read back FRAMES_IN_FLIGHT frames later
+// if the GPU is done with it and dropped otherwise, so the render thread never waits on a result
+class GpuTimers
+{
+public:
+	static const unsigned int FRAMES_IN_FLIGHT = 4;
+	// frames the rolling averages cover
+	static const unsigned int SAMPLES = 60;
+	// time each model's Draw on top of the passes
+	bool perModel = false;
+	// draw the averages as bars over the scene
+	bool overlay = false;
+
+	// reads back the oldest frame of the ring and starts recording a new one in its place
+	void beginFrame()
+	{
+		current = (current + 1) % FRAMES_IN_FLIGHT;
+		collect(frames[current]);
+		FrameQueries &frame = frames[current];
+		frame.number = frameCount++;
+		frame.used = 0;
+		frame.scopes.clear();
+		open.clear();
+		begin("frame");
+	}
+
+	// closes the frame scope, call before swapping buffers
+	void endFrame()
+	{
+		while (!open.empty())
+			end();
+	}
+
+	// starts a scope, scopes can nest. Only the first frame a name is seen allocates
+	void begin(const std::string &name)
+	{
+		FrameQueries &frame = frames[current];
+		Scope scope;
+		std::map<std::string, unsigned int>::iterator found = statIndex.find(name);
+		if (found == statIndex.end()) {
+			found = statIndex.insert(std::make_pair(name, (unsigned int)stats.size())).first;
+			GpuTimerStat stat;
+			stat.name = name;
+			stat.depth = open.size();
+			stat.samples.reserve(SAMPLES);
+			stats.push_back(stat);
+			frameMilliseconds.push_back(-1.0f);
+		}
+		scope.stat = found->second;
+		scope.first = timestamp(frame);
+		scope.last = scope.first;
+		open.push_back(frame.scopes.size());
+		frame.scopes.push_back(scope);
+	}
+
+	// ends the innermost open scope
+	void end()
+	{
+		if (open.empty())
+			return;
+		FrameQueries &frame = frames[current];
+		frame.scopes[open.back()].last = timestamp(frame);
+		open.pop_back();
+	}
+
+	// frames whose results weren't ready when their queries were reused
+	unsigned int getDropped() const { return dropped; }
+	const std::vector<GpuTimerStat> &getStats() const { return stats; }
+
+	// one line with the averages of the passes, for the window title
+	std::string summary() const
+	{
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(2);
+		for (unsigned int i = 0; i < stats.size(); i++) {
+			if (stats[i].depth > 1)
+				continue;
+			text << (i ? " | " : "") << stats[i].name << " " << stats[i].average() << " ms";
+		}
+		return text.str();
+	}
+
+	// writes every frame read back from now on, one line per scope: frame,scope,depth,milliseconds
+	bool startCsv(const std::string &path)
+	{
+		csv.open(path);
+		if (!csv.is_open())
+			return false;
+		csv << "frame,scope,depth,milliseconds" << std::endl;
+		return true;
+	}
+	void stopCsv() { csv.close(); }
+	bool isWritingCsv() const { return csv.is_open(); }
+
+	// one bar per scope from the top left corner, full width is half the window for 1/60 s
+	void drawOverlay(int width, int height)
+	{
+		static const float colors[][3] = {
+			{ 0.9f, 0.3f, 0.3f }, { 0.3f, 0.8f, 0.3f }, { 0.3f, 0.5f, 0.9f }, { 0.9f, 0.8f, 0.2f },
+			{ 0.8f, 0.4f, 0.9f }, { 0.2f, 0.8f, 0.8f }, { 0.9f, 0.6f, 0.3f }
+		};
+		const float budget = 1000.0f / 60.0f;
+		const int rowHeight = 6, gap = 2, indent = 8;
+		float full = width * 0.5f;
+
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		glEnable(GL_SCISSOR_TEST);
+		int y = height - gap;
+		//budget marker first, the bars go over it
+		int rows = stats.size();
+		glScissor(gap + (int)full, height - gap - rows * (rowHeight + gap), 1, rows * (rowHeight + gap));
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+		for (unsigned int i = 0; i < stats.size(); i++) {
+			y -= rowHeight + gap;
+			int x = gap + stats[i].depth * indent;
+			int length = (int)(full * stats[i].average() / budget);
+			if (length < 1)
+				length = 1;
+			const float* color = colors[i % (sizeof(colors) / sizeof(colors[0]))];
+			glScissor(x, y, length, rowHeight);
+			glClearColor(color[0], color[1], color[2], 1);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+	}
+
+	// deletes the queries, must run while the context is still current
+	void release()
+	{
+		for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+			if (!frames[i].queries.empty())
+				glDeleteQueries(frames[i].queries.size(), frames[i].queries.data());
+			frames[i].queries.clear();
+			frames[i].scopes.clear();
+		}
+		csv.close();
+	}
+
+private:
+	struct Scope
+	{
+		// index in stats
+		unsigned int stat;
+		// indices of the timestamps in the frame's queries
+		unsigned int first;
+		unsigned int last;
+	};
+	struct FrameQueries
+	{
+		unsigned long long number = 0;
+		// query objects are created as needed and reused by later frames
+		std::vector<GLuint> queries;
+		unsigned int used = 0;
+		std::vector<Scope> scopes;
+	};
+
+	FrameQueries frames[FRAMES_IN_FLIGHT];
+	unsigned int current = 0;
+	unsigned long long frameCount = 0;
+	unsigned int dropped = 0;
+	// scopes of the current frame not ended yet
+	std::vector<unsigned int> open;
+	std::vector<GpuTimerStat> stats;
+	std::map<std::string, unsigned int> statIndex;
+	std::ofstream csv;
+	// read back timestamps and the time of each stat in the frame being collected, -1 if it wasn't measured
+	std::vector<GLuint64> times;
+	std::vector<float> frameMilliseconds;
+
+	unsigned int timestamp(FrameQueries &frame)
+	{
+		if (frame.used == frame.queries.size()) {
+			GLuint query;
+			glGenQueries(1, &query);
+			frame.queries.push_back(query);
+		}
+		glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+		return frame.used++;
+	}
+
+	// adds a finished frame to the averages, or drops it if the GPU hasn't reached its last query
+	void collect(FrameQueries &frame)
+	{
+		if (frame.scopes.empty())
+			return;
+		//timestamps complete in order, the last one being ready means they all are
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			dropped++;
+			return;
+		}
+		times.resize(frame.used);
+		for (unsigned int i = 0; i < frame.used; i++)
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &times[i]);
+
+		//a scope can run several times a frame, its time is the sum
+		for (unsigned int i = 0; i < frame.scopes.size(); i++) {
+			const Scope &scope = frame.scopes[i];
+			float &milliseconds = frameMilliseconds[scope.stat];
+			milliseconds = (milliseconds < 0.0f ? 0.0f : milliseconds) + (times[scope.last] - times[scope.first]) / 1000000.0f;
+		}
+		for (unsigned int i = 0; i < stats.size(); i++) {
+			if (frameMilliseconds[i] < 0.0f)
+				continue;
+			GpuTimerStat &stat = stats[i];
+			if (stat.samples.size() < SAMPLES)
+				stat.samples.push_back(frameMilliseconds[i]);
+			else {
+				stat.sum -= stat.samples[stat.next];
+				stat.samples[stat.next] = frameMilliseconds[i];
+				stat.next = (stat.next + 1) % SAMPLES;
+			}
+			stat.sum += frameMilliseconds[i];
+			if (csv.is_open())
+				csv << frame.number << ',' << stat.name << ',' << stat.depth << ',' << frameMilliseconds[i] << '\n';
+			frameMilliseconds[i] = -1.0f;
+		}
+	}
+};
+#endif
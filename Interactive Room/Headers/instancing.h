@@ -0,0 +1,109 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "mesh.h"
+#include "shader.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <vector>
+
+// Collects the meshes drawn from shared buffers during a pass and draws each of them once, instanced.
+// The model and normal matrices of a pass are streamed into one buffer; the shader reads them from the instance
+// attributes while its "instanced" uniform is set. Storage is kept between frames, so a steady frame doesn't allocate
+class InstanceBatcher
+{
+public:
+	// the shader the batched meshes are drawn with, models drawn with another one aren't batched
+	Shader* shader = nullptr;
+
+	// queues a mesh with the model and normal matrices it would have been drawn with
+	void add(const Mesh &mesh, const glm::mat4 &model, const glm::vec4 (&normal)[3])
+	{
+		Instance instance;
+		instance.mesh = &mesh;
+		instance.data.model = model;
+		for (int i = 0; i < 3; i++)
+			instance.data.normal[i] = normal[i];
+		instances.push_back(instance);
+	}
+
+	bool empty() const { return instances.empty(); }
+
+	// draws the queued meshes, one instanced draw per geometry and textures
+	void flush()
+	{
+		if (instances.empty())
+			return;
+		PROFILE_ZONE("InstanceBatcher::flush");
+		//not stable_sort, which takes a temporary buffer from the heap
+		std::sort(instances.begin(), instances.end(), [](const Instance &a, const Instance &b) { return drawKey(*a.mesh) < drawKey(*b.mesh); });
+		data.resize(instances.size());
+		for (unsigned int i = 0; i < instances.size(); i++)
+			data[i] = instances[i].data;
+
+		if (!buffer)
+			glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		//orphans last pass's storage instead of waiting for the GPU to be done with it
+		if (data.size() > capacity)
+			capacity = data.size();
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, data.size() * sizeof(InstanceData), data.data());
+
+		shader->use();
+		shader->setBool("instanced", true);
+		unsigned int first = 0;
+		while (first < instances.size()) {
+			unsigned int last = first + 1;
+			while (last < instances.size() && sameDraw(*instances[first].mesh, *instances[last].mesh))
+				last++;
+			instances[first].mesh->DrawInstanced(*shader, buffer, first * sizeof(InstanceData), last - first);
+			first = last;
+		}
+		shader->setBool("instanced", false);
+		instances.clear();
+	}
+
+	// deletes the instance buffer, must run while the context is still current
+	void release()
+	{
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		capacity = 0;
+	}
+
+private:
+	struct Instance
+	{
+		const Mesh* mesh;
+		InstanceData data;
+	};
+	std::vector<Instance> instances;
+	std::vector<InstanceData> data;
+	GLuint buffer = 0;
+	// instances the buffer has room for
+	size_t capacity = 0;
+
+	// sorts the meshes sharing buffers and first texture next to each other
+	static unsigned long long drawKey(const Mesh &mesh)
+	{
+		return ((unsigned long long)mesh.VAO << 32) | (mesh.textures.empty() ? 0 : mesh.textures[0].id);
+	}
+
+	// same buffers and same textures, so one draw covers both
+	static bool sameDraw(const Mesh &a, const Mesh &b)
+	{
+		if (a.VAO != b.VAO || a.textures.size() != b.textures.size())
+			return false;
+		for (unsigned int i = 0; i < a.textures.size(); i++) {
+			if (a.textures[i].id != b.textures[i].id)
+				return false;
+		}
+		return true;
+	}
+};
+#endif
@@ -2,15 +2,21 @@
 #define MESH_H
 
 #include "glew.h"
+#include "gl_stats.h"
 #include "glm.hpp"
 #include "gtc/matrix_transform.hpp"
 #include <assimp/scene.h>
 #include "shader.h"
+#include "CollisionMesh.h"
+#include "Lightmapper.h"
+#include "Profiler.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -31,87 +37,321 @@ struct Texture {
 	unsigned int id;
 	string type;
 	aiString path;
+	// size of the image on the GPU, mipmaps included
+	size_t bytes = 0;
+};
+
+// Per-instance attributes of an instanced draw
+struct InstanceData {
+	glm::mat4 model;
+	// columns of the normal matrix, padded like ObjectRecord's
+	glm::vec4 normal[3];
+};
+
+// GL buffers of one geometry, shared by every mesh found identical to it up to a translation
+struct MeshBuffers {
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	// the positions alone, packed, with the same indices
+	unsigned int positionVAO = 0, positionVBO = 0;
+	// position of the first vertex of the uploaded geometry, the offset of a sharing mesh is measured from it
+	glm::vec3 anchor;
+	unsigned int vertexCount = 0, indexCount = 0;
+	// meshes drawing from these buffers, they are instanced once there is more than one
+	unsigned int users = 0;
 };
 
 class Mesh {
 public:
+	// buffers already uploaded, by geometry hash (see Model::geometryHash). Meshes whose hashes collide without being
+	// identical get an entry each. Only touched on the GL thread
+	static multimap<unsigned long long, MeshBuffers> sharedBuffers;
+	// vertex attributes 5 to 8 hold the model matrix of each instance in an instanced draw, 9 to 11 its normal matrix
+	static const unsigned int INSTANCE_ATTRIBUTE = 5;
+	static const unsigned int INSTANCE_NORMAL_ATTRIBUTE = 9;
+	// atlas coordinates of a baked mesh, and 1 to tell it from the others whose disabled attribute reads 0
+	static const unsigned int LIGHTMAP_ATTRIBUTE = 12;
+
 	/*  Mesh Data  */
-	vector<Vertex> vertices;
+	// the vertices and indices themselves are only on the GPU
+	unsigned int vertexCount;
+	unsigned int indexCount;
 	vector<glm::vec3> bounding_box;
-	vector<unsigned int> indices;
 	vector<Texture> textures;
 	unsigned int VAO;
+	// attribute 0 only, from a buffer of packed positions, for the shaders that read nothing else
+	unsigned int positionVAO;
+	// translation from the shared geometry to this mesh, in model space. Zero for the mesh that uploaded it
+	glm::vec3 offset;
+	//sampler uniform of each texture (texture_diffuse1, texture_specular1...), named once instead of every draw
+	vector<string> samplers;
+	//decimated copy of the mesh for triangle-accurate collision
+	CollisionMesh collision;
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<glm::vec3> bounding_box)
+	// constructor, takes over the buffers of the import and frees vertices and indices once they are uploaded.
+	// A mesh whose geometryHash was uploaded before draws from those buffers instead of uploading its own
+	Mesh(vector<Vertex> &&vertices, vector<unsigned int> &&indices, vector<Texture> &&textures, vector<glm::vec3> &&bounding_box,
+		unsigned long long geometryHash)
+		: vertexCount(vertices.size()), indexCount(indices.size()), bounding_box(std::move(bounding_box)), textures(std::move(textures))
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-		this->bounding_box = bounding_box;
-		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		nameSamplers();
+		glm::vec3 anchor = vertices.empty() ? glm::vec3(0) : vertices[0].Position;
+		//the hash only picks the candidates, the geometry itself must match to share its buffers
+		multimap<unsigned long long, MeshBuffers>::iterator found = sharedBuffers.end();
+		auto candidates = sharedBuffers.equal_range(geometryHash);
+		for (auto candidate = candidates.first; candidate != candidates.second; ++candidate) {
+			if (sameGeometry(candidate->second, vertices, indices)) {
+				found = candidate;
+				break;
+			}
+		}
+		if (found == sharedBuffers.end()) {
+			// now that we have all the required data, set the vertex buffers and its attribute pointers.
+			setupMesh(vertices, indices);
+			found = sharedBuffers.insert(make_pair(geometryHash, MeshBuffers()));
+			found->second.VAO = VAO;
+			found->second.VBO = VBO;
+			found->second.EBO = EBO;
+			found->second.positionVAO = positionVAO;
+			found->second.positionVBO = positionVBO;
+			found->second.anchor = anchor;
+			found->second.vertexCount = vertexCount;
+			found->second.indexCount = indexCount;
+			ownsBuffers = true;
+		}
+		else {
+			VAO = found->second.VAO;
+			VBO = found->second.VBO;
+			EBO = found->second.EBO;
+			positionVAO = found->second.positionVAO;
+			positionVBO = found->second.positionVBO;
+		}
+		buffers = &found->second;
+		buffers->users++;
+		offset = anchor - buffers->anchor;
+		vector<Vertex>().swap(vertices);
+		vector<unsigned int>().swap(indices);
 	}
 
+	// a mesh holds large buffers, it can be moved but never copied. See instance to draw the same mesh twice
+	Mesh(const Mesh &) = delete;
+	Mesh &operator=(const Mesh &) = delete;
+	Mesh(Mesh &&) = default;
+	Mesh &operator=(Mesh &&) = default;
+
+	// another mesh drawing from the same GL buffers and textures, for a copy of a model. Only the small CPU data is copied
+	Mesh instance() const
+	{
+		Mesh mesh;
+		mesh.vertexCount = vertexCount;
+		mesh.indexCount = indexCount;
+		mesh.bounding_box = bounding_box;
+		mesh.textures = textures;
+		mesh.VAO = VAO;
+		mesh.VBO = VBO;
+		mesh.EBO = EBO;
+		mesh.positionVAO = positionVAO;
+		mesh.positionVBO = positionVBO;
+		mesh.offset = offset;
+		mesh.samplers = samplers;
+		mesh.collision = collision;
+		mesh.buffers = buffers;
+		buffers->users++;
+		return mesh;
+	}
+
+	// uploads the baked lighting of the mesh as the texture_lightmap sampler, and its atlas coordinates. The mesh
+	// must have its own buffers, as the corners of its triangles each have their own coordinates
+	void attachLightmap(const Lightmap &lightmap)
+	{
+		vector<glm::vec3> coords(lightmap.coords.size());
+		for (unsigned int i = 0; i < coords.size(); i++)
+			coords[i] = glm::vec3(lightmap.coords[i], 1.0f);
+		glBindVertexArray(VAO);
+		glGenBuffers(1, &lightmapVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, lightmapVBO);
+		glBufferData(GL_ARRAY_BUFFER, coords.size() * sizeof(glm::vec3), &coords[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(LIGHTMAP_ATTRIBUTE);
+		glVertexAttribPointer(LIGHTMAP_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+		glBindVertexArray(0);
+
+		Texture texture;
+		glGenTextures(1, &texture.id);
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, lightmap.width, lightmap.height, 0, GL_RGBA, GL_FLOAT, &lightmap.texels[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture.type = "texture_lightmap";
+		textures.push_back(texture);
+		nameSamplers();
+		lightmapBytes = coords.size() * sizeof(glm::vec3) + (size_t)lightmap.width * lightmap.height * 4 * sizeof(unsigned short);
+	}
+
+	// whether other meshes draw from the same buffers, such meshes are batched into instanced draws
+	bool isShared() const { return buffers->users > 1; }
+
 	// render the mesh
-	void Draw(Shader shader)
+	void Draw(const Shader &shader)
 	{
+		PROFILE_ZONE("Mesh::Draw");
+		if (shader.positionsOnly) {
+			glBindVertexArray(positionVAO);
+			glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+			glBindVertexArray(0);
+			return;
+		}
 		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				ss << diffuseNr++; // transfer unsigned int to stream
-			else if (name == "texture_specular")
-				ss << specularNr++; // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				ss << normalNr++; // transfer unsigned int to stream
-			else if (name == "texture_height")
-				ss << heightNr++; // transfer unsigned int to stream
-			number = ss.str();
 			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+			glUniform1i(glGetUniformLocation(shader.ID, samplers[i].c_str()), i);
 			// and finally bind the texture
 			glBindTexture(GL_TEXTURE_2D, textures[i].id);
 		}
 
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
-	//Apply the model matrix to each of bounding box's matrices and return the result
-	vector<glm::vec3> getBoundingBox(glm::mat4 * model_matrix)
+	// draws count instances of the mesh, their InstanceData is read from instanceBuffer starting at byte first
+	void DrawInstanced(const Shader &shader, unsigned int instanceBuffer, size_t first, unsigned int count) const
 	{
-		vector<glm::vec3> result;
-		for (unsigned int i = 0; i < bounding_box.size(); i++)
+		PROFILE_ZONE("Mesh::DrawInstanced");
+		for (unsigned int i = 0; i < textures.size() && !shader.positionsOnly; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glUniform1i(glGetUniformLocation(shader.ID, samplers[i].c_str()), i);
+			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		}
+
+		glBindVertexArray(shader.positionsOnly ? positionVAO : VAO);
+		// a matrix attribute takes a location per column
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (unsigned int i = 0; i < 4; i++)
 		{
-			result.push_back(glm::vec3((*model_matrix) * glm::vec4(bounding_box[i], 1)));
+			glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + i);
+			glVertexAttribPointer(INSTANCE_ATTRIBUTE + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(first + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(INSTANCE_ATTRIBUTE + i, 1);
 		}
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			glEnableVertexAttribArray(INSTANCE_NORMAL_ATTRIBUTE + i);
+			glVertexAttribPointer(INSTANCE_NORMAL_ATTRIBUTE + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(first + offsetof(InstanceData, normal) + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(INSTANCE_NORMAL_ATTRIBUTE + i, 1);
+		}
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, count);
+		// plain draws of the same buffers must not read instance data
+		for (unsigned int i = 0; i < 4; i++)
+			glDisableVertexAttribArray(INSTANCE_ATTRIBUTE + i);
+		for (unsigned int i = 0; i < 3; i++)
+			glDisableVertexAttribArray(INSTANCE_NORMAL_ATTRIBUTE + i);
+		glBindVertexArray(0);
 
-		return result;
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// vertex and index buffers, counted by the mesh that uploaded them
+	size_t gpuBytes() const
+	{
+		return ownsBuffers ? vertexCount * (sizeof(Vertex) + sizeof(glm::vec3)) + indexCount * sizeof(unsigned int) + lightmapBytes : 0;
+	}
+
+	// what the mesh still holds in RAM: the collision mesh and the small per-mesh data.
+	// Textures are counted once by their model
+	size_t cpuBytes() const
+	{
+		size_t bytes = sizeof(Mesh) + collision.memoryBytes();
+		bytes += bounding_box.capacity() * sizeof(glm::vec3) + textures.capacity() * sizeof(Texture);
+		for (unsigned int i = 0; i < samplers.size(); i++)
+			bytes += samplers[i].capacity();
+		return bytes;
+	}
+
+	//Apply the model matrix to each of bounding box's matrices and append the result
+	void getBoundingBox(const glm::mat4 &model_matrix, vector<glm::vec3> &result) const
+	{
+		for (unsigned int i = 0; i < bounding_box.size(); i++)
+		{
+			result.push_back(glm::vec3(model_matrix * glm::vec4(bounding_box[i], 1)));
+		}
 	}
 
 private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	unsigned int VBO, EBO, positionVBO;
+	unsigned int lightmapVBO = 0;
+	// atlas coordinates and texture of the baked lighting, if any
+	size_t lightmapBytes = 0;
+	MeshBuffers* buffers = nullptr;
+	bool ownsBuffers = false;
+
+	Mesh() {}
 
 	/*  Functions    */
+	// names the sampler of each texture after its type and its number among textures of that type (the N in texture_diffuseN)
+	void nameSamplers()
+	{
+		unsigned int diffuseNr = 1;
+		unsigned int specularNr = 1;
+		unsigned int normalNr = 1;
+		unsigned int heightNr = 1;
+		samplers.clear();
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			stringstream ss;
+			string name = textures[i].type;
+			if (name == "texture_diffuse")
+				ss << diffuseNr++; // transfer unsigned int to stream
+			else if (name == "texture_specular")
+				ss << specularNr++; // transfer unsigned int to stream
+			else if (name == "texture_normal")
+				ss << normalNr++; // transfer unsigned int to stream
+			else if (name == "texture_height")
+				ss << heightNr++; // transfer unsigned int to stream
+			samplers.push_back(name + ss.str());
+		}
+	}
+
+	// whether vertices and indices are the geometry uploaded in buffers up to a translation, with the tolerances of
+	// Model::geometryHash. The uploaded geometry is only on the GPU, it is read back, once per candidate at load
+	static bool sameGeometry(const MeshBuffers &buffers, const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		if (vertices.empty() || buffers.vertexCount != vertices.size() || buffers.indexCount != indices.size())
+			return false;
+		PROFILE_ZONE("Mesh::sameGeometry");
+		vector<unsigned int> uploadedIndices(indices.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, buffers.EBO);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(unsigned int), &uploadedIndices[0]);
+		if (uploadedIndices != indices) {
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			return false;
+		}
+		vector<Vertex> uploaded(vertices.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, buffers.VBO);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertices.size() * sizeof(Vertex), &uploaded[0]);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		for (unsigned int i = 0; i < vertices.size(); i++) {
+			glm::vec3 position = vertices[i].Position - vertices[0].Position;
+			glm::vec3 uploadedPosition = uploaded[i].Position - buffers.anchor;
+			if (glm::any(glm::greaterThan(glm::abs(position - uploadedPosition), glm::vec3(1.0f / 1024.0f))) ||
+				glm::any(glm::greaterThan(glm::abs(vertices[i].Normal - uploaded[i].Normal), glm::vec3(1.0f / 1024.0f))) ||
+				glm::any(glm::greaterThan(glm::abs(vertices[i].TexCoords - uploaded[i].TexCoords), glm::vec2(1.0f / 4096.0f))))
+				return false;
+		}
+		return true;
+	}
+
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
 	{
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
@@ -144,6 +384,19 @@ private:
 		glEnableVertexAttribArray(4);
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
+		// the position stream: 12 bytes a vertex instead of 56, for the depth and selection passes
+		vector<glm::vec3> packed(vertices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++)
+			packed[i] = vertices[i].Position;
+		glGenVertexArrays(1, &positionVAO);
+		glGenBuffers(1, &positionVBO);
+		glBindVertexArray(positionVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(glm::vec3), &packed[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
 		glBindVertexArray(0);
 	}
 };
@@ -2,6 +2,7 @@
 #define MODEL_H
 
 #include <glew.h>
+#include "gl_stats.h"
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <SOIL.h>
@@ -9,6 +10,8 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "mesh.h"
+#include "instancing.h"
+#include "object_transforms.h"
 #include "camera.h"
 #include <string>
 #include <fstream>
@@ -17,6 +20,11 @@
 #include <map>
 #include <vector>
 #include "CollisionManager.h"
+#include "SceneCollision.h"
+#include "JobSystem.h"
+#include "Lightmapper.h"
+#include "Memory.h"
+#include "Profiler.h"
 
 
 using namespace glm;
@@ -41,7 +49,39 @@ enum Rotate {
 	ROTATE_UP_RIGHT
 };
 
-class Model
+// CPU side of a mesh, filled by the import jobs
+struct MeshData {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<vec3> bounding_box;
+	vec3 low, high;
+	// indices in ImportedModel::textures
+	vector<unsigned int> textures;
+	CollisionMesh collision;
+	// see Model::geometryHash
+	unsigned long long geometryHash = 0;
+	// baked lighting, see Model::bakeLightmaps
+	Lightmap lightmap;
+};
+
+// image of a material texture, decoded by the import jobs
+struct TextureData {
+	string type;
+	aiString path;
+	unsigned char* pixels = nullptr;
+	int width = 0, height = 0, components = 0;
+};
+
+// a model imported off the GL thread, waiting for its GL objects to be created
+struct ImportedModel {
+	JobCounter done;
+	string error;
+	string directory;
+	vector<MeshData> meshes;
+	vector<TextureData> textures;
+};
+
+class Model : public CollisionMover, public CollisionGeometry
 {
 public:
 	/*  Model Data */
@@ -56,36 +96,200 @@ public:
 	const float step = 5.f;
 	//angle of rotation
 	const float angle = 1.5f;
+	//size of the grid collision meshes are simplified on, in model units
+	static constexpr float collisionCellSize = 5.f;
 	//stores all models to make shader switching easier
 	static vector<Model*> models;
+	//models being imported by the job system, see preload
+	static map<string, ImportedModel*> imports;
+	//textures uploaded so far by file, models using the same image share it
+	static map<string, Texture> textureCache;
+	//the selection pass writes the ID in one byte
+	static const unsigned int MAX_MODELS = 255;
+	//model and normal matrix of each model for the shaders, at index ID - 1
+	static ObjectTransforms transforms;
 	int ID;
+	//layer, mask and exclusions used when this model asks to move
+	CollisionFilter collisionFilter;
+	//drawn in the weighted blended pass, after the opaque models
+	bool transparent = false;
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
 	Model(string const &path, bool gamma = false, float scale = 0.02f) : gammaCorrection(gamma)
 	{
 		this->scale = scale;
+		this->path = path;
 		model_matrix = glm::scale(mat4(1), vec3(scale));
+		render_matrix = model_matrix;
 		loadModel(path);
 		objectElipse = scale * 0.5f * vec3(abs(xmax - xmin), abs(ymax - ymin), abs(zmax - zmin));
 		displacementFromOrigin = vec4(scale * 0.5f * vec3(xmax + xmin, ymax + ymin, zmax + zmin), 0);
+		//By default a moved model collides with the furniture and the static models but never with itself. The house
+		//shell around it lets the furniture through, see SceneCollision.h
+		collisionFilter.layer = LAYER_FURNITURE;
+		collisionFilter.mask = MOVED_MODEL_MASK;
+		track();
+	}
+
+	// another instance of a loaded model, moved by offset in world space. It draws from the GL buffers and textures
+	// of source, so no file is read and nothing touches OpenGL. It isn't part of the scene until track is called
+	Model(const Model &source, const vec3 &offset) : textures_loaded(source.textures_loaded), scale(source.scale), directory(source.directory),
+		gammaCorrection(source.gammaCorrection), objectElipse(source.objectElipse), ID(0)
+	{
+		//textures and buffers are counted by the model that uploaded them
+		for (unsigned int i = 0; i < textures_loaded.size(); i++)
+			textures_loaded[i].bytes = 0;
+		meshes.reserve(source.meshes.size());
+		for (unsigned int i = 0; i < source.meshes.size(); i++)
+			meshes.push_back(source.meshes[i].instance());
+		collisionFilter.layer = source.collisionFilter.layer;
+		collisionFilter.mask = source.collisionFilter.mask;
+		model_matrix = translate(mat4(1), offset) * source.model_matrix;
+		render_matrix = model_matrix;
+		path = source.path;
+		displacementFromOrigin = source.displacementFromOrigin + vec4(offset, 0);
+		xmin = source.xmin; ymin = source.ymin; zmin = source.zmin;
+		xmax = source.xmax; ymax = source.ymax; zmax = source.zmax;
+		shade = source.shade;
+		transparent = source.transparent;
+		cam = source.cam;
+	}
+
+	// adds the model to models and to the collision manager. Both belong to the simulation thread once it runs,
+	// a model spawned then must be tracked from there (see Simulation::post)
+	void track() {
 		models.push_back(this);
 		ID = models.size();
-		//Once a model is created, track it with the collision manager
-		CollisionManager::getInstance()->trackModel(this);
+		collisionFilter.exclude.push_back(this);
+		CollisionManager::getInstance()->trackModel(this, collisionFilter.layer);
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw()
+	// starts importing models on the job system, so the constructors only have to create their GL objects.
+	// Must be called on the thread that constructs the models
+	static void preload(const vector<string> &paths) {
+		for (unsigned int i = 0; i < paths.size(); i++) {
+			if (imports.count(paths[i]))
+				continue;
+			ImportedModel* imported = new ImportedModel;
+			imports[paths[i]] = imported;
+			string path = paths[i];
+			JobSystem::getInstance()->submit([path, imported] { import(path, imported); }, &imported->done);
+		}
+	}
+
+	// bakes the lights into lightmaps for the models of paths, which must be preloaded and never move: each shadows
+	// the others and itself. scale is the one the models will be constructed with. Their meshes are unwelded into
+	// triangle soups, so every triangle has corners of its own in the atlas, and never share their buffers
+	static void bakeLightmaps(const vector<string> &paths, const vector<PointLight> &lights, float scale) {
+		PROFILE_ZONE("Model::bakeLightmaps");
+		MemoryScope tag(MEMORY_LOADING);
+		static unsigned long long baked = 0;
+		vector<MeshData*> meshes;
+		Lightmapper lightmapper;
+		for (unsigned int i = 0; i < paths.size(); i++) {
+			map<string, ImportedModel*>::iterator found = imports.find(paths[i]);
+			if (found == imports.end())
+				continue;
+			ImportedModel* imported = found->second;
+			JobSystem::getInstance()->wait(imported->done);
+			if (!imported->error.empty())
+				continue;
+			for (unsigned int j = 0; j < imported->meshes.size(); j++) {
+				MeshData &data = imported->meshes[j];
+				vector<Vertex> soup(data.indices.size());
+				vector<vec3> corners(data.indices.size());
+				for (unsigned int k = 0; k < data.indices.size(); k++) {
+					soup[k] = data.vertices[data.indices[k]];
+					data.indices[k] = k;
+					corners[k] = soup[k].Position * scale;
+				}
+				data.vertices = std::move(soup);
+				data.geometryHash = (1ULL << 63) | baked++;
+				lightmapper.addOccluders(corners);
+				meshes.push_back(&data);
+			}
+		}
+		lightmapper.build();
+
+		size_t texels = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			MeshData &data = *meshes[i];
+			vector<vec3> corners(data.vertices.size()), normals(data.vertices.size());
+			for (unsigned int k = 0; k < data.vertices.size(); k++) {
+				corners[k] = data.vertices[k].Position * scale;
+				normals[k] = normalize(data.vertices[k].Normal);
+			}
+			lightmapper.bake(corners, normals, lights, data.lightmap);
+			texels += (size_t)data.lightmap.width * data.lightmap.height;
+		}
+		cout << "lightmaps baked: " << meshes.size() << " meshes, " << lightmapper.occluderCount() << " occluders, "
+			<< texels / 1024 << "K texels" << endl;
+	}
+
+	// sets the collision layer of the model, both as an obstacle and as a mover
+	void setCollisionLayer(unsigned int layer) {
+		collisionFilter.layer = layer;
+		CollisionManager::getInstance()->setLayer(this, layer);
+	}
+
+	// sets which movers (camera, furniture...) are blocked by this model
+	void setCollisionBlocks(unsigned int blocks) {
+		CollisionManager::getInstance()->setBlocks(this, blocks);
+	}
+
+	// draws the model, and thus all its meshes. with replaces the model's own shader. The render passes replay the
+	// model's retained commands instead, see DrawCache
+	void Draw(Shader* with = nullptr)
 	{
-		(*shade).use();
-		(*shade).setInt("id", ID);
-		(*shade).setMat4("model", model_matrix);
+		Shader &shader = with ? *with : *shade;
+		shader.use();
+		shader.setInt("id", ID);
+		transforms.bind(ID - 1);
 		for (unsigned int i = 0; i < meshes.size(); i++) {
-			meshes[i].Draw(*shade);
+			drawMesh(meshes[i], shader);
 		}
 	}
 
+	unsigned int meshCount() const {
+		return meshes.size();
+	}
+
+	// model matrix of a mesh, its buffers may hold the geometry of an identical mesh somewhere else
+	mat4 meshMatrix(const Mesh &mesh) const
+	{
+		return mesh.offset == vec3(0) ? render_matrix : render_matrix * translate(mat4(1), mesh.offset);
+	}
+
+	// writes the meshes whose bounding box isn't entirely outside one of the frustum planes to visible, which must have
+	// room for meshCount() indices, and returns how many there are.
+	// Doesn't touch OpenGL, so the draw list can be built on the job system
+	unsigned int cull(const mat4 &viewProjection, unsigned int* visible) const
+	{
+		PROFILE_ZONE("Model::cull");
+		unsigned int count = 0;
+		mat4 mvp = viewProjection * render_matrix;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			//corners outside each of the 6 clip planes
+			int outside[6] = { 0, 0, 0, 0, 0, 0 };
+			for (unsigned int j = 0; j < meshes[i].bounding_box.size(); j++) {
+				vec4 clip = mvp * vec4(meshes[i].bounding_box[j], 1);
+				outside[0] += clip.x < -clip.w;
+				outside[1] += clip.x > clip.w;
+				outside[2] += clip.y < -clip.w;
+				outside[3] += clip.y > clip.w;
+				outside[4] += clip.z < -clip.w;
+				outside[5] += clip.z > clip.w;
+			}
+			bool culled = false;
+			for (int plane = 0; plane < 6; plane++)
+				culled = culled || outside[plane] == (int)meshes[i].bounding_box.size();
+			if (!culled)
+				visible[count++] = i;
+		}
+		return count;
+	}
+
 	// returns the original displacement of a model object in respect to the origin
 	vec3 displacement() {
 		return vec3(displacementFromOrigin);
@@ -117,10 +321,23 @@ public:
 			break;
 		}
 		vec3 requestedMove = scale * step * directionVector;
-		vec3 moveVector = CollisionManager::getInstance()->askMove(objectElipse, scale * step * directionVector, vec3(displacementFromOrigin));
 		if (direction == SHIFT_UP || direction == SHIFT_DOWN)
 		{
-			moveVector.y = requestedMove.y;
+			verticalShift = true;
+			requestedVertical += requestedMove.y;
+		}
+		//Resolved with the other moves of this frame by CollisionManager::resolveMoves
+		CollisionManager::getInstance()->queueMove(this, objectElipse, requestedMove, vec3(displacementFromOrigin), &collisionFilter);
+	}
+
+	// applies the shift left after collision
+	void moveResolved(vec3 moveVector) {
+		//vertical shifts aren't blocked by collisions
+		if (verticalShift)
+		{
+			moveVector.y = requestedVertical;
+			verticalShift = false;
+			requestedVertical = 0.0f;
 		}
 		displacementFromOrigin += vec4(moveVector, 0);
 		moveVector = moveVector / scale;
@@ -166,99 +383,333 @@ public:
 		shade = shader;
 	}
 
+	//the shader the object is drawn with, the selection shader while it is selected
+	Shader* getShader() const {
+		return shade;
+	}
+
 	//sets the Camera that will be used for relative transformations
 	void setCamera(Camera* camera) {
 		cam = camera;
 	}
 
-	//Apply the model matrix to each of bounding box's matrices and return the result
-	vector<vector<vec3>> getBoundingBoxes()
+	//world space box around the meshes' bounding boxes, as the model is drawn
+	void getRenderBounds(vec3 &low, vec3 &high) const
+	{
+		low = vec3(1e30f);
+		high = vec3(-1e30f);
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			for (unsigned int j = 0; j < meshes[i].bounding_box.size(); j++) {
+				vec3 corner = vec3(render_matrix * vec4(meshes[i].bounding_box[j], 1));
+				low = min(low, corner);
+				high = max(high, corner);
+			}
+		}
+	}
+
+	//Apply the model matrix to each of bounding box's matrices, 8 corners per mesh
+	void getBoundingBoxes(vector<vec3> &corners)
 	{
-		vector<vector<vec3>> bound;
+		corners.clear();
 		for (unsigned int i = 0; i < meshes.size(); i++) {
-			bound.push_back(meshes[i].getBoundingBox(&model_matrix));
+			meshes[i].getBoundingBox(model_matrix, corners);
 		}
-		return bound;
+	}
+
+	//sets the matrix the model is drawn with, interpolated by the render thread between simulation ticks
+	//and writes it to the model's record in transforms when it changed, most models stand still.
+	//Returns whether it changed (or was never set)
+	bool setRenderMatrix(const mat4 &matrix) {
+		if (matrix == render_matrix && recordWritten)
+			return false;
+		render_matrix = matrix;
+		transforms.set(ID - 1, render_matrix);
+		recordWritten = true;
+		return true;
+	}
+
+	//model matrix, used by the collision manager to place the collision meshes
+	mat4 getModelMatrix() const {
+		return model_matrix;
+	}
+
+	//fills result with the collision mesh of each mesh that has one
+	void getCollisionMeshes(vector<const CollisionMesh*> &result) const {
+		result.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!meshes[i].collision.empty())
+				result.push_back(&meshes[i].collision);
+		}
+	}
+
+	//the file path identifies the model in collision traces
+	string getCollisionName() const {
+		return path;
+	}
+
+	//the file path the model was loaded from, without copying it
+	const string &getPath() const {
+		return path;
+	}
+
+	//RAM held by the meshes and textures of the model
+	size_t cpuBytes() const {
+		size_t bytes = sizeof(Model) + meshes.capacity() * sizeof(Mesh) + textures_loaded.capacity() * sizeof(Texture);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].cpuBytes() - sizeof(Mesh);
+		return bytes;
+	}
+
+	//GPU memory of the vertex, index and texture data of the model
+	size_t gpuBytes() const {
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bytes += meshes[i].gpuBytes();
+		for (unsigned int i = 0; i < textures_loaded.size(); i++)
+			bytes += textures_loaded[i].bytes;
+		return bytes;
+	}
+
+	//prints the CPU and GPU memory of every model, and writes the same per mesh and texture to csvPath if it isn't empty
+	static void printMemoryReport(const string &csvPath) {
+		ofstream csv;
+		if (!csvPath.empty()) {
+			csv.open(csvPath);
+			if (csv.is_open())
+				csv << "model,kind,index,name,cpu bytes,gpu bytes" << endl;
+		}
+		size_t cpuTotal = 0, gpuTotal = 0;
+		cout << "Memory by model (CPU / GPU):" << endl;
+		for (unsigned int i = 0; i < models.size(); i++) {
+			const Model &model = *models[i];
+			cout << "	" << model.path << ":	" << model.cpuBytes() / 1024 << " KB / " << model.gpuBytes() / 1024 << " KB, "
+				<< model.meshes.size() << " meshes, " << model.textures_loaded.size() << " textures" << endl;
+			cpuTotal += model.cpuBytes();
+			gpuTotal += model.gpuBytes();
+			if (!csv.is_open())
+				continue;
+			for (unsigned int j = 0; j < model.meshes.size(); j++)
+				csv << model.path << ",mesh," << j << ",," << model.meshes[j].cpuBytes() << ',' << model.meshes[j].gpuBytes() << '\n';
+			for (unsigned int j = 0; j < model.textures_loaded.size(); j++)
+				csv << model.path << ",texture," << j << ',' << model.textures_loaded[j].path.C_Str() << ",0," << model.textures_loaded[j].bytes << '\n';
+		}
+		cout << "	total:	" << cpuTotal / (1024 * 1024) << " MB / " << gpuTotal / (1024 * 1024) << " MB" << endl;
+		if (csv.is_open())
+			cout << "Memory per mesh and texture written to " << csvPath << endl;
 	}
 
 
 private:
 	//model matrix used to rotate and shift Model object
 	mat4 model_matrix;
+	//model matrix used to draw the object, owned by the render thread
+	mat4 render_matrix;
+	//whether transforms holds render_matrix yet
+	bool recordWritten = false;
+	//file the model was loaded from
+	string path;
 	//used to get the location of the center of an object in order to rotate it
 	vec4 displacementFromOrigin;
-	float xmin, ymin, zmin, xmax, ymax, zmax, xmeshmin, ymeshmin, zmeshmin, xmeshmax, ymeshmax, zmeshmax;
-	//for first time setup of xmin ,ymin, zmin, xmax, ymax, and zmax
-	bool first = true;
+	float xmin, ymin, zmin, xmax, ymax, zmax;
+	//vertical part of the shifts queued this frame
+	bool verticalShift = false;
+	float requestedVertical = 0.0f;
 	//makes drawing objects and switching shaders more seamless
 	Shader* shade;
 	//Camera holder to shift and rotate according to camera
 	Camera* cam;
 
 	/*  Functions   */
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+
+	void drawMesh(Mesh &mesh, Shader &shader)
+	{
+		if (mesh.offset == vec3(0)) {
+			mesh.Draw(shader);
+			return;
+		}
+		shader.setVec3("meshOffset", mesh.offset);
+		mesh.Draw(shader);
+		shader.setVec3("meshOffset", vec3(0));
+	}
+
+	// loads a model imported by preload, or imports it now, then creates its GL objects on this thread.
 	void loadModel(string const &path)
 	{
-		// read file via ASSIMP
+		ImportedModel* imported;
+		map<string, ImportedModel*>::iterator found = imports.find(path);
+		if (found != imports.end())
+		{
+			imported = found->second;
+			imports.erase(found);
+			// help with the remaining import jobs until this one is done
+			JobSystem::getInstance()->wait(imported->done);
+		}
+		else
+		{
+			imported = new ImportedModel;
+			import(path, imported);
+		}
+		finishImport(*imported);
+		delete imported;
+	}
+
+	// reads the file via ASSIMP and fills imported. Meshes are processed and textures decoded in parallel;
+	// nothing here touches OpenGL so it can run on any thread
+	static void import(string const &path, ImportedModel* imported)
+	{
+		PROFILE_ZONE("Model::import");
+		MemoryScope tag(MEMORY_LOADING);
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		const aiScene* scene;
+		{
+			PROFILE_ZONE("Assimp ReadFile");
+			scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		}
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			imported->error = importer.GetErrorString();
 			return;
 		}
 		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
+		imported->directory = path.substr(0, path.find_last_of('/'));
+
+		// meshes in the order of the node hierarchy
+		vector<aiMesh*> sceneMeshes;
+		processNode(scene->mRootNode, scene, sceneMeshes);
+		// one arena holds the temporary buffers of every mesh, sized up front from the vertex and face counts
+		size_t scratchBytes = 0;
+		for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+			scratchBytes += meshScratchBytes(sceneMeshes[i]);
+		LinearArena scratch(scratchBytes);
+		imported->meshes.resize(sceneMeshes.size());
+		for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+			processMaterial(sceneMeshes[i], scene, *imported, imported->meshes[i]);
+
+		JobSystem* jobs = JobSystem::getInstance();
+		jobs->parallelFor(0, sceneMeshes.size(), 1, [&](unsigned int first, unsigned int last) {
+			for (unsigned int i = first; i < last; i++)
+				processMesh(sceneMeshes[i], imported->meshes[i], scratch);
+		});
+		jobs->parallelFor(0, imported->textures.size(), 1, [&](unsigned int first, unsigned int last) {
+			for (unsigned int i = first; i < last; i++)
+			{
+				PROFILE_ZONE("decode texture");
+				TextureData &texture = imported->textures[i];
+				string filename = imported->directory + '/' + string(texture.path.C_Str());
+				texture.pixels = SOIL_load_image(filename.c_str(), &texture.width, &texture.height, &texture.components, SOIL_LOAD_AUTO);
+			}
+		});
+	}
+
+	// uploads the textures and meshes of an imported model, on the GL thread
+	void finishImport(ImportedModel &imported)
+	{
+		PROFILE_ZONE("Model::upload");
+		MemoryScope tag(MEMORY_LOADING);
+		if (!imported.error.empty())
+		{
+			cout << "ERROR::ASSIMP:: " << imported.error << endl;
+			return;
+		}
+		directory = imported.directory;
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		textures_loaded.reserve(textures_loaded.size() + imported.textures.size());
+		for (unsigned int i = 0; i < imported.textures.size(); i++)
+		{
+			//an image another model uploaded already is only referenced
+			string file = imported.directory + '/' + string(imported.textures[i].path.C_Str());
+			map<string, Texture>::iterator cached = textureCache.find(file);
+			if (cached != textureCache.end() && imported.textures[i].pixels)
+			{
+				Texture texture = cached->second;
+				texture.type = std::move(imported.textures[i].type);
+				texture.bytes = 0;
+				SOIL_free_image_data(imported.textures[i].pixels);
+				imported.textures[i].pixels = nullptr;
+				textures_loaded.push_back(std::move(texture));
+				continue;
+			}
+			Texture texture;
+			//GL keeps a mip chain, a third more than the image
+			if (imported.textures[i].pixels)
+				texture.bytes = (size_t)imported.textures[i].width * imported.textures[i].height * imported.textures[i].components * 4 / 3;
+			texture.id = TextureFromData(imported.textures[i]);
+			texture.type = std::move(imported.textures[i].type);
+			texture.path = imported.textures[i].path;
+			if (texture.bytes)
+				textureCache[file] = texture;
+			textures_loaded.push_back(std::move(texture));
+		}
+
+		meshes.reserve(meshes.size() + imported.meshes.size());
+		for (unsigned int i = 0; i < imported.meshes.size(); i++)
+		{
+			MeshData &data = imported.meshes[i];
+			if (i == 0) {
+				xmin = data.low.x; ymin = data.low.y; zmin = data.low.z;
+				xmax = data.high.x; ymax = data.high.y; zmax = data.high.z;
+			}
+			xmin = glm::min(xmin, data.low.x);
+			ymin = glm::min(ymin, data.low.y);
+			zmin = glm::min(zmin, data.low.z);
+			xmax = glm::max(xmax, data.high.x);
+			ymax = glm::max(ymax, data.high.y);
+			zmax = glm::max(zmax, data.high.z);
+
+			vector<Texture> textures;
+			textures.reserve(data.textures.size());
+			for (unsigned int j = 0; j < data.textures.size(); j++)
+				textures.push_back(textures_loaded[data.textures[j]]);
+			// create the mesh object from the extracted mesh data, with its simplified collision mesh. Nothing is copied
+			meshes.emplace_back(std::move(data.vertices), std::move(data.indices), std::move(textures), std::move(data.bounding_box), data.geometryHash);
+			meshes.back().collision = std::move(data.collision);
+			if (!data.lightmap.empty())
+				meshes.back().attachLightmap(data.lightmap);
+		}
 	}
 
-	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	// collects the meshes of a node and its children, recursively.
+	static void processNode(aiNode *node, const aiScene *scene, vector<aiMesh*> &result)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
 			// the node object only contains indices to index the actual objects in the scene.
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			result.push_back(scene->mMeshes[node->mMeshes[i]]);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, result);
 		}
 	}
 
-	// processes mesh
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// bytes of scratch processMesh takes for a mesh: its positions and the collision mesh build
+	static size_t meshScratchBytes(const aiMesh *mesh)
+	{
+		return mesh->mNumVertices * sizeof(vec3) + 16 + CollisionMesh::scratchBytes(mesh->mNumVertices, mesh->mNumFaces * 3);
+	}
+
+	// processes mesh, its temporary buffers are taken from scratch
+	static void processMesh(aiMesh *mesh, MeshData &data, LinearArena &scratch)
 	{
+		PROFILE_ZONE("processMesh");
 		//meshmin
-		xmeshmin = mesh->mVertices[0].x;
-		ymeshmin = mesh->mVertices[0].y;
-		zmeshmin = mesh->mVertices[0].z;
+		float xmeshmin = mesh->mVertices[0].x;
+		float ymeshmin = mesh->mVertices[0].y;
+		float zmeshmin = mesh->mVertices[0].z;
 		//meshmax
-		xmeshmax = mesh->mVertices[0].x;
-		ymeshmax = mesh->mVertices[0].y;
-		zmeshmax = mesh->mVertices[0].z;
-		if (first) {
-			//min
-			xmin = mesh->mVertices[0].x;
-			ymin = mesh->mVertices[0].y;
-			zmin = mesh->mVertices[0].z;
-			//max
-			xmax = mesh->mVertices[0].x;
-			ymax = mesh->mVertices[0].y;
-			zmax = mesh->mVertices[0].z;
-			first = false;
-		}
+		float xmeshmax = mesh->mVertices[0].x;
+		float ymeshmax = mesh->mVertices[0].y;
+		float zmeshmax = mesh->mVertices[0].z;
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		vector<Vertex> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vertices.reserve(mesh->mNumVertices);
+		// faces are triangulated on import
+		indices.reserve(mesh->mNumFaces * 3);
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -269,32 +720,20 @@ private:
 			if (mesh->mVertices) {
 				// positions
 				vector.x = mesh->mVertices[i].x;
-				if (vector.x < xmin)
-					xmin = vector.x;
 				if (vector.x < xmeshmin)
 					xmeshmin = vector.x;
-				if (vector.x > xmax)
-					xmax = vector.x;
 				if (vector.x > xmeshmax)
 					xmeshmax = vector.x;
 
 				vector.y = mesh->mVertices[i].y;
-				if (vector.y < ymin)
-					ymin = vector.y;
 				if (vector.y < ymeshmin)
 					ymeshmin = vector.y;
-				if (vector.y > ymax)
-					ymax = vector.y;
 				if (vector.y > ymeshmax)
 					ymeshmax = vector.y;
 
 				vector.z = mesh->mVertices[i].z;
-				if (vector.z < zmin)
-					zmin = vector.z;
 				if (vector.z < zmeshmin)
 					zmeshmin = vector.z;
-				if (vector.z > zmax)
-					zmax = vector.z;
 				if (vector.z > zmeshmax)
 					zmeshmax = vector.z;
 
@@ -338,7 +777,7 @@ private:
 
 		// Using min and max values of x,y,z create a bounding box
 		// And apply the current model matrix to it
-		vector<vec3> bounding_box = {
+		data.bounding_box = {
 			vec3(xmeshmin, ymeshmin, zmeshmin), //Vertex 0: Front, bottom, left corner
 			vec3(xmeshmin, ymeshmax, zmeshmin), //Vertex 1: Front, top, left corner
 			vec3(xmeshmax, ymeshmax, zmeshmin), //Vertex 2: Front, top, right corner
@@ -348,16 +787,60 @@ private:
 			vec3(xmeshmax, ymeshmax, zmeshmax), //Vertex 6: Back, top, right corner
 			vec3(xmeshmax, ymeshmin, zmeshmax)  //Vertex 7: Back, bottom, right corner
 		};
+		data.low = vec3(xmeshmin, ymeshmin, zmeshmin);
+		data.high = vec3(xmeshmax, ymeshmax, zmeshmax);
 
 		// now walk through each of the mesh's faces (a face is a mesh's triangle) and retrieve the corresponding vertex indices.
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			const aiFace &face = mesh->mFaces[i];
 			// retrieve all indices of the face and store them in the indices vector
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
 		}
-		// process materials
+
+		// simplified collision mesh
+		PROFILE_ZONE("collision mesh");
+		vec3* positions = scratch.allocate<vec3>(vertices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++)
+			positions[i] = vertices[i].Position;
+		data.collision.build(positions, vertices.size(), indices.data(), indices.size(), collisionCellSize, scratch);
+		data.geometryHash = geometryHash(vertices, indices);
+	}
+
+	// FNV-1a hash of a mesh's geometry with its translation taken out: positions relative to the first vertex rounded
+	// to 1/1024 of a model unit, normals, texture coordinates and indices. Meshes with the same hash are compared
+	// in full (see Mesh::sameGeometry) and share their GL buffers if they match
+	static unsigned long long geometryHash(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		auto mix = [&hash](unsigned long long value) {
+			for (int i = 0; i < 8; i++) {
+				hash ^= (value >> (8 * i)) & 0xFF;
+				hash *= 1099511628211ULL;
+			}
+		};
+		mix(vertices.size());
+		mix(indices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++) {
+			ivec3 position = ivec3(round((vertices[i].Position - vertices[0].Position) * 1024.0f));
+			ivec3 normal = ivec3(round(vertices[i].Normal * 1024.0f));
+			ivec2 texCoords = ivec2(round(vertices[i].TexCoords * 4096.0f));
+			for (int j = 0; j < 3; j++) {
+				mix(position[j]);
+				mix(normal[j]);
+			}
+			mix(texCoords.x);
+			mix(texCoords.y);
+		}
+		for (unsigned int i = 0; i < indices.size(); i++)
+			mix(indices[i]);
+		return hash;
+	}
+
+	// process materials
+	static void processMaterial(aiMesh *mesh, const aiScene *scene, ImportedModel &imported, MeshData &data)
+	{
 		if (mesh->mMaterialIndex >= 0)
 		{
 			aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -369,92 +852,77 @@ private:
 			// normal: texture_normalN
 
 			// 1. diffuse maps
-			vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+			loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", imported, data);
 			// 2. specular maps
-			vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", imported, data);
 			// 3. normal maps
-			vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-			textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+			loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", imported, data);
 			// 4. height maps
-			vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-			textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+			loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", imported, data);
 		}
-
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures, bounding_box);
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// checks all material textures of a given type and adds the ones not seen yet to the textures to decode.
+	static void loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName, ImportedModel &imported, MeshData &data)
 	{
-		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
+			// check if texture was seen before and if so, continue to next iteration: skip loading a new texture
 			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
+			for (unsigned int j = 0; j < imported.textures.size(); j++)
 			{
-				if (strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
+				if (strcmp(imported.textures[j].path.C_Str(), str.C_Str()) == 0)
 				{
-					textures.push_back(textures_loaded[j]);
+					data.textures.push_back(j);
 					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
 					break;
 				}
 			}
 			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory, false);
+			{   // if texture hasn't been seen already, decode it once for the entire model
+				TextureData texture;
 				texture.type = typeName;
 				texture.path = str;
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+				data.textures.push_back(imported.textures.size());
+				imported.textures.push_back(std::move(texture));
 			}
 		}
-		return textures;
 	}
 
-	unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+	// uploads a decoded texture and frees its pixels
+	unsigned int TextureFromData(TextureData &texture)
 	{
-		string filename = string(path);
-		filename = directory + '/' + filename;
-
 		unsigned int textureID;
 		glGenTextures(1, &textureID);
 
-		int width, height, nrComponents;
-		unsigned char *data = SOIL_load_image(filename.c_str(), &width, &height, &nrComponents, SOIL_LOAD_AUTO);
+		unsigned char *data = texture.pixels;
 		if (data)
 		{
 			GLenum format;
-			if (nrComponents == 1)
+			if (texture.components == 1)
 				format = GL_RED;
-			else if (nrComponents == 3)
+			else if (texture.components == 3)
 				format = GL_RGB;
-			else if (nrComponents == 4)
+			else if (texture.components == 4)
 				format = GL_RGBA;
 
 			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, data);
 			glGenerateMipmap(GL_TEXTURE_2D);
 
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			SOIL_free_image_data(data);
 		}
 		else
 		{
-			cout << "Texture failed to load at path: " << path << endl;
-			SOIL_free_image_data(data);
+			cout << "Texture failed to load at path: " << texture.path.C_Str() << endl;
 		}
+		SOIL_free_image_data(data);
+		texture.pixels = nullptr;
 
 		return textureID;
 	}
@@ -0,0 +1,98 @@
+#ifndef OBJECT_TRANSFORMS_H
+#define OBJECT_TRANSFORMS_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include <cstring>
+#include <vector>
+
+// What a shader reads of the object it draws, laid out as the std140 block
+//	layout(std140) uniform Object { mat4 model; mat3 normalMatrix; };
+struct ObjectRecord
+{
+	glm::mat4 model;
+	// columns of the inverse transpose of the model matrix, a std140 mat3 pads each one to a vec4
+	glm::vec4 normal[3];
+};
+
+// One ObjectRecord per model in a uniform buffer. A record is only written when its model matrix changes,
+// and the changed ones go to the GPU in a single upload per frame; every draw then binds its object's record
+class ObjectTransforms
+{
+public:
+	// uniform block binding the records are bound to
+	static const unsigned int BINDING = 0;
+
+	// creates the buffer for capacity objects, on the GL thread
+	void create(unsigned int capacity)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		stride = (sizeof(ObjectRecord) + alignment - 1) / alignment * alignment;
+		this->capacity = capacity;
+		staging.assign(capacity * stride, 0);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, staging.size(), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// writes the record of an object, it reaches the GPU at the next upload
+	void set(unsigned int index, const glm::mat4 &model)
+	{
+		if (index >= capacity)
+			return;
+		ObjectRecord record;
+		record.model = model;
+		glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+		for (int i = 0; i < 3; i++)
+			record.normal[i] = glm::vec4(normal[i], 0);
+		memcpy(&staging[index * stride], &record, sizeof(record));
+		dirtyFirst = glm::min(dirtyFirst, index);
+		dirtyLast = glm::max(dirtyLast, index + 1);
+	}
+
+	// record of an object as last set, the instanced draws take its normal matrix as an attribute
+	const ObjectRecord &get(unsigned int index) const
+	{
+		return *reinterpret_cast<const ObjectRecord*>(&staging[index * stride]);
+	}
+
+	// sends the records written since the last upload, in one call
+	void upload()
+	{
+		if (dirtyFirst >= dirtyLast)
+			return;
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, dirtyFirst * stride, (dirtyLast - dirtyFirst) * stride, &staging[dirtyFirst * stride]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		dirtyFirst = capacity;
+		dirtyLast = 0;
+	}
+
+	// makes the record of an object the one the shaders read
+	void bind(unsigned int index) const
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, index * stride, sizeof(ObjectRecord));
+	}
+
+	// deletes the buffer, must run while the context is still current
+	void release()
+	{
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+private:
+	GLuint buffer = 0;
+	unsigned int capacity = 0;
+	// bytes between records, a multiple of the offset alignment glBindBufferRange needs
+	size_t stride = 0;
+	std::vector<char> staging;
+	// range of records written since the last upload
+	unsigned int dirtyFirst = ~0u;
+	unsigned int dirtyLast = 0;
+};
+#endif
@@ -0,0 +1,245 @@
+#ifndef SHADOW_MAPS_H
+#define SHADOW_MAPS_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "gtc/matrix_transform.hpp"
+#include "shader.h"
+#include "model.h"
+#include "LightClusters.h"
+#include "Profiler.h"
+#include <vector>
+
+// Omnidirectional shadows of the first MAX_SHADOWED lights, each a depth cube map holding the distance to the light.
+// The maps are cached: the models on the static collision layer (house, kitchen) are drawn once into a static layer,
+// and the map the shaders read is that layer copied with the other casters drawn over it. A light's map is only
+// redrawn when a caster moved within its reach, appeared there, or the light was switched on, so a frame where
+// nothing moves draws no shadow pass at all
+class ShadowMaps
+{
+public:
+	static const unsigned int MAX_SHADOWED = 4;
+	// texture unit of the first map, the others follow
+	static const unsigned int FIRST_UNIT = 9;
+	// width and height of a cube face
+	static const unsigned int SIZE = 512;
+
+	// creates the maps of the first lights and gives them their slot, on the GL thread.
+	// farPlane is the distance the maps are normalized by, capacity the number of models tracked
+	void create(Shader &shadowShader, std::vector<PointLight> &lights, float farPlane, unsigned int capacity)
+	{
+		shader = &shadowShader;
+		this->farPlane = farPlane;
+		bounds.assign(capacity, Bounds());
+		count = glm::min((unsigned int)lights.size(), MAX_SHADOWED);
+		for (unsigned int i = 0; i < lights.size(); i++)
+			lights[i].shadowMap = i < count ? (int)i : -1;
+		for (unsigned int i = 0; i < count; i++) {
+			maps[i].staticLayer = cubeMap(0);
+			//the map the shaders read stays bound to its unit
+			maps[i].combined = cubeMap(FIRST_UNIT + i);
+			maps[i].staticReady = false;
+			maps[i].dirty = true;
+		}
+		glActiveTexture(GL_TEXTURE0);
+		//depth only, neither framebuffer has a colour buffer to draw or read
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glGenFramebuffers(1, &copyFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, copyFramebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// points a lighting shader at the maps
+	void setup(Shader &lighting) const
+	{
+		lighting.use();
+		for (unsigned int i = 0; i < MAX_SHADOWED; i++) {
+			char name[16] = "shadowMaps[0]";
+			name[11] = '0' + i;
+			lighting.setInt(name, FIRST_UNIT + i);
+		}
+		lighting.setFloat("shadowFar", farPlane);
+	}
+
+	// a model's render matrix changed (or it appeared): the lights it was or is now within reach of are redrawn.
+	// Transparent models, spawned copies included, cast no shadow
+	void moved(unsigned int index, const Model &model, const std::vector<PointLight> &lights)
+	{
+		if (index >= bounds.size())
+			return;
+		Bounds &box = bounds[index];
+		glm::vec3 modelLow, modelHigh;
+		model.getRenderBounds(modelLow, modelHigh);
+		if (!model.transparent) {
+			for (unsigned int i = 0; i < count; i++) {
+				glm::vec3 low, high;
+				reach(lights[i], low, high);
+				if ((box.valid && overlaps(box.low, box.high, low, high)) || overlaps(modelLow, modelHigh, low, high))
+					maps[i].dirty = true;
+			}
+		}
+		box.low = modelLow;
+		box.high = modelHigh;
+		box.valid = true;
+	}
+
+	// a light was switched on, what moved while it was off is drawn now
+	void switched(const PointLight &light)
+	{
+		if (light.shadowMap >= 0)
+			maps[light.shadowMap].dirty = true;
+	}
+
+	// whether update has passes to draw
+	bool pending(const std::vector<PointLight> &lights) const
+	{
+		for (unsigned int i = 0; i < count; i++) {
+			if (maps[i].dirty && lights[i].on)
+				return true;
+		}
+		return false;
+	}
+
+	// redraws the maps of the lights that are on and need it, over the first modelCount models. Returns the cube
+	// faces drawn, 0 on a steady frame
+	unsigned int update(const std::vector<PointLight> &lights, unsigned int modelCount)
+	{
+		unsigned int faces = 0;
+		if (!pending(lights))
+			return faces;
+		PROFILE_ZONE("ShadowMaps::update");
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glViewport(0, 0, SIZE, SIZE);
+		//walls are single sided, they shadow from both sides
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		shader->use();
+		shader->setFloat("shadowFar", farPlane);
+		for (unsigned int i = 0; i < count; i++) {
+			ShadowMap &map = maps[i];
+			if (!map.dirty || !lights[i].on)
+				continue;
+			glm::vec3 low, high;
+			reach(lights[i], low, high);
+			shader->setVec3("lightPosition", lights[i].position);
+			if (!map.staticReady) {
+				faces += draw(map.staticLayer, lights[i].position, low, high, modelCount, true);
+				map.staticReady = true;
+			}
+			for (unsigned int face = 0; face < 6; face++) {
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffer);
+				glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, map.staticLayer, 0);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+				glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, map.combined, 0);
+				glBlitFramebuffer(0, 0, SIZE, SIZE, 0, 0, SIZE, SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			}
+			faces += draw(map.combined, lights[i].position, low, high, modelCount, false);
+			map.dirty = false;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glEnable(GL_BLEND);
+		glEnable(GL_CULL_FACE);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		return faces;
+	}
+
+	// deletes the maps and framebuffers, must run while the context is still current
+	void release()
+	{
+		for (unsigned int i = 0; i < count; i++) {
+			GLuint textures[2] = { maps[i].staticLayer, maps[i].combined };
+			glDeleteTextures(2, textures);
+		}
+		count = 0;
+		GLuint framebuffers[2] = { framebuffer, copyFramebuffer };
+		glDeleteFramebuffers(2, framebuffers);
+		framebuffer = copyFramebuffer = 0;
+	}
+
+private:
+	struct ShadowMap
+	{
+		GLuint staticLayer = 0;
+		GLuint combined = 0;
+		bool staticReady = false;
+		bool dirty = true;
+	};
+	// box of a model where it was last seen
+	struct Bounds
+	{
+		glm::vec3 low, high;
+		bool valid = false;
+	};
+	ShadowMap maps[MAX_SHADOWED];
+	unsigned int count = 0;
+	Shader* shader = nullptr;
+	float farPlane = 100.0f;
+	GLuint framebuffer = 0, copyFramebuffer = 0;
+	// by model index
+	std::vector<Bounds> bounds;
+
+	GLuint cubeMap(unsigned int unit)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		for (unsigned int face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		if (unit == 0)
+			glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		return texture;
+	}
+
+	// box the light can reach: its room, and no further than where it fades out or the maps end
+	void reach(const PointLight &light, glm::vec3 &low, glm::vec3 &high) const
+	{
+		float distance = glm::min(LightClusters::range(light), farPlane);
+		low = glm::max(light.boundsMin, light.position - glm::vec3(distance));
+		high = glm::min(light.boundsMax, light.position + glm::vec3(distance));
+	}
+
+	static bool overlaps(const glm::vec3 &lowA, const glm::vec3 &highA, const glm::vec3 &lowB, const glm::vec3 &highB)
+	{
+		return !glm::any(glm::lessThan(highA, lowB)) && !glm::any(glm::lessThan(highB, lowA));
+	}
+
+	// draws one layer of the casters within the box into the 6 faces of a cube map, cleared first for the static layer
+	unsigned int draw(GLuint cube, const glm::vec3 &position, const glm::vec3 &low, const glm::vec3 &high, unsigned int modelCount, bool staticLayer)
+	{
+		static const glm::vec3 directions[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+			glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+		static const glm::vec3 ups[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+			glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+		glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, farPlane);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		for (unsigned int face = 0; face < 6; face++) {
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cube, 0);
+			if (staticLayer)
+				glClear(GL_DEPTH_BUFFER_BIT);
+			shader->use();
+			shader->setMat4("viewProjection", projection * glm::lookAt(position, position + directions[face], ups[face]));
+			for (unsigned int i = 0; i < modelCount && i < bounds.size(); i++) {
+				Model &model = *(Model::models[i]);
+				bool isStatic = (model.collisionFilter.layer & LAYER_STATIC) != 0;
+				if (model.transparent || isStatic != staticLayer || !bounds[i].valid || !overlaps(bounds[i].low, bounds[i].high, low, high))
+					continue;
+				model.Draw(shader);
+			}
+		}
+		return 6;
+	}
+};
+#endif
@@ -0,0 +1,298 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "glm.hpp"
+#include "gtc/quaternion.hpp"
+#include "camera.h"
+#include "model.h"
+#include "CollisionManager.h"
+#include "Profiler.h"
+#include "Memory.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Keys held during a frame, as sampled by the render thread
+enum InputKey {
+	INPUT_FORWARD = 1 << 0,
+	INPUT_BACKWARD = 1 << 1,
+	INPUT_LEFT = 1 << 2,
+	INPUT_RIGHT = 1 << 3,
+	INPUT_PAGE_UP = 1 << 4,
+	INPUT_PAGE_DOWN = 1 << 5,
+	INPUT_UP = 1 << 6,
+	INPUT_DOWN = 1 << 7,
+	INPUT_ARROW_LEFT = 1 << 8,
+	INPUT_ARROW_RIGHT = 1 << 9,
+	// arrows and page up/down rotate the selected object instead of shifting it
+	INPUT_ROTATE = 1 << 10
+};
+
+// What the render thread hands the simulation every frame
+struct InputState
+{
+	unsigned int keys = 0;
+	// orientation of the view camera, the mouse is handled by the render thread
+	float yaw = YAW;
+	float pitch = PITCH;
+	// index of the selected model in Model::models, -1 if none
+	int selected = -1;
+};
+
+// Transforms at the end of a simulation tick
+struct SceneState
+{
+	// seconds since the simulation started
+	double time = 0.0;
+	glm::vec3 cameraPosition;
+	std::vector<glm::mat4> modelMatrices;
+};
+
+// The last two ticks, the render thread draws in between them
+struct SceneFrame
+{
+	SceneState previous;
+	SceneState current;
+};
+
+// Hands the latest value from one thread to another without either of them waiting.
+// The writer fills its own slot and swaps it with the shared one, the reader swaps its slot with the shared one
+// whenever a newer value was published
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : shared(1) {}
+
+	// slot to fill before publish, writer side
+	T& back() { return slots[writing]; }
+	void publish() { writing = shared.exchange(writing | FRESH) & ~FRESH; }
+
+	// takes the latest published value if there is a new one, reader side
+	bool update()
+	{
+		if (!(shared.load() & FRESH))
+			return false;
+		reading = shared.exchange(reading) & ~FRESH;
+		return true;
+	}
+	const T& front() const { return slots[reading]; }
+
+private:
+	static const unsigned int FRESH = 4;
+	T slots[3];
+	unsigned int writing = 0;
+	unsigned int reading = 2;
+	std::atomic<unsigned int> shared;
+};
+
+// Runs input, collision and transform updates on its own thread at a fixed tick.
+// The simulation owns the model matrices and the camera position; the render thread only sees
+// the published SceneFrame and interpolates between its two ticks
+class Simulation
+{
+public:
+	// length of a tick, in seconds
+	const double tick = 1.0 / 60.0;
+	// the player, moved by the simulation. Its orientation follows the view camera's
+	Camera body;
+
+	Simulation(const Camera &view) : body(view.Position, view.WorldUp, view.Yaw, view.Pitch), running(false), ticks(0), guarded(false) {}
+	~Simulation() { stop(); }
+
+	void start()
+	{
+		if (running)
+			return;
+		//publish the loaded scene so the first frame has something to draw
+		publish(0.0);
+		publish(0.0);
+		startTime = std::chrono::steady_clock::now();
+		running = true;
+		worker = std::thread(&Simulation::run, this);
+	}
+
+	void stop()
+	{
+		running = false;
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// called by the render thread once per frame
+	void setInput(const InputState &input)
+	{
+		inputs.back() = input;
+		inputs.publish();
+	}
+
+	// runs command on the simulation thread before the next tick, for anything touching state the simulation owns
+	void post(const std::function<void()> &command)
+	{
+		std::lock_guard<std::mutex> lock(commandMutex);
+		commands.push_back(command);
+	}
+
+	// transforms interpolated between the last two ticks at the current time, for the render thread
+	void interpolate(glm::vec3 &cameraPosition, std::vector<glm::mat4> &modelMatrices)
+	{
+		frames.update();
+		const SceneFrame &frame = frames.front();
+		float alpha = 1.0f;
+		if (frame.current.time > frame.previous.time)
+			alpha = (float)glm::clamp((now() - frame.current.time) / tick, 0.0, 1.0);
+
+		cameraPosition = glm::mix(frame.previous.cameraPosition, frame.current.cameraPosition, alpha);
+		modelMatrices.resize(frame.current.modelMatrices.size());
+		for (unsigned int i = 0; i < modelMatrices.size(); i++)
+			modelMatrices[i] = interpolateTransform(frame.previous.modelMatrices[i], frame.current.modelMatrices[i], alpha);
+	}
+
+	// ticks simulated since start
+	unsigned int getTicks() const { return ticks; }
+
+	// from the next tick on, any heap allocation during a tick is a violation, see MemoryTracker
+	void guardTicks(bool on) { guarded = on; }
+
+private:
+	std::thread worker;
+	std::atomic<bool> running;
+	std::atomic<unsigned int> ticks;
+	std::atomic<bool> guarded;
+	std::chrono::steady_clock::time_point startTime;
+	TripleBuffer<InputState> inputs;
+	TripleBuffer<SceneFrame> frames;
+	// state of the last tick, the previous half of the next published frame
+	SceneState last;
+	std::mutex commandMutex;
+	std::vector<std::function<void()>> commands;
+
+	double now() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	void run()
+	{
+		std::chrono::steady_clock::duration length = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(tick));
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+		Profiler::setThreadName("simulation");
+		MemoryTracker::setThreadName("simulation");
+		MemoryScope tag(MEMORY_SIMULATION);
+		InputState input;
+		std::vector<std::function<void()>> pending;
+		while (running)
+		{
+			{
+				std::lock_guard<std::mutex> lock(commandMutex);
+				pending.swap(commands);
+			}
+			for (unsigned int i = 0; i < pending.size(); i++)
+				pending[i]();
+			pending.clear();
+
+			if (inputs.update())
+				input = inputs.front();
+			MemoryTracker::guard(guarded);
+			step(input);
+			publish(now());
+			MemoryTracker::guard(false);
+			ticks++;
+
+			next += length;
+			//fell far behind (debugger, window dragged): drop the missed ticks instead of running them back to back
+			if (std::chrono::steady_clock::now() - next > 5 * length)
+				next = std::chrono::steady_clock::now();
+			std::this_thread::sleep_until(next);
+		}
+	}
+
+	// one tick: held keys become moves, which are then resolved together
+	void step(const InputState &input)
+	{
+		PROFILE_ZONE("simulation tick");
+		body.SetOrientation(input.yaw, input.pitch);
+		float seconds = (float)tick;
+		if (input.keys & INPUT_FORWARD)
+			body.ProcessMovement(MOVE_FORWARD, seconds);
+		if (input.keys & INPUT_BACKWARD)
+			body.ProcessMovement(MOVE_BACKWARD, seconds);
+		if (input.keys & INPUT_LEFT)
+			body.ProcessMovement(MOVE_LEFT, seconds);
+		if (input.keys & INPUT_RIGHT)
+			body.ProcessMovement(MOVE_RIGHT, seconds);
+
+		if (input.selected >= 0 && input.selected < (int)Model::models.size())
+		{
+			Model &selected = *Model::models[input.selected];
+			if (input.keys & INPUT_ROTATE)
+			{
+				if (input.keys & INPUT_PAGE_UP)
+					selected.rotate(ROTATE_UP_LEFT);
+				if (input.keys & INPUT_PAGE_DOWN)
+					selected.rotate(ROTATE_UP_RIGHT);
+				if (input.keys & INPUT_UP)
+					selected.rotate(ROTATE_UP);
+				if (input.keys & INPUT_DOWN)
+					selected.rotate(ROTATE_DOWN);
+				if (input.keys & INPUT_ARROW_LEFT)
+					selected.rotate(ROTATE_LEFT);
+				if (input.keys & INPUT_ARROW_RIGHT)
+					selected.rotate(ROTATE_RIGHT);
+			}
+			else
+			{
+				if (input.keys & INPUT_PAGE_UP)
+					selected.shift(SHIFT_UP);
+				if (input.keys & INPUT_PAGE_DOWN)
+					selected.shift(SHIFT_DOWN);
+				if (input.keys & INPUT_UP)
+					selected.shift(SHIFT_FORWARD);
+				if (input.keys & INPUT_DOWN)
+					selected.shift(SHIFT_BACKWARD);
+				if (input.keys & INPUT_ARROW_LEFT)
+					selected.shift(SHIFT_LEFT);
+				if (input.keys & INPUT_ARROW_RIGHT)
+					selected.shift(SHIFT_RIGHT);
+			}
+		}
+
+		CollisionManager::getInstance()->resolveMoves();
+	}
+
+	// writes the state of this tick next to the previous one and hands both to the render thread
+	void publish(double time)
+	{
+		SceneFrame &frame = frames.back();
+		frame.previous = last;
+		last.time = time;
+		last.cameraPosition = body.Position;
+		last.modelMatrices.resize(Model::models.size());
+		for (unsigned int i = 0; i < Model::models.size(); i++)
+			last.modelMatrices[i] = Model::models[i]->getModelMatrix();
+		//a model spawned since the last tick has no previous transform, it starts where it is
+		size_t tracked = frame.previous.modelMatrices.size();
+		frame.previous.modelMatrices.resize(last.modelMatrices.size());
+		for (size_t i = tracked; i < last.modelMatrices.size(); i++)
+			frame.previous.modelMatrices[i] = last.modelMatrices[i];
+		frame.current = last;
+		frames.publish();
+	}
+
+	// blends two model matrices made of a uniform scale, a rotation and a translation
+	static glm::mat4 interpolateTransform(const glm::mat4 &from, const glm::mat4 &to, float alpha)
+	{
+		if (from == to || alpha >= 1.0f)
+			return to;
+		float fromScale = glm::length(glm::vec3(from[0]));
+		float toScale = glm::length(glm::vec3(to[0]));
+		glm::quat rotation = glm::slerp(glm::quat_cast(glm::mat3(from) / fromScale), glm::quat_cast(glm::mat3(to) / toScale), alpha);
+		glm::mat4 result = glm::mat4(glm::mat3_cast(rotation) * glm::mix(fromScale, toScale, alpha));
+		result[3] = glm::mix(from[3], to[3], alpha);
+		return result;
+	}
+};
+#endif
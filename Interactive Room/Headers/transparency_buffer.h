@@ -0,0 +1,145 @@
+#ifndef TRANSPARENCY_BUFFER_H
+#define TRANSPARENCY_BUFFER_H
+
+#include "glew.h"
+#include "gl_stats.h"
+#include "glm.hpp"
+#include "shader.h"
+
+// Weighted blended order-independent transparency. The transparent models are drawn in one unsorted pass into an
+// accumulation target (colour premultiplied by alpha and a weight falling with distance) and a target of the summed
+// weights, while the accumulation's alpha keeps the product of the (1 - alpha) of every layer. A full screen pass
+// then blends their weighted average over the opaque image, so the cost is the same whatever the order, the number
+// of transparent models or where the camera looks from. One blend function serves both targets, as GL 3.3 has no
+// per-buffer blending
+class TransparencyBuffer
+{
+public:
+	// texture units the composite pass reads the targets from
+	static const unsigned int ACCUMULATION_UNIT = 0;
+	static const unsigned int WEIGHT_UNIT = 1;
+
+	// points the composite shader at the targets, the framebuffer itself is created at the first resize
+	void create(Shader &composite)
+	{
+		this->composite = &composite;
+		composite.use();
+		composite.setInt("accumulation", ACCUMULATION_UNIT);
+		composite.setInt("weights", WEIGHT_UNIT);
+		//the full screen triangle has no attributes, but a core context wants a vertex array bound
+		glGenVertexArrays(1, &emptyVAO);
+	}
+
+	// (re)creates the targets when the window size changed
+	void resize(int width, int height)
+	{
+		if (width == this->width && height == this->height)
+			return;
+		releaseTargets();
+		this->width = width;
+		this->height = height;
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		accumulation = target(GL_RGBA16F, GL_RGBA, GL_COLOR_ATTACHMENT0);
+		weights = target(GL_R16F, GL_RED, GL_COLOR_ATTACHMENT1);
+		//the opaque depth is blitted in, the format must be the one of the window's (24 bit depth, 8 bit stencil)
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, buffers);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::TRANSPARENCY_BUFFER::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// makes the targets the destination of the transparent models' draws: cleared, depth tested against the opaque
+	// models of the default framebuffer but not written, and blended additively
+	void begin()
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		//nothing in front yet: no colour, everything behind revealed, no weight
+		const GLfloat clearAccumulation[4] = { 0, 0, 0, 1 };
+		const GLfloat clearWeights[4] = { 0, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+		glClearBufferfv(GL_COLOR, 1, clearWeights);
+		glDepthMask(GL_FALSE);
+		//colours and weights add up, the accumulation's alpha is multiplied by (1 - alpha)
+		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// back to the default framebuffer and the usual blending
+	void end()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDepthMask(GL_TRUE);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// blends the weighted average of the transparent layers over the default framebuffer, by how much they cover
+	void resolve()
+	{
+		composite->use();
+		glActiveTexture(GL_TEXTURE0 + ACCUMULATION_UNIT);
+		glBindTexture(GL_TEXTURE_2D, accumulation);
+		glActiveTexture(GL_TEXTURE0 + WEIGHT_UNIT);
+		glBindTexture(GL_TEXTURE_2D, weights);
+		glActiveTexture(GL_TEXTURE0);
+		//the composite writes the revealed fraction as alpha: average * (1 - revealed) + opaque * revealed
+		glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+		glDisable(GL_DEPTH_TEST);
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glEnable(GL_DEPTH_TEST);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// deletes the framebuffer and its targets, must run while the context is still current
+	void release()
+	{
+		releaseTargets();
+		if (emptyVAO)
+			glDeleteVertexArrays(1, &emptyVAO);
+		emptyVAO = 0;
+	}
+
+private:
+	Shader* composite = nullptr;
+	GLuint framebuffer = 0, accumulation = 0, weights = 0, depth = 0;
+	GLuint emptyVAO = 0;
+	int width = 0, height = 0;
+
+	GLuint target(GLint internalFormat, GLenum format, GLenum point)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, point, GL_TEXTURE_2D, texture, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+	void releaseTargets()
+	{
+		if (!framebuffer)
+			return;
+		GLuint textures[2] = { accumulation, weights };
+		glDeleteTextures(2, textures);
+		glDeleteRenderbuffers(1, &depth);
+		glDeleteFramebuffers(1, &framebuffer);
+		framebuffer = accumulation = weights = depth = 0;
+		width = height = 0;
+	}
+};
+#endif
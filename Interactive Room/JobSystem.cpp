@@ -0,0 +1,259 @@
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Memory.h"
+#include <algorithm>
+#include <iostream>
+
+//Queue of the current thread, set on the workers only
+static thread_local int workerIndex = -1;
+
+JobSystem* JobSystem::getInstance()
+{
+	static JobSystem instance;
+	return &instance;
+}
+
+JobSystem::JobSystem() : queued(0), stopping(false)
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	count = count > 1 ? count - 1 : 1;
+	for (unsigned int i = 0; i <= count; i++)
+	{
+		queues.push_back(std::unique_ptr<Queue>(new Queue));
+	}
+	statsStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (unsigned int i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+//Jobs submitted by an untagged thread count as MEMORY_JOBS
+int JobSystem::submitterTag()
+{
+	int tag = MemoryTracker::currentTag();
+	return tag == MEMORY_UNTAGGED ? MEMORY_JOBS : tag;
+}
+
+unsigned int JobSystem::queueOf() const
+{
+	return workerIndex >= 0 ? workerIndex : queues.size() - 1;
+}
+
+void JobSystem::submit(const std::function<void()> &job, JobCounter* counter)
+{
+	if (counter)
+	{
+		counter->pending++;
+	}
+	push(Job{ job, counter, submitterTag() });
+}
+
+void JobSystem::submitAfter(JobCounter &dependency, const std::function<void()> &job, JobCounter* counter)
+{
+	if (counter)
+	{
+		counter->pending++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(dependency.lock);
+		if (dependency.pending > 0)
+		{
+			dependency.waiting.push_back(Job{ job, counter, submitterTag() });
+			return;
+		}
+	}
+	push(Job{ job, counter, submitterTag() });
+}
+
+void JobSystem::push(Job job)
+{
+	Queue &queue = *queues[queueOf()];
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.jobs.push_back(std::move(job));
+	}
+	queued++;
+	//Taking the lock orders this with a worker checking queued before it sleeps
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+//Newest job of our own queue first, it's the most likely to still be in cache, then the oldest of any other queue
+bool JobSystem::take(Job &job)
+{
+	unsigned int self = queueOf();
+	for (unsigned int i = 0; i < queues.size(); i++)
+	{
+		unsigned int victim = (self + i) % queues.size();
+		Queue &queue = *queues[victim];
+		std::lock_guard<std::mutex> lock(queue.lock);
+		if (queue.jobs.empty())
+		{
+			continue;
+		}
+		if (victim == self)
+		{
+			job = queue.jobs.pop_back();
+		}
+		else
+		{
+			job = queue.jobs.pop_front();
+			queues[self]->steals++;
+		}
+		queued--;
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::execute(Job &job)
+{
+	Queue &queue = *queues[queueOf()];
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	{
+		PROFILE_ZONE("job");
+		MemoryScope tag((MemoryTag)job.memoryTag);
+		job.run();
+	}
+	queue.busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	queue.jobsRun++;
+	finish(job.counter);
+}
+
+//Releases the jobs waiting on a counter once it reaches zero
+void JobSystem::finish(JobCounter* counter)
+{
+	if (!counter)
+	{
+		return;
+	}
+	std::vector<Job> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->lock);
+		if (--counter->pending == 0)
+		{
+			ready.swap(counter->waiting);
+		}
+	}
+	for (unsigned int i = 0; i < ready.size(); i++)
+	{
+		push(std::move(ready[i]));
+	}
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+	while (counter.pending > 0)
+	{
+		Job job;
+		if (take(job))
+		{
+			execute(job);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	//finish may still hold the lock after the last decrement
+	std::lock_guard<std::mutex> lock(counter.lock);
+}
+
+void JobSystem::parallelFor(unsigned int begin, unsigned int end, unsigned int grain, const std::function<void(unsigned int, unsigned int)> &body)
+{
+	grain = std::max(grain, 1u);
+	if (end <= begin)
+	{
+		return;
+	}
+	if (end - begin <= grain)
+	{
+		body(begin, end);
+		return;
+	}
+	JobCounter counter;
+	for (unsigned int first = begin; first < end; first += grain)
+	{
+		unsigned int last = std::min(first + grain, end);
+		submit([&body, first, last] { body(first, last); }, &counter);
+	}
+	wait(counter);
+}
+
+void JobSystem::workerLoop(unsigned int index)
+{
+	workerIndex = index;
+	Profiler::setThreadName("worker " + std::to_string(index));
+	MemoryTracker::setThreadName(("worker " + std::to_string(index)).c_str());
+	MemoryScope tag(MEMORY_JOBS);
+	while (!stopping)
+	{
+		Job job;
+		if (take(job))
+		{
+			execute(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return queued > 0 || stopping; });
+	}
+}
+
+void JobSystem::getStats(std::vector<WorkerStats> &stats) const
+{
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - statsStart).count();
+	stats.resize(queues.size());
+	for (unsigned int i = 0; i < queues.size(); i++)
+	{
+		stats[i].jobs = queues[i]->jobsRun;
+		stats[i].steals = queues[i]->steals;
+		stats[i].busyMilliseconds = queues[i]->busyNanoseconds / 1000000.0;
+		stats[i].utilization = elapsed > 0.0 ? (float)(stats[i].busyMilliseconds / elapsed) : 0.0f;
+	}
+}
+
+void JobSystem::resetStats()
+{
+	for (unsigned int i = 0; i < queues.size(); i++)
+	{
+		queues[i]->jobsRun = 0;
+		queues[i]->steals = 0;
+		queues[i]->busyNanoseconds = 0;
+	}
+	statsStart = std::chrono::high_resolution_clock::now();
+}
+
+void JobSystem::printStats() const
+{
+	std::vector<WorkerStats> stats;
+	getStats(stats);
+	for (unsigned int i = 0; i < stats.size(); i++)
+	{
+		if (i + 1 < stats.size())
+		{
+			std::cout << "worker " << i;
+		}
+		else
+		{
+			std::cout << "other threads";
+		}
+		std::cout << ":\t" << stats[i].jobs << " jobs, " << stats[i].steals << " stolen, " << stats[i].busyMilliseconds << " ms busy, "
+			<< (int)(stats[i].utilization * 100.0f) << "% utilization" << std::endl;
+	}
+}
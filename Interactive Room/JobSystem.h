@@ -0,0 +1,149 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+struct Job
+{
+	std::function<void()> run;
+	//decremented once the job is done, may be null
+	JobCounter* counter;
+	//MemoryTag of the thread that submitted it, the job's allocations are counted under it wherever it runs
+	int memoryTag;
+};
+
+//Number of unfinished jobs submitted with it. Jobs can be submitted to run after it reaches zero
+class JobCounter
+{
+public:
+	JobCounter() : pending(0) {}
+	bool done() const { return pending == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<int> pending;
+	std::mutex lock;
+	//jobs waiting for this counter to reach zero
+	std::vector<Job> waiting;
+};
+
+//Ring of jobs taken from either end. It grows when full and keeps its capacity, unlike a deque that allocates
+//and frees blocks as jobs go through it, so the queues stop allocating once they have grown to the load
+class JobQueue
+{
+public:
+	bool empty() const { return count == 0; }
+	void push_back(Job job)
+	{
+		if (count == jobs.size())
+		{
+			grow();
+		}
+		jobs[(first + count) % jobs.size()] = std::move(job);
+		count++;
+	}
+	Job pop_back()
+	{
+		count--;
+		return std::move(jobs[(first + count) % jobs.size()]);
+	}
+	Job pop_front()
+	{
+		Job job = std::move(jobs[first]);
+		first = (first + 1) % jobs.size();
+		count--;
+		return job;
+	}
+
+private:
+	std::vector<Job> jobs;
+	unsigned int first = 0;
+	unsigned int count = 0;
+
+	void grow()
+	{
+		std::vector<Job> larger(jobs.empty() ? 64 : jobs.size() * 2);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			larger[i] = std::move(jobs[(first + i) % jobs.size()]);
+		}
+		jobs.swap(larger);
+		first = 0;
+	}
+};
+
+//Time and jobs of one worker since the last resetStats
+struct WorkerStats
+{
+	unsigned long long jobs = 0;
+	//jobs taken from another worker's queue
+	unsigned long long steals = 0;
+	double busyMilliseconds = 0.0;
+	//busy time over the time since the last reset
+	float utilization = 0.0f;
+};
+
+//Work-stealing scheduler shared by loading, culling and collision.
+//Each worker pushes and pops jobs at the back of its own queue and steals from the front of the others' when it runs out.
+//Threads outside the pool (main, simulation, loaders) submit to a shared queue, and run jobs themselves while they wait
+class JobSystem
+{
+public:
+	static JobSystem* getInstance();
+	~JobSystem();
+
+	//runs job on any thread, counter (optional) is decremented when it's done
+	void submit(const std::function<void()> &job, JobCounter* counter = nullptr);
+	//runs job once dependency reaches zero
+	void submitAfter(JobCounter &dependency, const std::function<void()> &job, JobCounter* counter = nullptr);
+	//runs jobs until counter reaches zero
+	void wait(JobCounter &counter);
+	//calls body(first, last) on chunks of at most grain indices covering [begin, end), returns once all are done
+	void parallelFor(unsigned int begin, unsigned int end, unsigned int grain, const std::function<void(unsigned int, unsigned int)> &body);
+
+	//worker threads, not counting the threads that help while waiting
+	unsigned int workerCount() const { return threads.size(); }
+	//one entry per worker, the last one adds up the threads outside the pool
+	void getStats(std::vector<WorkerStats> &stats) const;
+	void resetStats();
+	void printStats() const;
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		JobQueue jobs;
+		std::atomic<unsigned long long> jobsRun;
+		std::atomic<unsigned long long> steals;
+		std::atomic<long long> busyNanoseconds;
+		Queue() : jobsRun(0), steals(0), busyNanoseconds(0) {}
+	};
+
+	JobSystem();
+	//worker queues, then the shared queue of outside threads
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	//jobs sitting in any queue, workers sleep while it's zero
+	std::atomic<int> queued;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<bool> stopping;
+	std::chrono::high_resolution_clock::time_point statsStart;
+
+	unsigned int queueOf() const;
+	static int submitterTag();
+	void push(Job job);
+	bool take(Job &job);
+	void execute(Job &job);
+	void finish(JobCounter* counter);
+	void workerLoop(unsigned int index);
+};
+#endif
@@ -0,0 +1,139 @@
+#include "LightClusters.h"
+#include <algorithm>
+#include <cmath>
+
+LightClusters::LightClusters() : counts(CLUSTER_COUNT), clusters(2 * CLUSTER_COUNT), indices(MAX_INDICES), indexCount(0), culled(0), dropped(0)
+{
+}
+
+float LightClusters::range(const PointLight &light)
+{
+	float brightest = max(light.color.r, max(light.color.g, light.color.b));
+	if (light.attenuation <= 0.0f || brightest <= CUTOFF)
+	{
+		return light.attenuation <= 0.0f ? 1e30f : 0.0f;
+	}
+	return sqrt((brightest / CUTOFF - 1.0f) / light.attenuation);
+}
+
+unsigned int LightClusters::slice(float depth, float zNear, float zFar)
+{
+	float position = log(depth / zNear) / log(zFar / zNear) * SLICES;
+	return (unsigned int)clamp(position, 0.0f, (float)(SLICES - 1));
+}
+
+//Clusters touched by the box the light reaches, the box clipped to the light's bounds.
+//Conservative: a box crossing the near plane covers every tile of the slices it spans
+bool LightClusters::cover(const PointLight &light, const mat4 &view, const mat4 &projection, float zNear, float zFar, Range &range) const
+{
+	float reach = LightClusters::range(light);
+	vec3 low = max(light.boundsMin, light.position - vec3(reach));
+	vec3 high = min(light.boundsMax, light.position + vec3(reach));
+	if (any(greaterThan(low, high)))
+	{
+		return false;
+	}
+
+	float minDepth = 1e30f, maxDepth = -1e30f;
+	vec2 ndcMin(1e30f), ndcMax(-1e30f);
+	bool crossesNear = false;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner((i & 1) ? high.x : low.x, (i & 2) ? high.y : low.y, (i & 4) ? high.z : low.z);
+		vec4 viewCorner = view * vec4(corner, 1);
+		float depth = -viewCorner.z;
+		minDepth = min(minDepth, depth);
+		maxDepth = max(maxDepth, depth);
+		if (depth <= zNear)
+		{
+			crossesNear = true;
+			continue;
+		}
+		vec4 clip = projection * viewCorner;
+		vec2 ndc = vec2(clip) / clip.w;
+		ndcMin = min(ndcMin, ndc);
+		ndcMax = max(ndcMax, ndc);
+	}
+	if (maxDepth < zNear || minDepth > zFar)
+	{
+		return false;
+	}
+	if (crossesNear)
+	{
+		ndcMin = vec2(-1);
+		ndcMax = vec2(1);
+	}
+	if (ndcMax.x < -1 || ndcMin.x > 1 || ndcMax.y < -1 || ndcMin.y > 1)
+	{
+		return false;
+	}
+
+	unsigned int tiles[2] = { TILES_X, TILES_Y };
+	for (int axis = 0; axis < 2; axis++)
+	{
+		range.min[axis] = (unsigned int)clamp((ndcMin[axis] * 0.5f + 0.5f) * tiles[axis], 0.0f, (float)(tiles[axis] - 1));
+		range.max[axis] = (unsigned int)clamp((ndcMax[axis] * 0.5f + 0.5f) * tiles[axis], 0.0f, (float)(tiles[axis] - 1));
+	}
+	range.min[2] = slice(max(minDepth, zNear), zNear, zFar);
+	range.max[2] = slice(min(maxDepth, zFar), zNear, zFar);
+	return true;
+}
+
+void LightClusters::build(const std::vector<PointLight> &lights, const mat4 &view, const mat4 &projection, float zNear, float zFar)
+{
+	ranges.resize(lights.size());
+	std::fill(counts.begin(), counts.end(), 0);
+	culled = 0;
+	dropped = 0;
+
+	//Count the lights of each cluster
+	for (unsigned int i = 0; i < lights.size(); i++)
+	{
+		Range &range = ranges[i];
+		if (!lights[i].on || !cover(lights[i], view, projection, zNear, zFar, range))
+		{
+			//empty range
+			range.min[0] = 1;
+			range.max[0] = 0;
+			culled++;
+			continue;
+		}
+		for (unsigned int z = range.min[2]; z <= range.max[2]; z++)
+			for (unsigned int y = range.min[1]; y <= range.max[1]; y++)
+				for (unsigned int x = range.min[0]; x <= range.max[0]; x++)
+					counts[x + TILES_X * (y + TILES_Y * z)]++;
+	}
+
+	//Give each cluster its slice of the index list
+	unsigned int offset = 0;
+	for (unsigned int i = 0; i < CLUSTER_COUNT; i++)
+	{
+		unsigned int count = std::min(counts[i], MAX_INDICES - offset);
+		dropped += counts[i] - count;
+		counts[i] = count;
+		clusters[2 * i] = offset;
+		clusters[2 * i + 1] = 0;
+		offset += count;
+	}
+	indexCount = offset;
+
+	//Fill the slices
+	for (unsigned int i = 0; i < lights.size(); i++)
+	{
+		const Range &range = ranges[i];
+		if (range.min[0] > range.max[0])
+		{
+			continue;
+		}
+		for (unsigned int z = range.min[2]; z <= range.max[2]; z++)
+			for (unsigned int y = range.min[1]; y <= range.max[1]; y++)
+				for (unsigned int x = range.min[0]; x <= range.max[0]; x++)
+				{
+					unsigned int cluster = x + TILES_X * (y + TILES_Y * z);
+					if (clusters[2 * cluster + 1] < counts[cluster])
+					{
+						indices[clusters[2 * cluster] + clusters[2 * cluster + 1]++] = i;
+					}
+				}
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+#include "glm.hpp"
+#include <vector>
+
+using namespace glm;
+
+//A point light, falling off as 1 / (1 + attenuation * distance^2)
+struct PointLight
+{
+	vec3 position;
+	vec3 color;
+	float attenuation;
+	//box the light may reach, in world space. The lamps are limited to their room, walls cast no shadows
+	vec3 boundsMin;
+	vec3 boundsMax;
+	//lights of a group are switched together (the lamps of a room)
+	int group;
+	bool on;
+	//cube map of the light in ShadowMaps, -1 if it casts no shadows
+	int shadowMap;
+};
+
+//Splits the view frustum into TILES_X * TILES_Y screen tiles and SLICES depth slices, spaced exponentially,
+//and lists the lights that can reach each of these clusters. A fragment then only shades the lights of its cluster.
+//Everything is preallocated, building the lists doesn't touch the heap unless the number of lights grows
+class LightClusters
+{
+public:
+	static const unsigned int TILES_X = 16;
+	static const unsigned int TILES_Y = 9;
+	static const unsigned int SLICES = 24;
+	static const unsigned int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+	//light indices all clusters together can hold, lights past it are dropped from the clusters that overflow
+	static const unsigned int MAX_INDICES = CLUSTER_COUNT * 32;
+	//a light stops being shaded where it contributes less than this
+	static constexpr float CUTOFF = 1.0f / 256.0f;
+
+	LightClusters();
+
+	//assigns the lights that are on to the clusters of the frustum of view and projection, which spans zNear to zFar
+	void build(const std::vector<PointLight> &lights, const mat4 &view, const mat4 &projection, float zNear, float zFar);
+
+	//offset in getIndices and count of the lights of each cluster, x first, then y, then the slice
+	const unsigned int* getClusters() const { return clusters.data(); }
+	const unsigned int* getIndices() const { return indices.data(); }
+	unsigned int getIndexCount() const { return indexCount; }
+	//lights that fell in no cluster (off, out of view) and indices dropped for lack of room, in the last build
+	unsigned int getCulled() const { return culled; }
+	unsigned int getDropped() const { return dropped; }
+
+	//distance at which a light falls under CUTOFF
+	static float range(const PointLight &light);
+	//slice of a view space depth, the shader computes the same
+	static unsigned int slice(float depth, float zNear, float zFar);
+
+private:
+	//clusters a light covers, inclusive
+	struct Range
+	{
+		unsigned int min[3];
+		unsigned int max[3];
+	};
+	std::vector<Range> ranges;
+	std::vector<unsigned int> counts;
+	//2 per cluster
+	std::vector<unsigned int> clusters;
+	std::vector<unsigned int> indices;
+	unsigned int indexCount;
+	unsigned int culled;
+	unsigned int dropped;
+
+	bool cover(const PointLight &light, const mat4 &view, const mat4 &projection, float zNear, float zFar, Range &range) const;
+};
+#endif
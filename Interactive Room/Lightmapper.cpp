@@ -0,0 +1,299 @@
+#include "Lightmapper.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const unsigned int LEAF_SIZE = 4;
+	//rays start this far off the surface, so a texel doesn't shadow itself
+	const float SURFACE_OFFSET = 0.02f;
+
+	//Moller-Trumbore, hit strictly between the ends of the segment
+	bool crosses(const vec3 &origin, const vec3 &direction, float length, const vec3 &a, const vec3 &b, const vec3 &c)
+	{
+		vec3 edge1 = b - a;
+		vec3 edge2 = c - a;
+		vec3 p = cross(direction, edge2);
+		float determinant = dot(edge1, p);
+		if (fabs(determinant) < 1e-9f)
+		{
+			return false;
+		}
+		float inverse = 1.0f / determinant;
+		vec3 t = origin - a;
+		float u = dot(t, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+		{
+			return false;
+		}
+		vec3 q = cross(t, edge1);
+		float v = dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+		float distance = dot(edge2, q) * inverse;
+		return distance > 0.0f && distance < length;
+	}
+
+	//slab test of a segment against a box
+	bool crossesBox(const vec3 &origin, const vec3 &inverseDirection, float length, const vec3 &boxMin, const vec3 &boxMax)
+	{
+		vec3 t1 = (boxMin - origin) * inverseDirection;
+		vec3 t2 = (boxMax - origin) * inverseDirection;
+		vec3 lower = min(t1, t2), upper = max(t1, t2);
+		float enter = max(max(lower.x, lower.y), max(lower.z, 0.0f));
+		float leave = min(min(upper.x, upper.y), min(upper.z, length));
+		return enter <= leave;
+	}
+}
+
+void Lightmapper::addOccluders(const std::vector<vec3> &corners)
+{
+	occluders.insert(occluders.end(), corners.begin(), corners.end());
+}
+
+void Lightmapper::build()
+{
+	PROFILE_ZONE("Lightmapper::build");
+	nodes.clear();
+	order.clear();
+	unsigned int count = occluderCount();
+	if (count == 0)
+	{
+		return;
+	}
+	std::vector<vec3> centers(count);
+	order.reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		centers[i] = (occluders[3 * i] + occluders[3 * i + 1] + occluders[3 * i + 2]) / 3.0f;
+		order.push_back(i);
+	}
+	nodes.reserve(2 * count / LEAF_SIZE + 1);
+	buildNode(centers, 0, count);
+}
+
+//Splits the triangles at the median of the longest axis of their centers, as CollisionMesh does
+unsigned int Lightmapper::buildNode(const std::vector<vec3> &centers, unsigned int first, unsigned int count)
+{
+	Node node;
+	node.boxMin = occluders[3 * order[first]];
+	node.boxMax = node.boxMin;
+	vec3 centerMin = centers[order[first]], centerMax = centerMin;
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		for (unsigned int j = 0; j < 3; j++)
+		{
+			node.boxMin = min(node.boxMin, occluders[3 * order[i] + j]);
+			node.boxMax = max(node.boxMax, occluders[3 * order[i] + j]);
+		}
+		centerMin = min(centerMin, centers[order[i]]);
+		centerMax = max(centerMax, centers[order[i]]);
+	}
+	node.left = node.right = 0;
+	node.first = first;
+	node.count = count;
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(node);
+
+	if (count <= LEAF_SIZE)
+	{
+		return index;
+	}
+
+	vec3 extent = centerMax - centerMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	unsigned int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[&centers, axis](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+
+	unsigned int left = buildNode(centers, first, half);
+	unsigned int right = buildNode(centers, first + half, count - half);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+bool Lightmapper::occluded(const vec3 &from, const vec3 &to) const
+{
+	if (nodes.empty())
+	{
+		return false;
+	}
+	vec3 direction = to - from;
+	float length = glm::length(direction);
+	if (length <= 0.0f)
+	{
+		return false;
+	}
+	direction /= length;
+	vec3 inverseDirection = 1.0f / direction;
+	unsigned int stack[64];
+	unsigned int size = 0;
+	stack[size++] = 0;
+	while (size > 0)
+	{
+		const Node &node = nodes[stack[--size]];
+		if (!crossesBox(from, inverseDirection, length, node.boxMin, node.boxMax))
+		{
+			continue;
+		}
+		if (node.count > 0)
+		{
+			for (unsigned int i = node.first; i < node.first + node.count; i++)
+			{
+				const vec3* triangle = &occluders[3 * order[i]];
+				if (crosses(from, direction, length, triangle[0], triangle[1], triangle[2]))
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			stack[size++] = node.left;
+			stack[size++] = node.right;
+		}
+	}
+	return false;
+}
+
+//Shelf packing, the cells sorted from the largest
+bool Lightmapper::pack(const std::vector<unsigned int> &sizes, std::vector<uvec2> &cells, unsigned int &width, unsigned int &height)
+{
+	std::vector<unsigned int> bySize(sizes.size());
+	unsigned long long area = 0;
+	for (unsigned int i = 0; i < sizes.size(); i++)
+	{
+		bySize[i] = i;
+		area += (unsigned long long)sizes[i] * sizes[i];
+	}
+	std::sort(bySize.begin(), bySize.end(), [&sizes](unsigned int a, unsigned int b) { return sizes[a] > sizes[b]; });
+
+	width = MAX_CELL;
+	while (width < MAX_SIZE && (unsigned long long)width * width < area)
+	{
+		width *= 2;
+	}
+	cells.resize(sizes.size());
+	unsigned int x = 0, y = 0, shelf = 0;
+	for (unsigned int i = 0; i < bySize.size(); i++)
+	{
+		unsigned int size = sizes[bySize[i]];
+		if (x + size > width)
+		{
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		cells[bySize[i]] = uvec2(x, y);
+		x += size;
+		shelf = max(shelf, size);
+	}
+	height = (y + shelf + 3) / 4 * 4;
+	return height <= MAX_SIZE;
+}
+
+void Lightmapper::bake(const std::vector<vec3> &corners, const std::vector<vec3> &normals, const std::vector<PointLight> &lights, Lightmap &lightmap) const
+{
+	PROFILE_ZONE("Lightmapper::bake");
+	unsigned int triangleCount = (unsigned int)(corners.size() / 3);
+	lightmap = Lightmap();
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	//cell of each triangle, by the side of the square its area would make
+	std::vector<unsigned int> sizes(triangleCount);
+	std::vector<uvec2> cells;
+	float texel = TEXEL;
+	for (;;)
+	{
+		bool smallest = true;
+		for (unsigned int i = 0; i < triangleCount; i++)
+		{
+			float area = 0.5f * length(cross(corners[3 * i + 1] - corners[3 * i], corners[3 * i + 2] - corners[3 * i]));
+			float side = std::ceil(std::sqrt(2.0f * area) / texel) + 2.0f;
+			sizes[i] = (unsigned int)clamp(side, (float)MIN_CELL, (float)MAX_CELL);
+			smallest = smallest && sizes[i] == MIN_CELL;
+		}
+		if (pack(sizes, cells, lightmap.width, lightmap.height))
+		{
+			break;
+		}
+		//too many triangles for one atlas even at the smallest cells, the mesh stays dynamically lit
+		if (smallest)
+		{
+			lightmap = Lightmap();
+			return;
+		}
+		texel *= 2.0f;
+	}
+
+	lightmap.texels.assign((size_t)lightmap.width * lightmap.height * 4, 0.0f);
+	lightmap.coords.resize(corners.size());
+	unsigned int baked = (unsigned int)min((size_t)CHANNELS, lights.size());
+
+	JobSystem::getInstance()->parallelFor(0, triangleCount, 16, [&](unsigned int first, unsigned int last)
+	{
+		for (unsigned int i = first; i < last; i++)
+		{
+			//the triangle is the lower left half of its cell, a texel inside the border: A at the origin, B along x, C along y
+			unsigned int size = sizes[i];
+			vec2 origin = vec2(cells[i]) + vec2(1.0f);
+			float span = (float)(size - 2);
+			vec2 scale(1.0f / lightmap.width, 1.0f / lightmap.height);
+			lightmap.coords[3 * i] = origin * scale;
+			lightmap.coords[3 * i + 1] = (origin + vec2(span, 0.0f)) * scale;
+			lightmap.coords[3 * i + 2] = (origin + vec2(0.0f, span)) * scale;
+
+			const vec3* corner = &corners[3 * i];
+			const vec3* normal = &normals[3 * i];
+			//every texel of the cell is lit, those past the triangle at its closest point, so filtering never reads black
+			for (unsigned int y = 0; y < size; y++)
+			{
+				for (unsigned int x = 0; x < size; x++)
+				{
+					vec2 barycentric = (vec2((float)x, (float)y) + vec2(0.5f) - vec2(1.0f)) / span;
+					barycentric = max(barycentric, vec2(0.0f));
+					float sum = barycentric.x + barycentric.y;
+					if (sum > 1.0f)
+					{
+						barycentric /= sum;
+					}
+					vec3 position = corner[0] + barycentric.x * (corner[1] - corner[0]) + barycentric.y * (corner[2] - corner[0]);
+					vec3 surfaceNormal = normal[0] + barycentric.x * (normal[1] - normal[0]) + barycentric.y * (normal[2] - normal[0]);
+					float normalLength = length(surfaceNormal);
+					if (normalLength <= 0.0f)
+					{
+						continue;
+					}
+					surfaceNormal /= normalLength;
+					float* texelValue = &lightmap.texels[(((size_t)cells[i].y + y) * lightmap.width + cells[i].x + x) * 4];
+
+					for (unsigned int l = 0; l < baked; l++)
+					{
+						const PointLight &light = lights[l];
+						if (any(lessThan(position, light.boundsMin)) || any(greaterThan(position, light.boundsMax)))
+						{
+							continue;
+						}
+						vec3 toLight = light.position - position;
+						float distance = length(toLight);
+						float diffuse = distance > 0.0f ? dot(surfaceNormal, toLight / distance) : 0.0f;
+						if (diffuse <= 0.0f || occluded(position + surfaceNormal * SURFACE_OFFSET, light.position))
+						{
+							continue;
+						}
+						texelValue[l] = diffuse / (1.0f + light.attenuation * distance * distance);
+					}
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,67 @@
+#ifndef LIGHTMAPPER_H
+#define LIGHTMAPPER_H
+#include "glm.hpp"
+#include "LightClusters.h"
+#include <vector>
+
+using namespace glm;
+
+//Lighting baked for one mesh: an atlas with one light per channel, and where each corner of its triangles falls in it
+struct Lightmap
+{
+	unsigned int width = 0, height = 0;
+	//RGBA per texel, channel i is the contribution of light i
+	std::vector<float> texels;
+	//atlas coordinates of each corner, 3 per triangle
+	std::vector<vec2> coords;
+
+	bool empty() const { return texels.empty(); }
+};
+
+//CPU lightmap baker for geometry that never moves. Each triangle gets its own square cell in its mesh's atlas,
+//sized by its area; every texel of the cell is lit by the first CHANNELS lights, with attenuation, N.L, the light's
+//room bounds and shadows from rays cast against the occluders. The triangles of a mesh are baked on the job system
+class Lightmapper
+{
+public:
+	//lights baked, one per channel
+	static const unsigned int CHANNELS = 4;
+	//world units a texel covers at first, doubled (coarser) until a mesh's atlas fits MAX_SIZE
+	static constexpr float TEXEL = 0.25f;
+	static const unsigned int MAX_SIZE = 2048;
+	//smallest and largest cell side, in texels, including the texel of padding around the triangle
+	static const unsigned int MIN_CELL = 4;
+	static const unsigned int MAX_CELL = 64;
+
+	//adds triangles that block the light, 3 world space corners per triangle
+	void addOccluders(const std::vector<vec3> &corners);
+	//indexes the occluders, before any bake
+	void build();
+
+	//bakes a triangle soup (3 world space corners and normals per triangle) into lightmap
+	void bake(const std::vector<vec3> &corners, const std::vector<vec3> &normals, const std::vector<PointLight> &lights, Lightmap &lightmap) const;
+
+	//whether an occluder crosses the segment
+	bool occluded(const vec3 &from, const vec3 &to) const;
+
+	unsigned int occluderCount() const { return (unsigned int)(occluders.size() / 3); }
+
+private:
+	struct Node
+	{
+		vec3 boxMin;
+		vec3 boxMax;
+		//children for inner nodes, range in order for leaves
+		unsigned int left, right;
+		unsigned int first, count;
+	};
+	std::vector<vec3> occluders;
+	std::vector<Node> nodes;
+	//occluder indices sorted so every leaf is a contiguous range
+	std::vector<unsigned int> order;
+
+	unsigned int buildNode(const std::vector<vec3> &centers, unsigned int first, unsigned int count);
+	//places the cells of the triangles, returns false if they don't fit MAX_SIZE at this texel size
+	static bool pack(const std::vector<unsigned int> &sizes, std::vector<uvec2> &cells, unsigned int &width, unsigned int &height);
+};
+#endif
@@ -1,33 +1,57 @@
 //glew, glfw, glm
 #include "glew.h"
+#include "gl_stats.h"
 #include "glfw3.h"
 #include "glm.hpp"
 //custom classes
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "simulation.h"
+#include "Profiler.h"
+#include "Memory.h"
+#include "gpu_timers.h"
+#include "instancing.h"
+#include "clustered_lighting.h"
+#include "gbuffer.h"
+#include "shadow_maps.h"
+#include "transparency_buffer.h"
+#include "RenderOnDemand.h"
+#include "draw_cache.h"
 
 #include <iostream>
+#include <cstring>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void cursor_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void processInput(GLFWwindow *window);
+void refresh_callback(GLFWwindow* window);
+bool processInput(GLFWwindow *window);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void selectObject(double x, double y);
 GLuint loadCubeMap(vector<string> faces);
 void loadSkybox();
 void drawSkybox();
+void drawDepthPrepass(int modelCount, int firstTransparent, InstanceBatcher* batcher);
+void depthTestEqual(bool equal);
+float gpuFrameMilliseconds();
+void drawTransparent(int modelCount, int firstTransparent, InstanceBatcher* batcher);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 int width, height;
 const float scaling = 0.02f;
+//depth range of the projection, the light clusters are sliced over it
+const float zNear = 0.1f;
+const float zFar = 100.0f;
 
 // camera
 Camera camera(scaling * glm::vec3(2280, 260, -121.5f));
+// input, collision and transforms at a fixed tick, on their own thread
+Simulation simulation(camera);
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 
@@ -44,21 +68,65 @@ Model *selected;
 //for some reason C++ wants other classes' static datatypes to be declared globally if we're going to use them.
 // who the f made that design decision???
 vector<Model*> Model::models;
+map<string, ImportedModel*> Model::imports;
+map<string, Texture> Model::textureCache;
+multimap<unsigned long long, MeshBuffers> Mesh::sharedBuffers;
+ObjectTransforms Model::transforms;
 
 //shader pointers to switch between shaders in functions
 Shader* general;
 Shader* selection;
 Shader* skybox_shader;
+Shader* depth_shader;
 //boolean determining whether an object is selected or not
 bool isSelected;
-//booleans to switch light on/off
-bool bed = true, liv = true, kich = true;
+//the lamps, L switches the group of the room the camera is in
+enum LightGroup { KITCHEN_LIGHTS, LIVING_LIGHTS, BED_LIGHTS };
+vector<PointLight> lights;
+//lights of each cluster of the view, built on the CPU every frame and read by the general shader
+LightClusters lightClusters;
+ClusteredLighting clusteredLighting;
+const unsigned int MAX_LIGHTS = 256;
+//B switches the opaque models between forward shading and the G-buffer and lighting passes
+bool deferred = false;
+GBuffer gBuffer;
+//Z draws the depth of the opaque models first, the main pass then only shades the fragments that stay visible
+bool depthPrepass = false;
+//cube map shadows of the lamps, only redrawn when something moves near them
+ShadowMaps shadowMaps;
+//the transparent models, averaged in one unsorted pass whatever their order
+TransparencyBuffer transparencyBuffer;
+//E (or --on-demand) only draws the frames where something changed, the loop sleeps in between
+RenderOnDemand onDemand;
 
 //Skybox objects
 GLuint skyboxVAO, skyboxVBO, skyboxEBO, skyboxCubemap;
 
-int main()
+//GPU time of the render passes, read back a few frames late
+GpuTimers gpuTimers;
+//draws the meshes several models share in one go, per pass
+InstanceBatcher instanceBatcher;
+//the draw commands of the models and the meshes in view, kept between frames
+DrawCache drawCache;
+//models drawn this frame, the simulation thread may be adding spawned ones to Model::models
+unsigned int drawnModels = 0;
+//N asks the render loop for a copy of the selected object
+bool spawnRequested = false;
+
+//--allocation-test: after the warm-up frames, any heap allocation on the render or simulation thread fails the run
+const unsigned int WARMUP_FRAMES = 120;
+const unsigned int TEST_FRAMES = 600;
+
+int main(int argc, char** argv)
 {
+	bool allocationTest = argc > 1 && strcmp(argv[1], "--allocation-test") == 0;
+	bool allocationFailed = false;
+	//the allocation test counts frames, they are all drawn
+	for (int i = 1; i < argc && !allocationTest; i++) {
+		if (strcmp(argv[i], "--on-demand") == 0)
+			onDemand.setEnabled(true, 0.0);
+	}
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
@@ -81,6 +149,7 @@ int main()
 	glfwSetCursorPosCallback(window, cursor_callback);
 	glfwSetScrollCallback(window, scroll_callback);
 	glfwSetKeyCallback(window, key_callback);
+	glfwSetWindowRefreshCallback(window, refresh_callback);
 
 	// tell GLFW to capture our mouse
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
@@ -112,31 +181,70 @@ int main()
 	//shaders
 	Shader generalShader("Shaders/general_vert.shader", "Shaders/general_frag.shader");
 	general = &generalShader;
+	instanceBatcher.shader = general;
 	Shader selectionShader("Shaders/selection_vert.shader", "Shaders/selection_frag.shader");
 	selection = &selectionShader;
 	Shader skyBoxShader("Shaders/skybox_vertex.shader", "Shaders/skybox_fragment.shader");
 	skybox_shader = &skyBoxShader;
+	//the deferred path: opaque models into the G-buffer, then one lighting pass over the screen
+	Shader gBufferShader("Shaders/general_vert.shader", "Shaders/gbuffer_frag.shader");
+	Shader deferredShader("Shaders/deferred_vert.shader", "Shaders/deferred_frag.shader");
+	gBuffer.create(deferredShader);
+	//the depth pre-pass and the selection passes only read positions, meshes draw them from their position stream
+	Shader depthShader("Shaders/depth_vert.shader", "Shaders/depth_frag.shader");
+	depth_shader = &depthShader;
+	depthShader.positionsOnly = true;
+	selectionShader.positionsOnly = true;
+	Shader shadowShader("Shaders/shadow_vert.shader", "Shaders/shadow_frag.shader");
+	shadowShader.positionsOnly = true;
+	//blends the transparent pass over the frame, from the same full screen triangle as the deferred lighting
+	Shader compositeShader("Shaders/deferred_vert.shader", "Shaders/composite_frag.shader");
+	transparencyBuffer.create(compositeShader);
+	//the model shaders read the drawn object's matrices from the same records
+	Model::transforms.create(Model::MAX_MODELS);
+	generalShader.bindUniformBlock("Object", ObjectTransforms::BINDING);
+	selectionShader.bindUniformBlock("Object", ObjectTransforms::BINDING);
+	gBufferShader.bindUniformBlock("Object", ObjectTransforms::BINDING);
+	depthShader.bindUniformBlock("Object", ObjectTransforms::BINDING);
+	shadowShader.bindUniformBlock("Object", ObjectTransforms::BINDING);
 
-	generalShader.use();
-	// scaled light positions
-	// ----------------------
-	glm::vec3 livLamp1 = scaling * glm::vec3(2066.43f, 375.f, -693.06f);
-	glm::vec3 livLamp2 = scaling * glm::vec3(2608.79f, 375.f, -692.68f);
-	glm::vec3 bedLamp = scaling * glm::vec3(2308.93f, 375.f, -1994.81f);
-	glm::vec3 kitchLamp = scaling * glm::vec3(765.54f, 375.f, -670.18f);
-	generalShader.setVec3("livLamp1", livLamp1);
-	generalShader.setVec3("livLamp2", livLamp2);
-	generalShader.setVec3("bedLamp", bedLamp);
-	generalShader.setVec3("kitchLamp", kitchLamp);
-	generalShader.setBool("kichOn", kich);
-	generalShader.setBool("bedOn", bed);
-	generalShader.setBool("livOn", liv);
+	// scaled light positions, each lamp lights its own room only
+	// ----------------------------------------------------------
+	const float margin = scaling * 50, outside = 1e4f;
+	glm::vec3 kitchenMin(-outside), kitchenMax(scaling * 1545 + margin, outside, outside);
+	glm::vec3 livingMin(scaling * 1545 - margin, -outside, -scaling * 1400 - margin), livingMax(outside);
+	glm::vec3 bedMin(scaling * 1545 - margin, -outside, -outside), bedMax(outside, outside, -scaling * 1400 + margin);
+	lights.reserve(MAX_LIGHTS);
+	lights.push_back({ scaling * glm::vec3(2066.43f, 375.f, -693.06f), glm::vec3(1), 0.002f, livingMin, livingMax, LIVING_LIGHTS, true, -1 });
+	lights.push_back({ scaling * glm::vec3(2608.79f, 375.f, -692.68f), glm::vec3(1), 0.002f, livingMin, livingMax, LIVING_LIGHTS, true, -1 });
+	lights.push_back({ scaling * glm::vec3(2308.93f, 375.f, -1994.81f), glm::vec3(1), 0.002f, bedMin, bedMax, BED_LIGHTS, true, -1 });
+	lights.push_back({ scaling * glm::vec3(765.54f, 375.f, -670.18f), glm::vec3(1), 0.002f, kitchenMin, kitchenMax, KITCHEN_LIGHTS, true, -1 });
+	clusteredLighting.create(MAX_LIGHTS);
+	clusteredLighting.setup(generalShader, zNear, zFar);
+	clusteredLighting.setup(deferredShader, zNear, zFar);
+	shadowMaps.create(shadowShader, lights, zFar, Model::MAX_MODELS);
+	shadowMaps.setup(generalShader);
+	shadowMaps.setup(deferredShader);
 
 	//Load the skybox
 	loadSkybox();
 
 	//number of objects to load, hard-coded
 	int objNum = 28;
+	//spawned models are added while the render thread reads the list, it must never reallocate
+	Model::models.reserve(Model::MAX_MODELS);
+	//import every model on the job system, each constructor below then waits for its own and uploads it
+	Model::preload({
+		"Models/bed/bed.obj", "Models/bed/ironman.obj", "Models/bed/wardrobe.obj", "Models/bed/nightstand.obj", "Models/bed/phone.obj",
+		"Models/kitchen/kitchen.obj", "Models/kitchen/kitchen table.obj", "Models/kitchen/chair 1.obj", "Models/kitchen/chair 2.obj",
+		"Models/kitchen/chair 3.obj", "Models/kitchen/chair 4.obj", "Models/kitchen/kettle.obj", "Models/kitchen/gun.obj",
+		"Models/kitchen/apples.obj", "Models/living/TV.obj", "Models/living/couch.obj", "Models/living/coffee table.obj",
+		"Models/living/table plant.obj", "Models/living/tray.obj", "Models/living/laptop.obj", "Models/living/indoor plant.obj",
+		"Models/living/dragon.obj", "Models/house/house.obj", "Models/house/lamps.obj", "Models/kitchen/blender.obj",
+		"Models/living/glass 1.obj", "Models/living/glass 2.obj", "Models/house/windows.obj"
+	});
+	//the house shell never moves, the lamps are baked into it while the other models import
+	Model::bakeLightmaps({ "Models/kitchen/kitchen.obj", "Models/house/house.obj" }, lights, scaling);
 	//bedroom
 	Model bed("Models/bed/bed.obj");
 	cout << "bed loaded,\t\tposition -> " << bed.displacement().x << " : " << bed.displacement().y << " : " << bed.displacement().z << ".\t\t";
@@ -230,11 +338,33 @@ int main()
 	Model windows("Models/house/windows.obj");
 	cout << "windows loaded,\t\tposition -> " << windows.displacement().x << " : " << windows.displacement().y << " : " << windows.displacement().z << ".\t\t";
 	cout << "Objects left: " << --objNum << endl;
+	//what importing and uploading the models cost the heap, see MemoryTracker
+	const MemoryTracker::Counters &loading = MemoryTracker::getTagCounters(MEMORY_LOADING);
+	cout << "Models loaded with " << loading.allocations << " heap allocations, " << loading.totalBytes / (1024 * 1024) << " MB allocated, "
+		<< loading.peakBytes / (1024 * 1024) << " MB at the peak, SOIL and Assimp's own allocations not included" << endl;
+	size_t geometryCpu = 0, geometryGpu = 0;
+	for (unsigned int i = 0; i < Model::models.size(); i++) {
+		geometryCpu += Model::models[i]->cpuBytes();
+		geometryGpu += Model::models[i]->gpuBytes();
+	}
+	cout << "Models hold " << geometryCpu / (1024 * 1024) << " MB in RAM and " << geometryGpu / (1024 * 1024) << " MB on the GPU" << endl;
+
+	//collision layers of the room, shared with the collision benchmark
+	for (unsigned int i = 0; i < Model::models.size(); i++) {
+		const SceneCollision* collision = findSceneCollision(Model::models[i]->getPath());
+		if (!collision)
+			continue;
+		Model::models[i]->setCollisionLayer(collision->layer);
+		Model::models[i]->setCollisionBlocks(collision->blocks);
+	}
+	//bake the static models for camera collision, in the background
+	CollisionManager::getInstance()->buildStaticField("Models/house/static.sdf");
 
 	//sets the shader that each model is going to use.
+	//Shifts and rotations happen on the simulation thread, relative to its camera
 	for (int i = 0; i < Model::models.size(); ++i) {
 		(*(Model::models[i])).setShader(general);
-		(*(Model::models[i])).setCamera(&camera);
+		(*(Model::models[i])).setCamera(&simulation.body);
 	}
 
 	//set clear color
@@ -244,133 +374,431 @@ int main()
 	float lastFrame = 0.0f;
 	float currentFrame = 0.0f;
 
+	//transforms interpolated between simulation ticks
+	glm::vec3 cameraPosition;
+	vector<glm::mat4> modelMatrices;
+	//the transparent models were loaded last, they are drawn in their own pass
+	const int firstTransparent = lamps.ID - 1;
+	for (unsigned int i = firstTransparent; i < Model::models.size(); i++)
+		(*(Model::models[i])).transparent = true;
+	//the window title shows the GPU timings while the overlay is on
+	float lastTitle = 0.0f;
+	//models loaded or spawned, including spawns the simulation hasn't tracked yet
+	unsigned int modelsCreated = Model::models.size();
+	//copies spawned with N, the loaded models live on the stack
+	vector<unique_ptr<Model>> spawnedModels;
+	simulation.start();
+
+	Profiler::setThreadName("render");
+	MemoryTracker::setThreadName("render");
+	unsigned int frameNumber = 0;
+
 	// game loop
 	// -----------
 	while (!glfwWindowShouldClose(window))
 	{
+		PROFILE_ZONE("frame");
+		MemoryScope tag(MEMORY_RENDER);
+		bool steady = allocationTest && frameNumber >= WARMUP_FRAMES;
+		if (steady && frameNumber == WARMUP_FRAMES)
+			simulation.guardTicks(true);
+		MemoryTracker::guard(steady);
 		// per-frame time logic
 		// --------------------
 		currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
-		// input
-		// -----
-		processInput(window);
-		glfwPollEvents();
+		// input, handed to the simulation thread. On demand, the loop sleeps once a frame had nothing new to draw
+		// ------------------------------------------------------------------------------------------------------
+		if (onDemand.shouldWait()) {
+			PROFILE_ZONE("wait events");
+			double asleep = glfwGetTime();
+			glfwWaitEventsTimeout(onDemand.waitTimeout());
+			onDemand.addSleep(glfwGetTime() - asleep);
+		}
+		else
+			glfwPollEvents();
+		onDemand.setInputHeld(processInput(window));
+
+		// interpolate the simulation state
+		// --------------------------------
+		simulation.interpolate(cameraPosition, modelMatrices);
+		camera.Position = cameraPosition;
+		//only the models the simulation has published a transform for are drawn
+		unsigned int modelCount = modelMatrices.size();
+		if (modelCount != drawnModels)
+			onDemand.request();
+		drawnModels = modelCount;
+		for (int i = 0; i < modelCount; ++i) {
+			if ((*(Model::models[i])).setRenderMatrix(modelMatrices[i])) {
+				shadowMaps.moved(i, *(Model::models[i]), lights);
+				drawCache.moved(i);
+				onDemand.request();
+			}
+		}
+
+		// copy of the selected object next to it, without loading anything
+		// -------------------------------------------------------------------
+		if (spawnRequested) {
+			spawnRequested = false;
+			if (isSelected && modelsCreated < Model::MAX_MODELS) {
+				glm::vec3 offset = camera.Right * (2.0f * selected->objectElipse.x + scaling * 20);
+				spawnedModels.emplace_back(new Model(*selected, offset));
+				Model* spawned = spawnedModels.back().get();
+				spawned->setShader(general);
+				spawned->setCamera(&simulation.body);
+				simulation.post([spawned] { spawned->track(); });
+				modelsCreated++;
+				cout << "Spawned a copy of " << selected->getPath() << endl;
+			}
+		}
 
 		// update view and projection
 		// --------------------------
 		view = camera.GetViewMatrix();
-		projection = glm::perspective(glm::radians(camera.Zoom), (float)width / (float)height, 0.1f, 100.0f);
+		projection = glm::perspective(glm::radians(camera.Zoom), (float)width / (float)height, zNear, zFar);
+
+		// on demand, a frame with nothing new isn't drawn and the last one stays on screen
+		// --------------------------------------------------------------------------------
+		if (!onDemand.beginFrame(projection * view))
+			continue;
+		gpuTimers.beginFrame();
 
 		// update shaders with view and projection
 		// ---------------------------------------
-		skyBoxShader.use();
-		skyBoxShader.setMat4("projection", projection);
-		skyBoxShader.setMat4("view", view);
-		skyBoxShader.setMat4("model", glm::translate(glm::mat4(1.0), camera.getPosition()));
-		generalShader.use();
-		generalShader.setMat4("projection", projection);
-		generalShader.setMat4("view", view);
-		if (isSelected) {
-			selectionShader.use();
-			selectionShader.setMat4("projection", projection);
-			selectionShader.setMat4("view", view);
+		{
+			PROFILE_ZONE("uniform upload");
+			skyBoxShader.use();
+			skyBoxShader.setMat4("projection", projection);
+			skyBoxShader.setMat4("view", view);
+			skyBoxShader.setMat4("model", glm::translate(glm::mat4(1.0), camera.getPosition()));
+			generalShader.use();
+			generalShader.setMat4("viewProjection", projection * view);
+			generalShader.setVec2("tileSize", (float)width / LightClusters::TILES_X, (float)height / LightClusters::TILES_Y);
+			glm::vec4 bakedOn(0);
+			for (unsigned int i = 0; i < Lightmapper::CHANNELS && i < lights.size(); i++)
+				bakedOn[i] = lights[i].on ? 1.0f : 0.0f;
+			generalShader.setVec4("bakedOn", bakedOn);
+			if (isSelected) {
+				selectionShader.use();
+				selectionShader.setMat4("viewProjection", projection * view);
+			}
+			if (depthPrepass) {
+				depthShader.use();
+				depthShader.setMat4("viewProjection", projection * view);
+			}
+			if (deferred) {
+				gBufferShader.use();
+				gBufferShader.setMat4("viewProjection", projection * view);
+				deferredShader.use();
+				deferredShader.setVec2("tileSize", (float)width / LightClusters::TILES_X, (float)height / LightClusters::TILES_Y);
+			}
+			//the records of the models that moved since the last frame
+			Model::transforms.upload();
+		}
+
+		// assign the lights to the clusters of this view
+		// ----------------------------------------------
+		{
+			PROFILE_ZONE("light clusters");
+			lightClusters.build(lights, view, projection, zNear, zFar);
+			clusteredLighting.upload(lights, lightClusters);
+		}
+
+		// redraw the shadow maps of the lights something moved near, none on a steady frame
+		// -----------------------------------------------------------------------------------
+		if (shadowMaps.pending(lights)) {
+			gpuTimers.begin("shadows");
+			shadowMaps.update(lights, modelCount);
+			gpuTimers.end();
 		}
 
 		// render
 		// ------
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		//skybox.draw();
+		gpuTimers.begin("skybox");
 		drawSkybox();
+		gpuTimers.end();
+
+		glm::mat4 viewProjection = projection * view;
+		//only the models that moved are culled again, unless the view changed
+		drawCache.cull(viewProjection, modelCount);
+		if (deferred) {
+			PROFILE_ZONE("draw deferred");
+			InstanceBatcher* batcher = gpuTimers.perModel ? nullptr : &instanceBatcher;
+			//the opaque models drawn with the general shader go to the G-buffer, the selected one keeps its highlight
+			gpuTimers.begin("gbuffer");
+			gBuffer.resize(width, height);
+			gBuffer.beginGeometry();
+			if (depthPrepass) {
+				gpuTimers.begin("depth prepass");
+				drawDepthPrepass(modelCount, firstTransparent, batcher);
+				gpuTimers.end();
+				depthTestEqual(true);
+			}
+			instanceBatcher.shader = &gBufferShader;
+			for (int i = 0; i < modelCount && i < firstTransparent; ++i) {
+				if ((*(Model::models[i])).getShader() != general)
+					continue;
+				if (gpuTimers.perModel)
+					gpuTimers.begin((*(Model::models[i])).getPath());
+				drawCache.draw(i, batcher, &gBufferShader);
+				if (gpuTimers.perModel)
+					gpuTimers.end();
+			}
+			instanceBatcher.flush();
+			instanceBatcher.shader = general;
+			if (depthPrepass)
+				depthTestEqual(false);
+			gBuffer.endGeometry();
+			gpuTimers.end();
+
+			gpuTimers.begin("lighting");
+			gBuffer.light(viewProjection);
+			gpuTimers.end();
+
+			//the selected and spawned models forward on top, depth tested against the opaque models
+			gpuTimers.begin("forward");
+			for (int i = 0; i < modelCount; ++i) {
+				if ((i < firstTransparent || (*(Model::models[i])).transparent) && (*(Model::models[i])).getShader() == general)
+					continue;
+				if (gpuTimers.perModel)
+					gpuTimers.begin((*(Model::models[i])).getPath());
+				drawCache.draw(i, batcher);
+				if (gpuTimers.perModel)
+					gpuTimers.end();
+			}
+			instanceBatcher.flush();
+			gpuTimers.end();
+			drawTransparent(modelCount, firstTransparent, batcher);
+		}
+		else {
+			PROFILE_ZONE("draw");
+			//timing each model needs its meshes drawn with it, not batched at the end of the pass
+			InstanceBatcher* batcher = gpuTimers.perModel ? nullptr : &instanceBatcher;
+			if (depthPrepass) {
+				gpuTimers.begin("depth prepass");
+				drawDepthPrepass(modelCount, firstTransparent, batcher);
+				gpuTimers.end();
+				depthTestEqual(true);
+			}
+			gpuTimers.begin("opaque");
+			for (int i = 0; i < modelCount; ++i) {
+				if (i == firstTransparent && depthPrepass) {
+					instanceBatcher.flush();
+					depthTestEqual(false);
+				}
+				//drawn after the opaque ones, in the weighted blended pass
+				if ((*(Model::models[i])).transparent && (*(Model::models[i])).getShader() == general)
+					continue;
+				//the selected model isn't in the pre-pass, it is tested as usual
+				bool ownDepth = depthPrepass && i < firstTransparent && (*(Model::models[i])).getShader() != general;
+				if (ownDepth)
+					depthTestEqual(false);
+				if (gpuTimers.perModel)
+					gpuTimers.begin((*(Model::models[i])).getPath());
+				drawCache.draw(i, batcher);
+				if (gpuTimers.perModel)
+					gpuTimers.end();
+				if (ownDepth)
+					depthTestEqual(true);
+			}
+			instanceBatcher.flush();
+			if (depthPrepass)
+				depthTestEqual(false);
+			gpuTimers.end();
+			drawTransparent(modelCount, firstTransparent, batcher);
+		}
 
-		for (int i = 0; i < Model::models.size(); ++i) {
-			(*(Model::models[i])).Draw();
+		if (gpuTimers.overlay) {
+			gpuTimers.drawOverlay(width, height);
+			if (currentFrame - lastTitle > 0.5f) {
+				lastTitle = currentFrame;
+				glfwSetWindowTitle(window, ("House - GPU " + gpuTimers.summary()).c_str());
+			}
 		}
+		gpuTimers.endFrame();
+		GlStats::get().endFrame();
 
 		// glfw: swap buffers
 		// ------------------
-		glfwSwapBuffers(window);
+		{
+			PROFILE_ZONE("swap");
+			glfwSwapBuffers(window);
+		}
+
+		MemoryTracker::guard(false);
+		if (steady && MemoryTracker::getViolations() > 0 && !allocationFailed) {
+			cout << "Allocation test failed on frame " << frameNumber << ": ";
+			MemoryTracker::printViolation();
+			allocationFailed = true;
+			glfwSetWindowShouldClose(window, true);
+		}
+		if (allocationTest && ++frameNumber == WARMUP_FRAMES + TEST_FRAMES && !allocationFailed) {
+			cout << "Allocation test passed: no heap allocations in " << TEST_FRAMES << " steady-state frames" << endl;
+			glfwSetWindowShouldClose(window, true);
+		}
 	}
 
+	//the simulation uses the models, stop it before they go out of scope
+	simulation.stop();
+	spawnedModels.clear();
+	//a profile still being recorded is saved on exit
+	if (Profiler::isEnabled() && Profiler::dump("profile.json"))
+		cout << "Profile saved to profile.json" << endl;
+	if (onDemand.isEnabled())
+		onDemand.printReport(glfwGetTime(), gpuFrameMilliseconds());
+
+	gpuTimers.release();
+	Model::transforms.release();
+	instanceBatcher.release();
+	clusteredLighting.release();
+	gBuffer.release();
+	transparencyBuffer.release();
+	shadowMaps.release();
+
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
-	return 0;
+	return allocationFailed ? 1 : 0;
 }
 
 //determines whether rotating or shifting
 bool rotating = false;
-// process all input that needs instant and continuous response
-// ------------------------------------------------------------
-void processInput(GLFWwindow *window)
+// samples the keys that need continuous response for the simulation thread, returns whether one is held
+// -----------------------------------------------------------------------------------------------------
+bool processInput(GLFWwindow *window)
 {
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessMovement(MOVE_FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessMovement(MOVE_BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessMovement(MOVE_LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessMovement(MOVE_RIGHT, deltaTime);
-	if (isSelected)
-	{
-		if (rotating)
-		{
-			if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_UP_LEFT);
-			if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_UP_RIGHT);
-			if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_UP);
-			if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_DOWN);
-			if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_LEFT);
-			if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-				(*selected).rotate(ROTATE_RIGHT);
-		}
-		else
-		{
-			if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
-				(*selected).shift(SHIFT_UP);
-			if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
-				(*selected).shift(SHIFT_DOWN);
-			if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-				(*selected).shift(SHIFT_FORWARD);
-			if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-				(*selected).shift(SHIFT_BACKWARD);
-			if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-				(*selected).shift(SHIFT_LEFT);
-			if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-				(*selected).shift(SHIFT_RIGHT);
-		}
+	InputState input;
+	const int keys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_PAGE_UP, GLFW_KEY_PAGE_DOWN,
+		GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_LEFT, GLFW_KEY_RIGHT };
+	//bits of InputKey, in the same order
+	for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+		if (glfwGetKey(window, keys[i]) == GLFW_PRESS)
+			input.keys |= 1 << i;
 	}
+	if (rotating)
+		input.keys |= INPUT_ROTATE;
+	input.yaw = camera.Yaw;
+	input.pitch = camera.Pitch;
+	input.selected = isSelected ? selected->ID - 1 : -1;
+	simulation.setInput(input);
+	return input.keys != 0;
 }
 
 // Process all input that doesn't need continuous response
 // -------------------------------------------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
+	//any key may change what is drawn, the lights or the passes
+	onDemand.request();
 	if (key == GLFW_KEY_ESCAPE &&action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 	if (key == GLFW_KEY_R && action == GLFW_PRESS)
 		rotating = true;
 	if (key == GLFW_KEY_R && action == GLFW_RELEASE)
 		rotating = false;
-	if (key == GLFW_KEY_L && action == GLFW_PRESS) {
-		if (camera.Position.x < scaling * 1545) {
-			kich = !kich;
-			general->setBool("kichOn", kich);
-		}
-		else if (camera.Position.z > -scaling * 1400){
-			liv = !liv;
-			general->setBool("livOn", liv);
+	//the collision manager belongs to the simulation thread
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		simulation.post([] {
+			CollisionManager* collision = CollisionManager::getInstance();
+			collision->meshCollision = !collision->meshCollision;
+			cout << "Collision against " << (collision->meshCollision ? "mesh triangles" : "bounding boxes") << endl;
+		});
+	}
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		simulation.post([] {
+			CollisionManager* collision = CollisionManager::getInstance();
+			if (collision->isTracing()) {
+				collision->stopTrace();
+				cout << "Collision trace saved to collision_trace.txt" << endl;
+			}
+			else if (collision->startTrace("collision_trace.txt"))
+				cout << "Recording collision trace" << endl;
+		});
+	}
+	if (key == GLFW_KEY_J && action == GLFW_PRESS) {
+		JobSystem::getInstance()->printStats();
+		JobSystem::getInstance()->resetStats();
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		if (Profiler::isEnabled()) {
+			Profiler::setEnabled(false);
+			if (Profiler::dump("profile.json"))
+				cout << "Profile saved to profile.json" << endl;
 		}
 		else {
-			bed = !bed;
-			general->setBool("bedOn", bed);
+			Profiler::setEnabled(true);
+			cout << "Profiling" << endl;
+		}
+	}
+	if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		gpuTimers.overlay = !gpuTimers.overlay;
+		if (!gpuTimers.overlay)
+			glfwSetWindowTitle(window, "House");
+	}
+	if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+		gpuTimers.perModel = !gpuTimers.perModel;
+		cout << "GPU timing " << (gpuTimers.perModel ? "per model and per pass" : "per pass") << endl;
+	}
+	if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		if (gpuTimers.isWritingCsv()) {
+			gpuTimers.stopCsv();
+			cout << "GPU timings saved to gpu_timings.csv" << endl;
+		}
+		else if (gpuTimers.startCsv("gpu_timings.csv"))
+			cout << "Recording GPU timings" << endl;
+	}
+	//F prints the GL calls of the last frame, shift + F records them every frame
+	if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+		GlStats &stats = GlStats::get();
+		if (!(mode & GLFW_MOD_SHIFT))
+			stats.print();
+		else if (stats.isWritingCsv()) {
+			stats.stopCsv();
+			cout << "GL calls saved to gl_calls.csv" << endl;
+		}
+		else if (stats.startCsv("gl_calls.csv"))
+			cout << "Recording GL calls" << endl;
+	}
+	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		MemoryTracker::printReport();
+	}
+	//K prints the memory of each model, the breakdown per mesh and texture goes to memory.csv. Model::models belongs to the simulation thread
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+		simulation.post([] { Model::printMemoryReport("memory.csv"); });
+	if (key == GLFW_KEY_N && action == GLFW_PRESS)
+		spawnRequested = true;
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+		depthPrepass = !depthPrepass;
+		cout << "Depth pre-pass " << (depthPrepass ? "on" : "off") << endl;
+	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		deferred = !deferred;
+		cout << (deferred ? "Deferred shading of the opaque models" : "Forward shading") << endl;
+	}
+	if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+		if (onDemand.isEnabled())
+			onDemand.printReport(glfwGetTime(), gpuFrameMilliseconds());
+		onDemand.setEnabled(!onDemand.isEnabled(), glfwGetTime());
+		cout << (onDemand.isEnabled() ? "Rendering on demand" : "Rendering every frame") << endl;
+	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+		LightGroup room;
+		if (camera.Position.x < scaling * 1545)
+			room = KITCHEN_LIGHTS;
+		else if (camera.Position.z > -scaling * 1400)
+			room = LIVING_LIGHTS;
+		else
+			room = BED_LIGHTS;
+		for (unsigned int i = 0; i < lights.size(); i++) {
+			if (lights[i].group != room)
+				continue;
+			lights[i].on = !lights[i].on;
+			if (lights[i].on)
+				shadowMaps.switched(lights[i]);
 		}
 	}
 }
@@ -383,6 +811,14 @@ void framebuffer_size_callback(GLFWwindow* window, int w, int h)
 	width = w;
 	height = h;
 	glViewport(0, 0, width, height);
+	onDemand.request();
+}
+
+// glfw: the window's contents were lost (uncovered, restored), the last frame is drawn again
+// ----------------------------------------------------------------------------------------
+void refresh_callback(GLFWwindow* window)
+{
+	onDemand.request();
 }
 
 //determines whether camera should follow mouse movement or not
@@ -390,6 +826,7 @@ bool processCam = false;
 // Process all mouse input
 // -----------------------
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+	onDemand.request();
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
 		double xpos, ypos;
 		glfwGetCursorPos(window, &xpos, &ypos);
@@ -426,24 +863,27 @@ void cursor_callback(GLFWwindow* window, double xpos, double ypos)
 // ----------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+	onDemand.request();
 	camera.ProcessMouseScroll(yoffset);
 }
 
 // this function selects the object the user clicked on
 // ----------------------------------------------------
 void selectObject(double x, double y) {
+	PROFILE_ZONE("selectObject");
+	gpuTimers.begin("selection");
 	unsigned int col[4];
 	//clear frame buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	//switch shaders
 	(*selection).use();
-	(*selection).setMat4("projection", projection);
-	(*selection).setMat4("view", view);
-	// draw all objects with their id as a parameter for their color
-	for (int i = 0; i < Model::models.size(); ++i) {
+	(*selection).setMat4("viewProjection", projection * view);
+	// draw all objects with their id as a parameter for their color, the meshes in view of the last frame are the
+	// ones under the cursor. The cache keeps the commands of both shaders, switching records nothing after the first time
+	for (int i = 0; i < drawnModels; ++i) {
 		(*(Model::models[i])).setShader(selection);
-		(*(Model::models[i])).Draw();
+		drawCache.draw(i);
 	}
 
 	//get the color of the pixel which the user clicked on
@@ -472,10 +912,11 @@ void selectObject(double x, double y) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	//set the usual shader for all objects except selected one
-	for (int i = 0; i < Model::models.size(); ++i)
+	for (int i = 0; i < drawnModels; ++i)
 		(*(Model::models[i])).setShader(general);
 	if (isSelected)
 		(*selected).setShader(selection);
+	gpuTimers.end();
 }
 
 GLuint loadCubeMap(vector<string> faces)
@@ -568,6 +1009,68 @@ void loadSkybox()
 
 }
 
+// draws the depth of the opaque models drawn with the general shader, without colours or textures. The selected
+// model, drawn with the selection shader, and the transparent ones are left out
+void drawDepthPrepass(int modelCount, int firstTransparent, InstanceBatcher* batcher)
+{
+	PROFILE_ZONE("depth prepass");
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	Shader* batched = instanceBatcher.shader;
+	instanceBatcher.shader = depth_shader;
+	for (int i = 0; i < modelCount && i < firstTransparent; ++i) {
+		if ((*(Model::models[i])).getShader() == general)
+			drawCache.draw(i, batcher, depth_shader);
+	}
+	instanceBatcher.flush();
+	instanceBatcher.shader = batched;
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// GPU milliseconds of a whole frame, averaged over the last frames read back
+float gpuFrameMilliseconds()
+{
+	const vector<GpuTimerStat> &stats = gpuTimers.getStats();
+	for (unsigned int i = 0; i < stats.size(); i++) {
+		if (stats[i].name == "frame")
+			return stats[i].average();
+	}
+	return 0.0f;
+}
+
+// after the pre-pass, fragments are only shaded where their depth is the one it kept, and the depth isn't written again
+void depthTestEqual(bool equal)
+{
+	glDepthFunc(equal ? GL_EQUAL : GL_LESS);
+	glDepthMask(equal ? GL_FALSE : GL_TRUE);
+}
+
+// draws the transparent models in one unsorted pass into the transparency buffer, then blends their weighted average
+// over the frame. The selected model keeps its highlight, drawn with the opaque ones
+void drawTransparent(int modelCount, int firstTransparent, InstanceBatcher* batcher)
+{
+	PROFILE_ZONE("transparent");
+	gpuTimers.begin("transparent");
+	transparencyBuffer.resize(width, height);
+	transparencyBuffer.begin();
+	general->use();
+	general->setBool("weighted", true);
+	for (int i = firstTransparent; i < modelCount; ++i) {
+		if (!(*(Model::models[i])).transparent || (*(Model::models[i])).getShader() != general)
+			continue;
+		if (gpuTimers.perModel)
+			gpuTimers.begin((*(Model::models[i])).getPath());
+		drawCache.draw(i, batcher);
+		if (gpuTimers.perModel)
+			gpuTimers.end();
+	}
+	instanceBatcher.flush();
+	general->use();
+	general->setBool("weighted", false);
+	transparencyBuffer.end();
+	transparencyBuffer.resolve();
+	gpuTimers.end();
+}
+
 void drawSkybox()
 {
 	glDepthMask(GL_FALSE);
@@ -0,0 +1,280 @@
+#include "Memory.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+MemoryTracker::Counters MemoryTracker::tags[MEMORY_TAG_COUNT];
+MemoryTracker::Counters MemoryTracker::threads[MAX_THREADS];
+char MemoryTracker::threadNames[MAX_THREADS][32];
+std::atomic<unsigned int> MemoryTracker::threadCount(0);
+std::atomic<unsigned long long> MemoryTracker::violations(0);
+std::atomic<bool> MemoryTracker::violationRecorded(false);
+std::size_t MemoryTracker::violationSize = 0;
+int MemoryTracker::violationTag = 0;
+int MemoryTracker::violationThread = 0;
+
+//Plain values only, so they are ready before any constructor allocates
+static thread_local int tagOfThread = MEMORY_UNTAGGED;
+static thread_local bool guarded = false;
+
+//Put in front of every block, keeps the block aligned like malloc's
+struct BlockHeader
+{
+	std::size_t size;
+	int tag;
+	int thread;
+};
+static const std::size_t HEADER_SIZE = 16;
+static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "the block header must fit in front of the block");
+
+const char* MemoryTracker::tagName(int tag)
+{
+	static const char* names[MEMORY_TAG_COUNT] = { "untagged", "loading", "render", "simulation", "collision", "jobs" };
+	return names[tag];
+}
+
+int MemoryTracker::currentTag()
+{
+	return tagOfThread;
+}
+
+void MemoryTracker::setCurrentTag(int tag)
+{
+	tagOfThread = tag;
+}
+
+//Slots are handed out in the order threads first allocate, without allocating
+int MemoryTracker::threadSlot()
+{
+	static thread_local int slot = -1;
+	if (slot < 0)
+	{
+		unsigned int index = threadCount++;
+		slot = index < MAX_THREADS ? index : MAX_THREADS - 1;
+	}
+	return slot;
+}
+
+void MemoryTracker::setThreadName(const char* name)
+{
+	int slot = threadSlot();
+	strncpy(threadNames[slot], name, sizeof(threadNames[slot]) - 1);
+	threadNames[slot][sizeof(threadNames[slot]) - 1] = '\0';
+}
+
+unsigned long long MemoryTracker::threadAllocations()
+{
+	return threads[threadSlot()].allocations;
+}
+
+void MemoryTracker::guard(bool on)
+{
+	guarded = on;
+}
+
+void MemoryTracker::resetViolations()
+{
+	violations = 0;
+	violationRecorded = false;
+}
+
+void MemoryTracker::printViolation()
+{
+	if (!violationRecorded)
+	{
+		return;
+	}
+	int thread = violationThread;
+	std::cout << violations << " heap allocations in guarded code, the first one of " << violationSize << " bytes tagged "
+		<< tagName(violationTag) << " on " << (threadNames[thread][0] ? threadNames[thread] : "an unnamed thread") << std::endl;
+}
+
+void MemoryTracker::printReport()
+{
+	//only operator new is replaced, C allocations and those of other modules go around it
+	std::cout << "Heap allocations by tag (operator new only, SOIL's malloc and Assimp's allocations in its DLL aren't counted):" << std::endl;
+	for (int i = 0; i < MEMORY_TAG_COUNT; i++)
+	{
+		std::cout << "\t" << tagName(i) << ":\t" << tags[i].allocations << " allocations, " << tags[i].frees << " frees, "
+			<< tags[i].liveBytes / 1024 << " KB live, " << tags[i].peakBytes / 1024 << " KB peak, " << tags[i].totalBytes / (1024 * 1024) << " MB total" << std::endl;
+	}
+	std::cout << "Heap allocations by thread:" << std::endl;
+	unsigned int count = std::min((unsigned int)threadCount, MAX_THREADS);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		std::cout << "\t" << (threadNames[i][0] ? threadNames[i] : "thread " + std::to_string(i)) << ":\t" << threads[i].allocations
+			<< " allocations, " << threads[i].liveBytes / 1024 << " KB live" << std::endl;
+	}
+}
+
+void* MemoryTracker::allocate(std::size_t size)
+{
+	char* block = static_cast<char*>(std::malloc(size + HEADER_SIZE));
+	if (!block)
+	{
+		return nullptr;
+	}
+	BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+	header->size = size;
+	header->tag = tagOfThread;
+	header->thread = threadSlot();
+
+	Counters* counters[2] = { &tags[header->tag], &threads[header->thread] };
+	for (int i = 0; i < 2; i++)
+	{
+		counters[i]->allocations.fetch_add(1, std::memory_order_relaxed);
+		counters[i]->liveBytes.fetch_add(size, std::memory_order_relaxed);
+		counters[i]->totalBytes.fetch_add(size, std::memory_order_relaxed);
+		long long live = counters[i]->liveBytes.load(std::memory_order_relaxed);
+		long long peak = counters[i]->peakBytes.load(std::memory_order_relaxed);
+		while (live > peak && !counters[i]->peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+	}
+	if (guarded)
+	{
+		if (!violationRecorded.exchange(true))
+		{
+			violationSize = size;
+			violationTag = header->tag;
+			violationThread = header->thread;
+		}
+		violations++;
+	}
+	return block + HEADER_SIZE;
+}
+
+//Counted against the thread and tag that allocated the block
+void MemoryTracker::release(void* pointer)
+{
+	if (!pointer)
+	{
+		return;
+	}
+	char* block = static_cast<char*>(pointer) - HEADER_SIZE;
+	BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+	Counters* counters[2] = { &tags[header->tag], &threads[header->thread] };
+	for (int i = 0; i < 2; i++)
+	{
+		counters[i]->frees.fetch_add(1, std::memory_order_relaxed);
+		counters[i]->liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+	}
+	std::free(block);
+}
+
+void* operator new(std::size_t size)
+{
+	void* pointer = MemoryTracker::allocate(size);
+	if (!pointer)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* pointer = MemoryTracker::allocate(size);
+	if (!pointer)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return MemoryTracker::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return MemoryTracker::allocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t &) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t &) noexcept
+{
+	MemoryTracker::release(pointer);
+}
+
+LinearArena::LinearArena(std::size_t capacity) : memory(new char[capacity]), capacity(capacity), offset(0), used(0), overflows(0)
+{
+}
+
+LinearArena::~LinearArena()
+{
+	reset();
+	delete[] memory;
+}
+
+//Rounds up inside a block reserved with room for the alignment
+static void* alignUp(char* block, std::size_t alignment)
+{
+	std::uintptr_t address = reinterpret_cast<std::uintptr_t>(block);
+	address = (address + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+	return reinterpret_cast<void*>(address);
+}
+
+void* LinearArena::allocate(std::size_t bytes, std::size_t alignment)
+{
+	std::size_t reserved = bytes + alignment - 1;
+	used += bytes;
+	std::size_t start = offset.fetch_add(reserved);
+	if (start + reserved <= capacity)
+	{
+		return alignUp(memory + start, alignment);
+	}
+	overflows++;
+	char* block = new char[reserved];
+	{
+		std::lock_guard<std::mutex> lock(overflowMutex);
+		overflowBlocks.push_back(block);
+	}
+	return alignUp(block, alignment);
+}
+
+void LinearArena::reset()
+{
+	std::size_t needed = offset;
+	for (unsigned int i = 0; i < overflowBlocks.size(); i++)
+	{
+		delete[] overflowBlocks[i];
+	}
+	overflowBlocks.clear();
+	if (needed > capacity)
+	{
+		delete[] memory;
+		capacity = std::max(capacity * 2, needed);
+		memory = new char[capacity];
+	}
+	offset = 0;
+	used = 0;
+}
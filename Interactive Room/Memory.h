@@ -0,0 +1,120 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+//What an allocation was made for, set per thread with MemoryScope
+enum MemoryTag {
+	MEMORY_UNTAGGED,
+	MEMORY_LOADING,
+	MEMORY_RENDER,
+	MEMORY_SIMULATION,
+	MEMORY_COLLISION,
+	MEMORY_JOBS,
+	MEMORY_TAG_COUNT
+};
+
+//Allocations made through operator new, per tag and per thread.
+//Memory.cpp replaces the global operator new and delete; each block carries a small header with its size and tag.
+//A thread can be guarded, any allocation it makes is then counted as a violation, see the steady-state frame test in Main.cpp
+class MemoryTracker
+{
+public:
+	//threads with their own counters, later threads share the last one
+	static const unsigned int MAX_THREADS = 64;
+
+	struct Counters
+	{
+		std::atomic<unsigned long long> allocations;
+		std::atomic<unsigned long long> frees;
+		std::atomic<long long> liveBytes;
+		std::atomic<unsigned long long> totalBytes;
+		//highest liveBytes reached
+		std::atomic<long long> peakBytes;
+	};
+
+	//counters of one tag, e.g. everything allocated while loading
+	static const Counters &getTagCounters(MemoryTag tag) { return tags[tag]; }
+
+	static const char* tagName(int tag);
+	//tag of the calling thread's allocations, the jobs it submits are counted under it too
+	static int currentTag();
+	//name shown for the calling thread in the report
+	static void setThreadName(const char* name);
+	//allocations made by the calling thread since it started
+	static unsigned long long threadAllocations();
+
+	//makes every allocation of the calling thread a violation, until unguarded
+	static void guard(bool on);
+	static unsigned long long getViolations() { return violations; }
+	//prints the first violation since the last reset
+	static void printViolation();
+	static void resetViolations();
+
+	static void printReport();
+
+	//used by operator new and delete
+	static void* allocate(std::size_t size);
+	static void release(void* pointer);
+
+private:
+	static Counters tags[MEMORY_TAG_COUNT];
+	static Counters threads[MAX_THREADS];
+	static char threadNames[MAX_THREADS][32];
+	static std::atomic<unsigned int> threadCount;
+	static std::atomic<unsigned long long> violations;
+	//the first violation, written by the thread that made it
+	static std::atomic<bool> violationRecorded;
+	static std::size_t violationSize;
+	static int violationTag;
+	static int violationThread;
+	static int threadSlot();
+
+	friend class MemoryScope;
+	static void setCurrentTag(int tag);
+};
+
+//Tags the allocations of the calling thread until the end of the scope
+class MemoryScope
+{
+public:
+	explicit MemoryScope(MemoryTag tag) : previous(MemoryTracker::currentTag()) { MemoryTracker::setCurrentTag(tag); }
+	~MemoryScope() { MemoryTracker::setCurrentTag(previous); }
+
+private:
+	int previous;
+};
+
+//Linear allocator for data sharing a lifetime: the scratch of one model import or collision mesh build.
+//Allocating is a single atomic add so jobs can allocate from it too. When it runs out it falls back to the heap
+//and grows to fit at the next reset, so a reused arena only allocates when it's outgrown
+class LinearArena
+{
+public:
+	explicit LinearArena(std::size_t capacity);
+	~LinearArena();
+
+	void* allocate(std::size_t bytes, std::size_t alignment = 16);
+	template <typename T>
+	T* allocate(std::size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+	//frees everything allocated since the last reset, no destructors are run
+	void reset();
+
+	std::size_t getCapacity() const { return capacity; }
+	//bytes handed out since the last reset, overflow included
+	std::size_t getUsed() const { return used; }
+	//allocations that didn't fit since the arena was created
+	unsigned int getOverflows() const { return overflows; }
+
+private:
+	char* memory;
+	std::size_t capacity;
+	std::atomic<std::size_t> offset;
+	std::atomic<std::size_t> used;
+	std::atomic<unsigned int> overflows;
+	std::mutex overflowMutex;
+	std::vector<char*> overflowBlocks;
+};
+#endif
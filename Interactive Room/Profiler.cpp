@@ -0,0 +1,112 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+std::atomic<bool> Profiler::enabled(false);
+std::chrono::high_resolution_clock::time_point Profiler::epoch = std::chrono::high_resolution_clock::now();
+std::mutex Profiler::buffersMutex;
+//Buffers are never freed, events of threads that exited can still be dumped
+std::vector<Profiler::ThreadBuffer*> Profiler::buffers;
+
+//Registered the first time a thread records or is named, the only time the profiler takes a lock on the hot path
+Profiler::ThreadBuffer* Profiler::threadBuffer()
+{
+	static thread_local ThreadBuffer* buffer = nullptr;
+	if (!buffer)
+	{
+		buffer = new ThreadBuffer;
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffer->id = buffers.size();
+		buffer->name = "thread " + std::to_string(buffer->id);
+		buffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+void Profiler::setThreadName(const std::string &name)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	buffer->name = name;
+}
+
+void Profiler::record(const char* name, long long start, long long end)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	unsigned long long index = buffer->written.load(std::memory_order_relaxed);
+	Event &event = buffer->events[index % RING_SIZE];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	//publishes the event to dump
+	buffer->written.store(index + 1, std::memory_order_release);
+}
+
+//Escapes the characters JSON doesn't allow in strings
+static std::string jsonString(const std::string &text)
+{
+	std::string result;
+	for (unsigned int i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"' || text[i] == '\\')
+		{
+			result += '\\';
+		}
+		result += text[i];
+	}
+	return result;
+}
+
+bool Profiler::dump(const std::string &path)
+{
+	std::ofstream out(path);
+	if (!out.is_open())
+	{
+		return false;
+	}
+	std::vector<ThreadBuffer*> threads;
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		threads = buffers;
+	}
+
+	//microseconds with nanosecond digits
+	out << std::fixed << std::setprecision(3);
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	std::vector<Event> events;
+	for (unsigned int t = 0; t < threads.size(); t++)
+	{
+		ThreadBuffer &buffer = *threads[t];
+		{
+			std::lock_guard<std::mutex> lock(buffersMutex);
+			out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.id
+				<< ",\"args\":{\"name\":\"" << jsonString(buffer.name) << "\"}}";
+			first = false;
+		}
+
+		//Copy without stopping the thread, then drop whatever it may have overwritten meanwhile
+		unsigned long long end = buffer.written.load(std::memory_order_acquire);
+		unsigned long long begin = end > RING_SIZE ? end - RING_SIZE : 0;
+		events.clear();
+		for (unsigned long long i = begin; i < end; i++)
+		{
+			events.push_back(buffer.events[i % RING_SIZE]);
+		}
+		//the copies must be done before written is read again
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned long long after = buffer.written.load(std::memory_order_relaxed);
+		//the thread may be writing event after into its slot while it was copied, so that one is dropped too
+		unsigned long long overwritten = after + 1 > RING_SIZE ? after + 1 - RING_SIZE : 0;
+		unsigned long long skip = overwritten > begin ? std::min(overwritten - begin, (unsigned long long)events.size()) : 0;
+
+		for (unsigned long long i = skip; i < events.size(); i++)
+		{
+			out << ",\n{\"name\":\"" << jsonString(events[i].name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.id
+				<< ",\"ts\":" << events[i].start / 1000.0 << ",\"dur\":" << (events[i].end - events[i].start) / 1000.0 << "}";
+		}
+	}
+	out << "\n]}\n";
+	return true;
+}
@@ -0,0 +1,90 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Scoped CPU timing zones, written to per-thread ring buffers and dumped as Chrome trace_event JSON
+//(open it in chrome://tracing or ui.perfetto.dev).
+//Zones cost one relaxed load while the profiler is disabled; define NO_PROFILER to compile them out entirely
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+//times the rest of the enclosing scope, name must be a string literal
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#endif
+
+class Profiler
+{
+public:
+	//events each thread keeps, older ones are overwritten
+	static const unsigned int RING_SIZE = 1 << 16;
+
+	static std::atomic<bool> enabled;
+
+	static void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+	//name shown for the calling thread in the trace
+	static void setThreadName(const std::string &name);
+	//writes every event still in the ring buffers, returns false if the file can't be written
+	static bool dump(const std::string &path);
+
+	//nanoseconds since the profiler started
+	static long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - epoch).count();
+	}
+	//adds a finished zone to the calling thread's ring buffer
+	static void record(const char* name, long long start, long long end);
+
+private:
+	struct Event
+	{
+		const char* name;
+		long long start;
+		long long end;
+	};
+	//written by its thread only, read by dump
+	struct ThreadBuffer
+	{
+		unsigned int id;
+		std::string name;
+		std::vector<Event> events;
+		std::atomic<unsigned long long> written;
+		ThreadBuffer() : events(RING_SIZE), written(0) {}
+	};
+
+	static std::chrono::high_resolution_clock::time_point epoch;
+	static std::mutex buffersMutex;
+	static std::vector<ThreadBuffer*> buffers;
+	static ThreadBuffer* threadBuffer();
+};
+
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* zone) : name(nullptr)
+	{
+		if (Profiler::isEnabled())
+		{
+			name = zone;
+			start = Profiler::now();
+		}
+	}
+	~ProfileZone()
+	{
+		if (name)
+		{
+			Profiler::record(name, start, Profiler::now());
+		}
+	}
+
+private:
+	const char* name;
+	long long start;
+};
+#endif
@@ -0,0 +1,46 @@
+#include "RenderOnDemand.h"
+#include <iostream>
+
+void RenderOnDemand::setEnabled(bool enabled, double now)
+{
+	this->enabled = enabled;
+	requested = true;
+	drewLast = true;
+	drawn = skipped = 0;
+	since = now;
+	slept = 0.0;
+}
+
+bool RenderOnDemand::beginFrame(const mat4 &viewProjection)
+{
+	bool draw = !enabled || requested || viewProjection != lastViewProjection;
+	requested = false;
+	lastViewProjection = viewProjection;
+	drewLast = draw;
+	if (draw)
+	{
+		drawn++;
+	}
+	else
+	{
+		skipped++;
+	}
+	return draw;
+}
+
+void RenderOnDemand::printReport(double now, float gpuFrameMilliseconds)
+{
+	double elapsed = now - since;
+	if (elapsed <= 0.0)
+	{
+		return;
+	}
+	double awake = elapsed - slept;
+	std::cout << "On demand, over " << elapsed << " s: " << drawn << " frames drawn (" << drawn / elapsed << " per second), "
+		<< skipped << " skipped, loop asleep " << (int)(slept / elapsed * 100.0) << "% of the time ("
+		<< awake / elapsed * 1000.0 << " ms awake per second), GPU busy about "
+		<< drawn / elapsed * gpuFrameMilliseconds << " ms per second" << std::endl;
+	drawn = skipped = 0;
+	since = now;
+	slept = 0.0;
+}
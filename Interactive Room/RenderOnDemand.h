@@ -0,0 +1,54 @@
+#ifndef RENDER_ON_DEMAND_H
+#define RENDER_ON_DEMAND_H
+#include "glm.hpp"
+
+using namespace glm;
+
+//Render-on-demand: once a frame has nothing new to show, the render loop sleeps until an event or a timeout and
+//the last frame stays on screen. A frame is drawn when the view, a model or the window changed, or an input event
+//(a key switching the lights, a click) asked for it. The time slept and the frames skipped are counted to report
+//what the idle loop still costs
+class RenderOnDemand
+{
+public:
+	//longest sleep when idle: changes no event announces, such as a spawned model the simulation starts tracking,
+	//show this late at most
+	static constexpr double IDLE_TIMEOUT = 0.1;
+	//sleep while a key is held but moves nothing, walking into a wall say: one frame at 60 Hz
+	static constexpr double HELD_TIMEOUT = 1.0 / 60.0;
+
+	bool isEnabled() const { return enabled; }
+	//switching either way draws the next frame and restarts the counts from now, in seconds
+	void setEnabled(bool enabled, double now);
+
+	//something a frame can't see for itself changed: an input event, a light, the window, a model's transform
+	void request() { requested = true; }
+	//whether a movement key is held, sampled every iteration
+	void setInputHeld(bool held) { inputHeld = held; }
+
+	//whether the loop should block for events before this iteration, and for how long at most
+	bool shouldWait() const { return enabled && !drewLast; }
+	double waitTimeout() const { return inputHeld ? HELD_TIMEOUT : IDLE_TIMEOUT; }
+	//seconds the loop spent blocked
+	void addSleep(double seconds) { slept += seconds; }
+
+	//whether the frame with this view has to be drawn, once per iteration. Always true when disabled
+	bool beginFrame(const mat4 &viewProjection);
+
+	//prints the frames drawn and skipped, the share of the time the loop slept and the GPU time per second, from
+	//the GPU milliseconds of a drawn frame. Then restarts the counts
+	void printReport(double now, float gpuFrameMilliseconds);
+
+private:
+	bool enabled = false;
+	bool requested = true;
+	bool drewLast = true;
+	bool inputHeld = false;
+	mat4 lastViewProjection;
+	unsigned long long drawn = 0;
+	unsigned long long skipped = 0;
+	//counts since this time, in seconds
+	double since = 0.0;
+	double slept = 0.0;
+};
+#endif
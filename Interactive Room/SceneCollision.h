@@ -0,0 +1,69 @@
+#ifndef SCENE_COLLISION_H
+#define SCENE_COLLISION_H
+#include "CollisionManager.h"
+#include <string>
+
+//Collision layers of the models of the room. Main.cpp applies them to the models it loads and the collision
+//benchmark builds its scene from the same table, so a recorded trace replays with the pair filtering of the app
+
+//A model, its layer and the layers of movers it blocks
+struct SceneCollision
+{
+	const char* path;
+	unsigned int layer;
+	unsigned int blocks;
+};
+
+//Layers a moved model collides with by default: the other furniture and the static models
+const unsigned int MOVED_MODEL_MASK = LAYER_STATIC | LAYER_FURNITURE;
+//Small objects on tables don't stop the player
+const unsigned int NOT_CAMERA = LAYER_ALL & ~LAYER_CAMERA;
+//Moved models stand inside the house's bounds, only the cabinets and windows stop them
+const unsigned int NOT_MOVED_MODELS = LAYER_ALL & ~(LAYER_FURNITURE | LAYER_DECOR);
+
+//In the order Main.cpp loads the models
+const SceneCollision SCENE_COLLISION[] = {
+	{ "Models/bed/bed.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/bed/ironman.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/bed/wardrobe.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/bed/nightstand.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/bed/phone.obj", LAYER_DECOR, NOT_CAMERA },
+	{ "Models/kitchen/kitchen.obj", LAYER_STATIC, LAYER_ALL },
+	{ "Models/kitchen/kitchen table.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/chair 1.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/chair 2.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/chair 3.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/chair 4.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/kettle.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/gun.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/kitchen/apples.obj", LAYER_DECOR, NOT_CAMERA },
+	{ "Models/living/TV.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/couch.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/coffee table.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/table plant.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/tray.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/laptop.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/indoor plant.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/living/dragon.obj", LAYER_FURNITURE, LAYER_ALL },
+	{ "Models/house/house.obj", LAYER_STATIC, NOT_MOVED_MODELS },
+	{ "Models/house/lamps.obj", LAYER_DECOR, LAYER_ALL },
+	{ "Models/kitchen/blender.obj", LAYER_DECOR, NOT_CAMERA },
+	{ "Models/living/glass 1.obj", LAYER_DECOR, NOT_CAMERA },
+	{ "Models/living/glass 2.obj", LAYER_DECOR, NOT_CAMERA },
+	{ "Models/house/windows.obj", LAYER_STATIC, LAYER_ALL }
+};
+const unsigned int SCENE_COLLISION_SIZE = sizeof(SCENE_COLLISION) / sizeof(SCENE_COLLISION[0]);
+
+//Entry of the model loaded from path, nullptr if it isn't part of the room
+inline const SceneCollision* findSceneCollision(const std::string &path)
+{
+	for (unsigned int i = 0; i < SCENE_COLLISION_SIZE; i++)
+	{
+		if (path == SCENE_COLLISION[i].path)
+		{
+			return &SCENE_COLLISION[i];
+		}
+	}
+	return nullptr;
+}
+#endif
@@ -0,0 +1,20 @@
+#version 330 core
+out vec4 FragColor;
+
+//targets of the weighted blended transparent pass, see TransparencyBuffer
+uniform sampler2D accumulation;
+uniform sampler2D weights;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 accumulated = texelFetch(accumulation, pixel, 0);
+	//product of (1 - alpha) of the layers, 1 where nothing transparent was drawn
+	float revealed = accumulated.a;
+	if (revealed >= 1.0f)
+		discard;
+	//a half float sum can overflow with many close layers
+	vec3 sum = min(accumulated.rgb, vec3(65504.0f));
+	float weight = max(texelFetch(weights, pixel, 0).r, 1e-5f);
+	FragColor = vec4(sum / weight, revealed);
+}
\ No newline at end of file
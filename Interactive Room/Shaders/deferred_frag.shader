@@ -0,0 +1,100 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+//G-buffer of the opaque models
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+//back from the depth buffer to world space
+uniform mat4 inverseViewProjection;
+
+//clustered lights, filled by ClusteredLighting each frame
+//two texels per light: position and attenuation, then color and shadow map (-1 for none)
+uniform samplerBuffer lights;
+//offset in lightIndices and count of the lights of each cluster
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+//size of a tile in pixels, and the depth range the slices span
+uniform vec2 tileSize;
+uniform float zNear;
+uniform float zFar;
+
+//distance to the light of the nearest caster in each direction, over shadowFar. Must match ShadowMaps::MAX_SHADOWED
+uniform samplerCube shadowMaps[4];
+uniform float shadowFar;
+
+//must match LightClusters
+const int TILES_X = 16;
+const int TILES_Y = 9;
+const int SLICES = 24;
+//keeps surfaces from shadowing themselves, in units of shadowFar
+const float SHADOW_BIAS = 0.001f;
+
+int cluster(float ndcDepth)
+{
+	//view space depth of the pixel
+	float depth = 2.0f * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+	//slices are spaced exponentially, as LightClusters::slice
+	int slice = int(clamp(log(depth / zNear) / log(zFar / zNear) * SLICES, 0.0f, SLICES - 1.0f));
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / tileSize), ivec2(TILES_X - 1, TILES_Y - 1));
+	return tile.x + TILES_X * (tile.y + TILES_Y * slice);
+}
+
+//1 if the light reaches the fragment, 0 if a caster in its shadow map is closer. Samplers can't be indexed
+//by a variable in GLSL 3.30, hence the branches
+float lit(int shadowMap, vec3 fromLight)
+{
+	float nearest;
+	if (shadowMap == 0)
+		nearest = textureLod(shadowMaps[0], fromLight, 0).r;
+	else if (shadowMap == 1)
+		nearest = textureLod(shadowMaps[1], fromLight, 0).r;
+	else if (shadowMap == 2)
+		nearest = textureLod(shadowMaps[2], fromLight, 0).r;
+	else if (shadowMap == 3)
+		nearest = textureLod(shadowMaps[3], fromLight, 0).r;
+	else
+		return 1.0f;
+	return length(fromLight) / shadowFar - SHADOW_BIAS > nearest ? 0.0f : 1.0f;
+}
+
+void main()
+{
+	float bufferDepth = texture(gDepth, TexCoords).r;
+	//nothing opaque there, the skybox stays
+	if (bufferDepth == 1.0f)
+		discard;
+	//the transparent models drawn after are depth tested against the opaque ones
+	gl_FragDepth = bufferDepth;
+
+	float ambientStrength = 0.04f;
+	vec3 lampLightColor = vec3(1);
+
+	vec4 albedo = texture(gAlbedo, TexCoords);
+	vec3 norm = texture(gNormal, TexCoords).xyz;
+	vec3 ndc = vec3(TexCoords, bufferDepth) * 2.0f - 1.0f;
+	vec4 world = inverseViewProjection * vec4(ndc, 1);
+	vec3 fragPosition = world.xyz / world.w;
+	//ambiant light
+	vec3 light = ambientStrength * lampLightColor;
+
+	uvec2 range = texelFetch(clusters, cluster(ndc.z)).xy;
+	for (uint i = 0u; i < range.y; i++) {
+		int index = int(texelFetch(lightIndices, int(range.x + i)).x);
+		vec4 positionAttenuation = texelFetch(lights, 2 * index);
+		vec4 colorShadow = texelFetch(lights, 2 * index + 1);
+		//light direction and distance
+		vec3 toLight = positionAttenuation.xyz - fragPosition;
+		float distanceToLight = length(toLight);
+		//light distance attenuation factor
+		float attenuation = 1.0f / (1.0f + positionAttenuation.w * distanceToLight * distanceToLight);
+		//light angle attenuation factor
+		float diffuse = max(dot(norm, toLight / distanceToLight), 0);
+		//diffuse light
+		light += attenuation * diffuse * lit(int(colorShadow.w), -toLight) * colorShadow.rgb;
+	}
+	//final color
+	FragColor = vec4(light, 1) * albedo;
+}
\ No newline at end of file
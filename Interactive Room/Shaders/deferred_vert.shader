@@ -0,0 +1,10 @@
+#version 330 core
+//one triangle covering the screen, no vertex buffer needed
+out vec2 TexCoords;
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	TexCoords = corner;
+	gl_Position = vec4(2.0f * corner - 1.0f, 0, 1);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 5) in mat4 aInstanceModel;
+
+layout(std140) uniform Object
+{
+	mat4 model;
+	mat3 normalMatrix;
+};
+uniform mat4 viewProjection;
+uniform vec3 meshOffset;
+uniform bool instanced;
+//computed exactly as in general_vert, the main pass keeps the fragments whose depth equals this one
+invariant gl_Position;
+
+void main()
+{
+	vec4 position = instanced ? aInstanceModel * vec4(aPos, 1.0) : model * vec4(aPos + meshOffset, 1.0);
+
+	gl_Position = viewProjection * position;
+}
\ No newline at end of file
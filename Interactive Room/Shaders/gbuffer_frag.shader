@@ -0,0 +1,16 @@
+#version 330 core
+//what the lighting pass needs of an opaque fragment, the depth comes from the depth attachment
+layout(location = 0) out vec4 Albedo;
+layout(location = 1) out vec4 GNormal;
+
+in vec2 TexCoords;
+in vec3 fragPosition;
+in vec3 Normal;
+
+uniform sampler2D texture_diffuse1;
+
+void main()
+{
+	Albedo = texture(texture_diffuse1, TexCoords);
+	GNormal = vec4(normalize(Normal), 0);
+}
\ No newline at end of file
@@ -1,19 +1,79 @@
 #version 330 core
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+//sum of the weights of the transparent layers, only written in the weighted blended pass
+layout(location = 1) out vec4 Weight;
 
 in vec2 TexCoords;
 in vec3 fragPosition;
 in vec3 Normal;
+in vec3 Lightmap;
 
 uniform sampler2D texture_diffuse1;
-uniform vec3 livLamp1;
-uniform vec3 livLamp2;
-uniform vec3 bedLamp;
-uniform vec3 kitchLamp;
+//lighting baked by Lightmapper, light i in channel i, for the meshes whose Lightmap.z is 1
+uniform sampler2D texture_lightmap;
+//1 for each baked light that is on
+uniform vec4 bakedOn;
 
-uniform int livOn;
-uniform int bedOn;
-uniform int kichOn;
+//clustered lights, filled by ClusteredLighting each frame
+//two texels per light: position and attenuation, then color and shadow map (-1 for none)
+uniform samplerBuffer lights;
+//offset in lightIndices and count of the lights of each cluster
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+//size of a tile in pixels, and the depth range the slices span
+uniform vec2 tileSize;
+uniform float zNear;
+uniform float zFar;
+
+//distance to the light of the nearest caster in each direction, over shadowFar. Must match ShadowMaps::MAX_SHADOWED
+uniform samplerCube shadowMaps[4];
+uniform float shadowFar;
+
+//set for the transparent models, drawn into TransparencyBuffer instead of blended in order
+uniform bool weighted;
+
+//must match LightClusters
+const int TILES_X = 16;
+const int TILES_Y = 9;
+const int SLICES = 24;
+//keeps surfaces from shadowing themselves, in units of shadowFar
+const float SHADOW_BIAS = 0.001f;
+//must match Lightmapper::CHANNELS
+const int BAKED_LIGHTS = 4;
+
+//view space depth of the fragment, back from the depth buffer value
+float viewDepth()
+{
+	float ndcDepth = 2.0f * gl_FragCoord.z - 1.0f;
+	return 2.0f * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+}
+
+int cluster()
+{
+	float depth = viewDepth();
+	//slices are spaced exponentially, as LightClusters::slice
+	int slice = int(clamp(log(depth / zNear) / log(zFar / zNear) * SLICES, 0.0f, SLICES - 1.0f));
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / tileSize), ivec2(TILES_X - 1, TILES_Y - 1));
+	return tile.x + TILES_X * (tile.y + TILES_Y * slice);
+}
+
+//1 if the light reaches the fragment, 0 if a caster in its shadow map is closer. Samplers can't be indexed
+//by a variable in GLSL 3.30, hence the branches
+float lit(int shadowMap, vec3 fromLight)
+{
+	float nearest;
+	if (shadowMap == 0)
+		nearest = textureLod(shadowMaps[0], fromLight, 0).r;
+	else if (shadowMap == 1)
+		nearest = textureLod(shadowMaps[1], fromLight, 0).r;
+	else if (shadowMap == 2)
+		nearest = textureLod(shadowMaps[2], fromLight, 0).r;
+	else if (shadowMap == 3)
+		nearest = textureLod(shadowMaps[3], fromLight, 0).r;
+	else
+		return 1.0f;
+	return length(fromLight) / shadowFar - SHADOW_BIAS > nearest ? 0.0f : 1.0f;
+}
 
 void main()
 {
@@ -22,33 +82,47 @@ void main()
 
 	//normalized normal vector
 	vec3 norm = normalize(Normal);
-	//light direction
-	vec3 livLamp1Dir = normalize(livLamp1 - fragPosition);
-	vec3 livLamp2Dir = normalize(livLamp2 - fragPosition);
-	vec3 bedLampDir = normalize(bedLamp - fragPosition);
-	vec3 kitchLampDir = normalize(kitchLamp - fragPosition);
-	//distance between fragment and lamp
-	float distanceToLivLamp1 = distance(livLamp1, fragPosition);
-	float distanceToLivLamp2 = distance(livLamp2, fragPosition);
-	float distanceToBedLamp = distance(bedLamp, fragPosition);
-	float distanceToKitchLamp = distance(kitchLamp, fragPosition);
-	//light distance attenuation factor
-	float attenuationLivLamp1 = 1.0f / (1.0f + 0.002f * pow(distanceToLivLamp1, 2));
-	float attenuationLivLamp2 = 1.0f / (1.0f + 0.002f  * pow(distanceToLivLamp2, 2));
-	float attenuationBedLamp = 1.0f / (1.0f + 0.002f  * pow(distanceToBedLamp, 2));
-	float attenuationKitchLamp = 1.0f / (1.0f + 0.002f * pow(distanceToKitchLamp, 2));
-	//light angle attenuation factor
-	float livLamp1Diff = max(dot(norm, livLamp1Dir), 0);
-	float livLamp2Diff = max(dot(norm, livLamp2Dir), 0);
-	float bedLampDiff = max(dot(norm, bedLampDir), 0);
-	float kitchLampDiff = max(dot(norm, kitchLampDir), 0);
 	//ambiant light
-	vec3 ambiant = ambientStrength * lampLightColor;
-	//diffuse light
-	vec3 livLamp1Light = attenuationLivLamp1 * livLamp1Diff * lampLightColor * livOn;
-	vec3 livLamp2Light = attenuationLivLamp2 * livLamp2Diff * lampLightColor * livOn;
-	vec3 bedLampLight = attenuationBedLamp * bedLampDiff * lampLightColor * bedOn;
-	vec3 kitchLampLight = attenuationKitchLamp * kitchLampDiff * lampLightColor * kichOn;
+	vec3 light = ambientStrength * lampLightColor;
+
+	//the baked lights are read from the lightmap, with the shadow maps still applied for the models that move
+	bool baked = Lightmap.z > 0.5f;
+	if (baked) {
+		vec4 bakedLight = texture(texture_lightmap, Lightmap.xy) * bakedOn;
+		for (int i = 0; i < BAKED_LIGHTS; i++) {
+			if (bakedLight[i] <= 0.0f)
+				continue;
+			vec4 colorShadow = texelFetch(lights, 2 * i + 1);
+			light += bakedLight[i] * lit(int(colorShadow.w), fragPosition - texelFetch(lights, 2 * i).xyz) * colorShadow.rgb;
+		}
+	}
+
+	uvec2 range = texelFetch(clusters, cluster()).xy;
+	for (uint i = 0u; i < range.y; i++) {
+		int index = int(texelFetch(lightIndices, int(range.x + i)).x);
+		if (baked && index < BAKED_LIGHTS)
+			continue;
+		vec4 positionAttenuation = texelFetch(lights, 2 * index);
+		vec4 colorShadow = texelFetch(lights, 2 * index + 1);
+		//light direction and distance
+		vec3 toLight = positionAttenuation.xyz - fragPosition;
+		float distanceToLight = length(toLight);
+		//light distance attenuation factor
+		float attenuation = 1.0f / (1.0f + positionAttenuation.w * distanceToLight * distanceToLight);
+		//light angle attenuation factor
+		float diffuse = max(dot(norm, toLight / distanceToLight), 0);
+		//diffuse light
+		light += attenuation * diffuse * lit(int(colorShadow.w), -toLight) * colorShadow.rgb;
+	}
 	//final color
-	FragColor = vec4(ambiant + livLamp1Light + livLamp2Light + bedLampLight + kitchLampLight, 1) * texture(texture_diffuse1, TexCoords);
+	vec4 color = vec4(light, 1) * texture(texture_diffuse1, TexCoords);
+	if (weighted) {
+		//nearer layers weigh more, so the average leans to what is in front (McGuire and Bavoil's depth weight)
+		float depth = viewDepth();
+		float weight = clamp(10.0f / (1e-5f + pow(depth / 5.0f, 2.0f) + pow(depth / 200.0f, 6.0f)), 1e-2f, 3e3f);
+		FragColor = vec4(color.rgb * color.a * weight, color.a);
+		Weight = vec4(color.a * weight);
+	}
+	else
+		FragColor = color;
 }
\ No newline at end of file
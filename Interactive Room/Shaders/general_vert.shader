@@ -2,21 +2,37 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
+//model and normal matrices of each instance, read instead of the Object block in an instanced draw
+layout(location = 5) in mat4 aInstanceModel;
+layout(location = 9) in mat3 aInstanceNormal;
+//atlas coordinates of a baked mesh and 1, left disabled (0) for the others
+layout(location = 12) in vec3 aLightmap;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 fragPosition;
+out vec3 Lightmap;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//the object being drawn, written by the CPU when it moves
+layout(std140) uniform Object
+{
+	mat4 model;
+	mat3 normalMatrix;
+};
+uniform mat4 viewProjection;
+//model space translation of a mesh drawn from the buffers of an identical one
+uniform vec3 meshOffset;
+uniform bool instanced;
+//the depth pre-pass computes the same position, the main pass tests for equal depths
+invariant gl_Position;
 
 void main()
 {
-	mat4 MVP = projection * view * model;
+	vec4 position = instanced ? aInstanceModel * vec4(aPos, 1.0) : model * vec4(aPos + meshOffset, 1.0);
 
 	TexCoords = aTexCoords;
-	gl_Position = MVP * vec4(aPos, 1.0);
-	fragPosition = (model * vec4(aPos,1)).xyz;
-	Normal = mat3(transpose(inverse(model))) * aNormal;
+	Lightmap = aLightmap;
+	gl_Position = viewProjection * position;
+	fragPosition = position.xyz;
+	Normal = (instanced ? aInstanceNormal : normalMatrix) * aNormal;
 }
\ No newline at end of file
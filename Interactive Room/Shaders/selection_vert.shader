@@ -1,12 +1,15 @@
 #version 330 core
 layout(location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout(std140) uniform Object
+{
+	mat4 model;
+	mat3 normalMatrix;
+};
+uniform mat4 viewProjection;
+uniform vec3 meshOffset;
 
 void main()
 {
-	mat4 MVP = projection * view * model;
-	gl_Position = MVP * vec4(aPos, 1.0);
+	gl_Position = viewProjection * model * vec4(aPos + meshOffset, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 330 core
+in vec3 fragPosition;
+
+uniform vec3 lightPosition;
+//distance stored as 1 in the cube map
+uniform float shadowFar;
+
+//the cube map keeps the distance to the light, the same whatever face it is looked up from
+void main()
+{
+	gl_FragDepth = distance(fragPosition, lightPosition) / shadowFar;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+
+out vec3 fragPosition;
+
+layout(std140) uniform Object
+{
+	mat4 model;
+	mat3 normalMatrix;
+};
+//of the cube face being drawn
+uniform mat4 viewProjection;
+uniform vec3 meshOffset;
+
+void main()
+{
+	vec4 position = model * vec4(aPos + meshOffset, 1.0);
+
+	fragPosition = position.xyz;
+	gl_Position = viewProjection * position;
+}
\ No newline at end of file
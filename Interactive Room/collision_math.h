@@ -1,5 +1,6 @@
 #pragma once
 #include "glm.hpp"
+#include <vector>
 
 using namespace glm;
 
@@ -17,6 +18,12 @@ struct CollisionPacket
 	bool foundCollision;
 	float nearestDistance;
 	vec3 intersectionPoint;
+
+	//deepest triangle the elipsoid already overlapped at the start of the sweep, and how far the base point must
+	//move against its normal to only touch its plane
+	bool foundEmbedded;
+	float embeddedDepth;
+	vec3 embeddedNormal;
 };
 
 class Plane
@@ -59,4 +66,51 @@ public:
 	{
 		return dot(point, normal) + equation[3];
 	}
+};
+
+//Structure of arrays holding triangles for the batched narrowphase.
+//Each corner coordinate lives in its own array so SIMD lanes can load 4/8 triangles at once.
+//Arrays are padded to a multiple of TriangleBatch::PADDING, count is the number of real triangles.
+struct TriangleBatch
+{
+	static const unsigned int PADDING = 8;
+
+	std::vector<float> x1, y1, z1;
+	std::vector<float> x2, y2, z2;
+	std::vector<float> x3, y3, z3;
+	unsigned int count = 0;
+
+	//Empties the batch but keeps the memory for the next query
+	void clear()
+	{
+		x1.clear(); y1.clear(); z1.clear();
+		x2.clear(); y2.clear(); z2.clear();
+		x3.clear(); y3.clear(); z3.clear();
+		count = 0;
+	}
+
+	//Assume that p1, p2 and p3 are given in front-facing order, like checkTriangle
+	void add(const vec3 &p1, const vec3 &p2, const vec3 &p3)
+	{
+		//Overwrite the padding left by the previous pad() call, if any
+		resize(count);
+		x1.push_back(p1.x); y1.push_back(p1.y); z1.push_back(p1.z);
+		x2.push_back(p2.x); y2.push_back(p2.y); z2.push_back(p2.z);
+		x3.push_back(p3.x); y3.push_back(p3.y); z3.push_back(p3.z);
+		count++;
+	}
+
+	//Fill the tail with zeroed triangles so the last SIMD load stays in bounds
+	void pad()
+	{
+		resize((count + PADDING - 1) / PADDING * PADDING);
+	}
+
+private:
+	void resize(unsigned int size)
+	{
+		x1.resize(size); y1.resize(size); z1.resize(size);
+		x2.resize(size); y2.resize(size); z2.resize(size);
+		x3.resize(size); y3.resize(size); z3.resize(size);
+	}
 };
\ No newline at end of file